@@ -66,15 +66,36 @@ luau_db_getUpdateInfo(AUpdate *update, const char* updateID, const AProgInfo *pr
 
 GList *
 luau_db_checkForUpdates(const AProgInfo *info, GError **err) {
+	return luau_db_checkForUpdates_fields(info, LUAU_FIELDS_FULL, err);
+}
+
+GList *
+luau_db_checkForUpdates_fields(const AProgInfo *info, AUpdateFields fields, GError **err) {
 	GList *results;
 	
-	results = luau_checkForUpdates(info, err);
+	results = luau_checkForUpdates_fields(info, fields, err);
 	if (results != NULL)
 		luau_db_categorizeUpdateList(results, info);
 	
 	return results;
 }
 
+GPtrArray *
+luau_db_checkForUpdates_all(const GPtrArray *infos, AUpdateFields fields, int maxConcurrent, GPtrArray *errors) {
+	GPtrArray *results;
+	GList *updates;
+	unsigned int i;
+	
+	results = luau_checkForUpdates_all(infos, fields, maxConcurrent, errors);
+	for (i = 0; i < results->len; ++i) {
+		updates = g_ptr_array_index(results, i);
+		if (updates != NULL)
+			luau_db_categorizeUpdateList(updates, g_ptr_array_index(infos, i));
+	}
+	
+	return results;
+}
+
 
 /**
  * Retrieve program information for \c progID from the luau database and store it in \c info.
@@ -46,6 +46,8 @@ LUAU_DLL_EXPORT gboolean luau_db_closeThreadedEnvironment(void);
 LUAU_DLL_EXPORT gboolean luau_db_getUpdateInfo(AUpdate *update, const char* updateID, const AProgInfo *progInfo, GError **err);
 /// Retrieve any new updates for the specified program
 LUAU_DLL_EXPORT GList* luau_db_checkForUpdates(const AProgInfo *info, GError **err);
+LUAU_DLL_EXPORT GList* luau_db_checkForUpdates_fields(const AProgInfo *info, AUpdateFields fields, GError **err);
+LUAU_DLL_EXPORT GPtrArray* luau_db_checkForUpdates_all(const GPtrArray *infos, AUpdateFields fields, int maxConcurrent, GPtrArray *errors);
 
 /// Retrieve program info (version, updates url, etc.) from the luau database given the ID
 LUAU_DLL_EXPORT gboolean luau_db_getProgInfo(AProgInfo *progInfo, const char* progID, GError **err);
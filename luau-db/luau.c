@@ -58,6 +58,7 @@
 
 
 static int verbosity = 1;
+static int jobs = LUAU_DEFAULT_CONCURRENCY;
 static gboolean outputToString = FALSE;
 static GString *outputString = NULL;
 
@@ -72,6 +73,7 @@ static int getUpdates(const char* program, APkgType type);
 static void runInteractive(void);
 static void printInteractiveHelp(void);
 static int list(const char* program);
+static void freeProgInfoArray(GPtrArray *infos);
 
 static gint compareUpdates(gconstpointer p1, gconstpointer p2); /*, gpointer data);*/
 static int progressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
@@ -87,7 +89,7 @@ main(int argc, char *argv[]) {
 	
 	srand(time(NULL));
 	
-	while ((c = getopt_long(argc, argv, ":d:e:gilhm:o:p:t:vq", longOptions, NULL)) != -1) {
+	while ((c = getopt_long(argc, argv, ":d:e:gij:lhm:o:p:st:vq", longOptions, NULL)) != -1) {
 		switch (c) {
 			case 'd':
 			case 'e':
@@ -104,6 +106,14 @@ main(int argc, char *argv[]) {
 				}
 				break;
 				
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs <= 0) {
+					ERROR("Invalid number of simultaneous downloads: %s", optarg);
+					printUsage();
+					exit(1);
+				}
+				break;
 			case 'm':
 				email = g_strdup(optarg);
 				outputToString = TRUE;
@@ -115,6 +125,9 @@ main(int argc, char *argv[]) {
 			case 'p':
 				program = g_strdup(optarg);
 				break;
+			case 's':
+				luau_setDownloadMode(LUAU_DOWNLOAD_SEGMENTED);
+				break;
 			case 't':
 				typeName = g_strdup(optarg);
 				break;
@@ -225,6 +238,8 @@ main(int argc, char *argv[]) {
 	g_free(typeName);
 	g_free(arg);
 	
+	luau_cleanup();
+	
 #ifdef WITH_LEAKBUG
 	lbDumpLeaks();
 #endif
@@ -356,11 +371,11 @@ installUpdate(const char* ID, const char* program, APkgType type) {
 
 static int
 getUpdates(const char* program, APkgType type) {
-	AProgInfo info;
+	AProgInfo info, *progInfo;
 	GContainer *allUpdates;
 	GIterator iter;
 	GList *updates, *curr, *temp;
-	GPtrArray *progs;
+	GPtrArray *progs, *infos, *results, *errors;
 	GError *err = NULL;
 	const char* updateType;
 	char *packageType, *desc;
@@ -376,28 +391,51 @@ getUpdates(const char* program, APkgType type) {
 			ERROR("Couldn't retrieve list of registered programs: exiting");
 			exit(1);
 		}
+		
+		infos = g_ptr_array_new();
 		for (i = 0; i < progs->len; ++i) {
 			program = g_ptr_array_index(progs, i);
-			result = luau_db_getProgInfo(&info, program, &err);
+			progInfo = g_malloc(sizeof(AProgInfo));
+			result = luau_db_getProgInfo(progInfo, program, &err);
 			if (result == FALSE) {
 				g_assert(err != NULL);
 				ERROR("Couldn't retrieve program information for %s: %s", program, err->message);
 				g_error_free(err);
+				g_free(progInfo);
+				freeProgInfoArray(infos);
 				g_container_destroy_type(GCONT_PTR_ARRAY, progs);
 				return 1;
 			}
-			updates = luau_db_checkForUpdates(&info, &err);
+			g_ptr_array_add(infos, progInfo);
+		}
+		
+		/* Contact all the servers at once, then handle the results in order (only
+		   what's listed is read in: updates are looked up again to be installed) */
+		errors = g_ptr_array_new();
+		results = luau_db_checkForUpdates_all(infos, LUAU_FIELDS_SUMMARY, jobs, errors);
+		
+		for (i = 0; i < progs->len; ++i) {
+			program = g_ptr_array_index(progs, i);
+			progInfo = g_ptr_array_index(infos, i);
+			updates = g_ptr_array_index(results, i);
+			err = g_ptr_array_index(errors, i);
 			if (err != NULL) {
 				g_assert(updates == NULL);
 				ERROR("Couldn't retrieve updates for %s: %s", program, err->message);
-				g_error_free(err);
+				for (; i < progs->len; ++i) {
+					if (g_ptr_array_index(errors, i) != NULL)
+						g_error_free(g_ptr_array_index(errors, i));
+					luau_freeUpdateList(g_ptr_array_index(results, i));
+				}
+				g_ptr_array_free(errors, TRUE);
+				g_ptr_array_free(results, TRUE);
+				freeProgInfoArray(infos);
 				g_container_destroy_type(GCONT_PTR_ARRAY, progs);
-				luau_freeProgInfo(&info);
 				return 1;
 			}
 			
 			g_free((char*)program);
-			progs->pdata[i] = g_strdup(info.fullname);
+			progs->pdata[i] = g_strdup(progInfo->fullname);
 			
 			for (curr = updates; curr != NULL; curr = curr->next) {
 UPDATE_LOOP1:
@@ -428,8 +466,10 @@ UPDATE_LOOP1:
 				g_assert(update != NULL);
 			}
 			g_container_add(allUpdates, updates);
-			luau_freeProgInfo(&info);
 		}
+		g_ptr_array_free(errors, TRUE);
+		g_ptr_array_free(results, TRUE);
+		freeProgInfoArray(infos);
 		program = NULL;
 	} else {
 		result = luau_db_getProgInfo(&info, program, &err);
@@ -439,7 +479,7 @@ UPDATE_LOOP1:
 			g_error_free(err);
 			return 1;
 		}
-		updates = luau_db_checkForUpdates(&info, &err);
+		updates = luau_db_checkForUpdates_fields(&info, LUAU_FIELDS_SUMMARY, &err);
 		if (err != NULL) {
 			g_assert(updates == NULL);
 			ERROR("Couldn't retrieve updates for %s", program);
@@ -756,9 +796,11 @@ printUsage() {
 	MSG(0, "  -h, --help            display this message\n");
 	MSG(0, "\n");
 	MSG(0, "  Extra Information:\n");
+	MSG(0, "  -j, --jobs=N          check up to N programs for updates simultaneously\n");
 	MSG(0, "  -m, --email=ADDRESS   email the results to ADDRESS, if any results at all\n");
 	MSG(0, "  -o, --output=PATH     when downloading an update, specify where to download\n");
 	MSG(0, "  -p, --program=NAME    specify a program\n");
+	MSG(0, "  -s, --segmented       download packages in pieces from several mirrors at once\n");
 	MSG(0, "  -t, --type=TYPE       specify the type of update to download/install\n");
 	MSG(0, "  -q, --quiet           suppress all unnecessary output\n");
 	MSG(0, "  -v, --verbose         display more informational output\n");
@@ -833,12 +875,33 @@ getLongOptions() {
 	options[9].flag = NULL;
 	options[9].val = 'v';
 	
-	memset(&options[12], 0, sizeof(struct option));
+	options[12].name = "jobs";
+	options[12].has_arg = 1;
+	options[12].flag = NULL;
+	options[12].val = 'j';
+	
+	options[13].name = "segmented";
+	options[13].has_arg = 0;
+	options[13].flag = NULL;
+	options[13].val = 's';
+	
+	memset(&options[14], 0, sizeof(struct option));
 	
 	return options;
 }
 
 
+static void
+freeProgInfoArray(GPtrArray *infos) {
+	unsigned int i;
+	
+	for (i = 0; i < infos->len; ++i) {
+		luau_freeProgInfo(g_ptr_array_index(infos, i));
+		g_free(g_ptr_array_index(infos, i));
+	}
+	g_ptr_array_free(infos, TRUE);
+}
+
 static gint
 compareUpdates(gconstpointer p1, gconstpointer p2) { /*, gpointer data) {*/
 	/* Used by g_ptr_array_sort */
@@ -57,21 +57,36 @@ static void printerror(char *s, ...)
 
 static int download_url_update(char *url, const char *update_name, const AInterface *interface, const char *version, const char *packageVersion, const char *instVersion, const char *instPackage, const char *output, gboolean look_for_meta);
 static char* download_update(AProgInfo *progInfo, AUpdate *updateInfo, APkgType pkgtype, const char *output, gboolean lookForMeta);
-static char* download_file(const char *url, const char *output);
+static char* download_file(const char *url, const char *output, const APackage *package);
 
 static AUpdate *find_update(const AProgInfo *prog_info, const AInterface *interface, const char *version, const char *pkgVersion, const char *update_name);
-static GList* get_updates_of_type(const AProgInfo *progInfo, APkgType type);
+static GList* get_updates_of_type(const AProgInfo *progInfo, APkgType type, AUpdateFilter *filter);
 
 static gboolean curl_fetch(const char *url, const char *loc);
-static gboolean curl_exists(const char *url);
+static gboolean segmented_fetch(const APackage *package, const char *loc);
+static void start_download(void);
 
 static int progress_callback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
-static size_t autofail_callback(void *ptr, size_t size, size_t nmemb, void *stream);
+static size_t write_callback(void *ptr, size_t size, size_t nmemb, void *stream);
 
 static void print_usage(void);
 static struct option* get_long_options();
 
 static char *outpipe = "/dev/stdin";
+static gboolean segmented = FALSE;
+
+/* the frontend is only told about a download once data starts
+ * arriving, so a missing file costs a single request and produces no
+ * DOWNLOAD-* messages at all */
+static const char *download_name = NULL;
+static gboolean download_started = FALSE;
+
+/* a file being fetched by curl_fetch; it is created when the first data arrives */
+struct fetch
+{
+    const char *loc;
+    FILE *file;
+};
 
 /* reads from the pipe into a temporary buffer. used to receive frontends "OK" response */
 static void wait_for_frontend()
@@ -104,7 +119,7 @@ int main(int argc, char *argv[])
     options = get_long_options();
     luau_registerProgressCallback(progress_callback);
 
-    while ((c = getopt_long(argc, argv, ":P:p:u:n:f:o:i:v:V:K:mh", options, NULL)) != -1)
+    while ((c = getopt_long(argc, argv, ":P:p:u:n:f:o:i:v:V:K:msh", options, NULL)) != -1)
     {
 	switch (c) {
 	case 'P':
@@ -141,6 +156,10 @@ int main(int argc, char *argv[])
 	case 'm':
 	    look_for_meta = TRUE;
 	    break;
+	case 's':
+	    segmented = TRUE;
+	    luau_setDownloadMode(LUAU_DOWNLOAD_SEGMENTED);
+	    break;
 	case 'h':
 	    print_usage();
 	    ret = 0;
@@ -175,7 +194,7 @@ int main(int argc, char *argv[])
 	}
 	else if (file)
 	{
-	    char *result = download_file(file, output);
+	    char *result = download_file(file, output, NULL);
 	    ret = (result != NULL);
 	    g_free(result);
 	}
@@ -199,6 +218,7 @@ end:
     if (instVersion) g_free(instVersion);
 
     g_free(options);
+    luau_cleanup();
     return ret;
 }
 
@@ -240,9 +260,11 @@ static char *download_update(AProgInfo *prog_info, AUpdate *update_info,
 			     APkgType pkgtype, const char *output,
 			     gboolean look_for_meta)
 {
-    APackage *package;
-    char *loc, *url, *url2;
+    APackage *package, segmented_package;
+    GPtrArray *mirrors;
+    char *loc, *url, *url2, *suffix;
     GError *error = NULL;
+    unsigned int i;
 
     if (!(package = luau_getUpdatePackage(update_info, pkgtype, &error)))
     {
@@ -270,8 +292,41 @@ static char *download_update(AProgInfo *prog_info, AUpdate *update_info,
         terminator = ".payload";
     }
     
-    url2 = g_strdup_printf("%s%s", url, look_for_meta ? ".meta" : terminator);
-    loc = download_file(url2, output);
+    suffix = look_for_meta ? ".meta" : terminator;
+    url2 = g_strdup_printf("%s%s", url, suffix);
+    g_free(url);
+
+    if (!segmented)
+    {
+	loc = download_file(url2, output, NULL);
+	g_free(url2);
+	return loc;
+    }
+
+    /* same package, but with the suffix applied to every mirror (those of
+     * its shared mirror set included, so the copy doesn't need the set)
+     */
+    mirrors = luau_getPackageMirrors(package);
+    for (i = 1; i < mirrors->len; i += 2)
+    {
+	url = g_ptr_array_index(mirrors, i);
+	g_ptr_array_index(mirrors, i) = g_strdup_printf("%s%s", url, suffix);
+	g_free(url);
+    }
+    segmented_package = *package;
+    segmented_package.mirrors = mirrors;
+    segmented_package.mirrorSet = NULL;
+    segmented_package.mirrorPath = NULL;
+    if (suffix[0] != '\0')
+    {
+	/* not the package itself: size and md5 sum unknown */
+	segmented_package.size = 0;
+	segmented_package.md5sum[0] = '\0';
+    }
+
+    loc = download_file(url2, output, &segmented_package);
+
+    luau_freePackageMirrors(mirrors);
     g_free(url2);
 
     return loc;
@@ -295,21 +350,22 @@ static void out(char *s, ...)
 }
 
 /* downloads the file at URL "url" to the output path "output" (can be
- * directory or file) then returns its full path or NULL on error.
+ * directory or file) then returns its full path or NULL on error. if
+ * "package" is non-null, the file is fetched from all of its mirrors
+ * at once instead.
  */
-static char *download_file(const char *url, const char *output)
+static char *download_file(const char *url, const char *output, const APackage *package)
 {
     char *loc, *realURL;
     int len, i;
     const char *filename;
+    gboolean ok;
 
     realURL = NULL;
 
     if (output == NULL || output[0] == '\0')
 	output = "/tmp";
 
-    if (!curl_exists(url)) return NULL;
-
     if (lutil_isDirectory(output))
     {
 	/* invalid URLs include http://foo.org, http://foo.org/ etc .. it must have a file name */
@@ -334,18 +390,23 @@ static char *download_file(const char *url, const char *output)
     }
 
     /* make url short enough for frontend */
-    char *urldesc = strdup(url);
-    if (strrchr(urldesc, '/')) urldesc = strrchr(urldesc, '/');
-    out("DOWNLOAD-START\n%s\nDescription?\n", ++urldesc);
+    download_name = strrchr(url, '/') ? strrchr(url, '/') + 1 : url;
+    download_started = FALSE;
 
-    wait_for_frontend();
+    /* ok, start the download */
+    ok = package ? segmented_fetch(package, loc) : curl_fetch(url, loc);
 
-    out("DOWNLOAD-PREPARE\nCONNECTING\n\n");
+    /* an empty file never triggers the frontend messages by itself */
+    if (ok) start_download();
 
-    wait_for_frontend();
+    /* the file isn't there (or the server couldn't be reached) */
+    if (!download_started)
+    {
+	g_free(loc);
+	return NULL;
+    }
 
-    /* ok, start the download */
-    if (!curl_fetch(url, loc))
+    if (!ok)
     {
 	g_free(loc);
 	loc = NULL;
@@ -399,7 +460,7 @@ static AUpdate *find_update(const AProgInfo *prog_info, const AInterface *interf
     {
 	g_assert( !update_name && !interface );
 
-	all_updates = get_updates_of_type(prog_info, LUAU_AUTOPKG);
+	all_updates = get_updates_of_type(prog_info, LUAU_AUTOPKG, NULL);
 	if (!all_updates) return NULL;
 
 	current = all_updates;
@@ -422,10 +483,17 @@ static AUpdate *find_update(const AProgInfo *prog_info, const AInterface *interf
     else if (interface)
     {
 	AUpdate *candidate = NULL;
+	AUpdateFilter filter;
 
 	g_assert( !version && !update_name );
 
-	all_updates = get_updates_of_type(prog_info, LUAU_AUTOPKG);
+	/* only the one with the highest minor version is any use */
+	luau_initUpdateFilter(&filter);
+	filter.interfaceMajor = interface->major;
+	filter.limit = 1;
+	filter.order = LUAU_ORDER_INTERFACE;
+
+	all_updates = get_updates_of_type(prog_info, LUAU_AUTOPKG, &filter);
 	if (!all_updates) return NULL;
 
 	current = all_updates;
@@ -441,8 +509,15 @@ static AUpdate *find_update(const AProgInfo *prog_info, const AInterface *interf
     else
     {
 	AUpdate *candidate = NULL;
+	AUpdateFilter filter;
 
-	all_updates = get_updates_of_type(prog_info, LUAU_AUTOPKG);
+	/* only the newest is any use, and only if it's newer than what's installed */
+	luau_initUpdateFilter(&filter);
+	filter.newerOnly = TRUE;
+	filter.limit = 1;
+	filter.order = LUAU_ORDER_NEWEST;
+
+	all_updates = get_updates_of_type(prog_info, LUAU_AUTOPKG, &filter);
 	if (!all_updates) return NULL;
 
 	current = all_updates;
@@ -478,57 +553,67 @@ static AUpdate *find_update(const AProgInfo *prog_info, const AInterface *interf
     }
 }
 
-/* return a list of any updates matching the given type */
-static GList *get_updates_of_type(const AProgInfo *progInfo, APkgType type)
+/* return a list of any software updates matching the given type (and passing
+   filter, if it isn't NULL).  The others are never read in at all. */
+static GList *get_updates_of_type(const AProgInfo *progInfo, APkgType type, AUpdateFilter *filter)
 {
-    GList *updates = NULL;
-    GList *current;
-    AUpdate *update;
+    AUpdateFilter all;
+    GList *updates;
     GError *error = NULL;
 
-    if (!(updates = luau_checkForUpdates(progInfo, &error)))
+    if (!filter)
+    {
+	luau_initUpdateFilter(&all);
+	filter = &all;
+    }
+    filter->type = LUAU_SOFTWARE;
+    filter->formats = type;
+
+    updates = luau_checkForUpdates_filtered(progInfo, filter, LUAU_FIELDS_FULL, &error);
+    if (!updates && error)
     {
-	g_assert(error != NULL);
 	printerror("Couldn't retrieve updates for program: %s", error->message);
 	g_error_free(error);
 	return NULL;
     }
 
-    current = updates;
+    return updates;
+}
 
-    /* eliminate unsuitable updates from the list */
-    do {
-	update = (AUpdate *)current->data;
+/* tells the frontend a download has started: called once the first data arrives */
+static void start_download(void)
+{
+    if (download_started) return;
+    download_started = TRUE;
 
-	if ((update->type != LUAU_SOFTWARE) || !luau_isOfType(update->availableFormats, type))
-	{
-	    luau_freeUpdateInfo(update);
-	    g_free(update);
-	    current->data = NULL;
-	}
-    } while ((current = g_list_next(current)));
+    out("DOWNLOAD-START\n%s\nDescription?\n", download_name);
+
+    wait_for_frontend();
+
+    out("DOWNLOAD-PREPARE\nCONNECTING\n\n");
 
-    return g_list_remove_all(updates, NULL);
+    wait_for_frontend();
 }
 
+/* fetches the file in a single request: if it doesn't exist, the
+ * server's error status arrives before any data and nothing is written */
 static gboolean curl_fetch(const char *url, const char *loc)
 {
     CURL *curl_handle;
     CURLcode ret;
-    FILE *tmp;
+    struct fetch fetch;
     time_t now = time(NULL);
     char buf[CURL_ERROR_SIZE];
 
-    if (!(tmp = fopen(loc, "w")))
-    {
-	printerror("Couldn't download file to specified location %s: %s", loc, strerror(errno));
-	return FALSE;
-    }
+    fetch.loc = loc;
+    fetch.file = NULL;
+    buf[0] = '\0';
 
-    curl_handle = curl_easy_init();
+    curl_handle = luau_acquireTransferHandle();
 
     curl_easy_setopt(curl_handle, CURLOPT_URL, url);
-    curl_easy_setopt(curl_handle, CURLOPT_FILE, (void *)tmp);
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *)&fetch);
     curl_easy_setopt(curl_handle, CURLOPT_ERRORBUFFER, buf);
     curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, 15);
 
@@ -542,49 +627,75 @@ static gboolean curl_fetch(const char *url, const char *loc)
 
     ret = curl_easy_perform(curl_handle);
 
-    curl_easy_cleanup(curl_handle);
+    luau_releaseTransferHandle(curl_handle);
+
+    /* an empty file: create it */
+    if (ret == 0 && !fetch.file && !(fetch.file = fopen(loc, "w")))
+    {
+	printerror("Couldn't download file to specified location %s: %s", loc, strerror(errno));
+	return FALSE;
+    }
 
-    fclose(tmp);
+    if (fetch.file && fclose(fetch.file) != 0 && ret == 0)
+    {
+	printerror("Couldn't write to %s: %s", loc, strerror(errno));
+	unlink(loc);
+	return FALSE;
+    }
 
     if (ret == 0) return TRUE;
 
-    unlink(loc);
-    printerror("Couldn't download %s: %s", url, buf);
+    if (fetch.file) unlink(loc);
+    if (download_started) printerror("Couldn't download %s: %s", url, buf[0] ? buf : curl_easy_strerror(ret));
     return FALSE;
 }
 
-
-static gboolean curl_exists(const char *url)
+static gboolean segmented_fetch(const APackage *package, const char *loc)
 {
-    CURL *curl_handle;
-    CURLcode ret;
+    GError *error = NULL;
+
+    if (!luau_downloadPackage(package, loc, &error))
+    {
+	g_assert(error != NULL);
+	if (download_started) printerror("Couldn't download %s: %s", loc, error->message);
+	g_error_free(error);
+	return FALSE;
+    }
 
-    curl_handle = curl_easy_init();
+    return TRUE;
+}
 
-    curl_easy_setopt(curl_handle, CURLOPT_URL, url);
-    curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, autofail_callback);
-    curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT, 15);
-    curl_easy_setopt(curl_handle, CURLOPT_FAILONERROR, 1);
+static size_t write_callback(void *ptr, size_t size, size_t nmemb, void *stream)
+{
+    struct fetch *fetch = (struct fetch *) stream;
 
-    ret = curl_easy_perform(curl_handle);
+    if (!fetch->file)
+    {
+	start_download();
 
-    curl_easy_cleanup(curl_handle);
+	if (!(fetch->file = fopen(fetch->loc, "w")))
+	{
+	    printerror("Couldn't download file to specified location %s: %s", fetch->loc, strerror(errno));
+	    return 0;
+	}
+    }
 
-    /* If the connection is made and the file exists, the write
-       function 'autofail_callback' will be called (which then signals
-       an error and causes libcurl to return a write error
-       ("CURLE_WRITE_ERROR").  Otherwise, some other error will be
-       returned, meaning the file cannot be retrieved. */
-    return (ret == CURLE_WRITE_ERROR);
+    return fwrite(ptr, size, nmemb, fetch->file) * size;
 }
 
-
 static int progress_callback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow)
 {
     int remaining;
     float rate;
     static int last_dl = 0;
 
+    /* nothing has arrived yet, so the frontend doesn't know about this download */
+    if (!download_started)
+    {
+	if (dlnow <= 0) return 0;
+	start_download();
+    }
+
     GString *buf = g_string_new("DOWNLOAD-PROGRESS\n");
     rate = (dlnow - last_dl) / 1024;
     last_dl = dlnow;
@@ -612,12 +723,6 @@ static int progress_callback(void *clientp, double dltotal, double dlnow, double
     return 0;
 }
 
-static size_t autofail_callback(void *ptr, size_t size, size_t nmemb, void *stream)
-{
-    return 0; /* causes libcurl to disconnect with CURLE_WRITE_ERROR */
-}
-
-
 static void print_usage()
 {
     printf("Usage: luau-download [OPTION] ...\n");
@@ -636,7 +741,8 @@ static void print_usage()
     printf("  -V, --instvers='VERSION'  installed program version number\n");
     printf("  -K, --instpkg='VERSION'   installed package version number\n\n");
 
-    printf("  -m, --meta                check for and download .meta file, if available\n\n");
+    printf("  -m, --meta                check for and download .meta file, if available\n");
+    printf("  -s, --segmented           download from several mirrors at once\n\n");
 
     printf("  -o, --output='PATH'       file or directory to download to\n");
     printf("  -h, --help                display this message\n");
@@ -650,7 +756,7 @@ static void print_usage()
 
 static struct option *get_long_options()
 {
-    struct option *options = (struct option *) calloc(12, sizeof(struct option));
+    struct option *options = (struct option *) calloc(13, sizeof(struct option));
 
     options[0].name = "version";
     options[0].has_arg = 1;
@@ -707,7 +813,12 @@ static struct option *get_long_options()
     options[10].flag = NULL;
     options[10].val = 'K';
 
-    memset(&options[11], 0, sizeof(struct option));
+    options[11].name = "segmented";
+    options[11].has_arg = 0;
+    options[11].flag = NULL;
+    options[11].val = 's';
+
+    memset(&options[12], 0, sizeof(struct option));
 
     return options;
 }
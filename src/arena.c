@@ -0,0 +1,346 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdarg.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "libuau.h"
+#include "arena.h"
+
+#ifdef WITH_DMALLOC
+#  include <dmalloc.h>
+#endif
+
+/// Every allocation is aligned to this many bytes
+#define ARENA_ALIGN 8
+/// Size of the first block of an arena; each block after it is twice as big...
+#define ARENA_FIRST_BLOCK (16 * 1024)
+/// ...up to this size (larger requests get a block of their own)
+#define ARENA_MAX_BLOCK (1024 * 1024)
+
+#define ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~((gsize) ARENA_ALIGN - 1))
+
+/// One block of an arena's memory (the memory itself follows the header)
+typedef struct _AArenaBlock AArenaBlock;
+struct _AArenaBlock {
+	AArenaBlock *next;
+	gsize size;
+	gsize used;
+};
+
+#define BLOCK_HEADER   ALIGN_UP(sizeof(AArenaBlock))
+#define BLOCK_DATA(b)  ((char *) (b) + BLOCK_HEADER)
+
+struct _AArena {
+	gint refCount;
+	/// Block currently being allocated from first, then the full ones
+	AArenaBlock *blocks;
+	/// Size of the next block to be allocated
+	gsize nextSize;
+	/// Set of interned strings, themselves allocated from the arena (created the
+	/// first time a string is interned)
+	GHashTable *strings;
+	/// Pointer arrays free'd along with the arena (see luau_arena_newPtrArray)
+	GSList *arrays;
+};
+
+static AArenaBlock* newBlock(AArena *arena, gsize size);
+
+
+/**
+ * Create a new (empty) arena.  No memory is allocated for its contents until
+ * something is allocated from it.
+ *
+ * @return the arena, with one reference (to be dropped with \ref luau_arena_unref)
+ */
+AArena *
+luau_arena_new(void) {
+	AArena *arena;
+	
+	arena = g_malloc(sizeof(AArena));
+	arena->refCount = 1;
+	arena->blocks = NULL;
+	arena->nextSize = ARENA_FIRST_BLOCK;
+	arena->strings = NULL;
+	arena->arrays = NULL;
+	
+	return arena;
+}
+
+/**
+ * Take another reference to an arena.
+ *
+ * @arg <i>arena</i> is the arena.
+ * @return \c arena
+ */
+AArena *
+luau_arena_ref(AArena *arena) {
+	g_atomic_int_inc(&(arena->refCount));
+	return arena;
+}
+
+/**
+ * Drop a reference to an arena.  When the last reference goes, everything
+ * allocated from the arena is free'd in one go.
+ *
+ * @arg <i>arena</i> is the arena (may be NULL).
+ */
+void
+luau_arena_unref(AArena *arena) {
+	AArenaBlock *block, *next;
+	GSList *curr;
+	
+	if (arena == NULL || !g_atomic_int_dec_and_test(&(arena->refCount)))
+		return;
+	
+	for (block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		g_free(block);
+	}
+	if (arena->strings != NULL)
+		g_hash_table_destroy(arena->strings);
+	for (curr = arena->arrays; curr != NULL; curr = curr->next)
+		g_ptr_array_free((GPtrArray *) curr->data, TRUE);
+	g_slist_free(arena->arrays);
+	g_free(arena);
+}
+
+/**
+ * Allocate memory from an arena.  The memory can't be free'd by itself; it goes
+ * when the arena does.
+ *
+ * @arg <i>arena</i> is the arena.
+ * @arg <i>size</i> is the number of bytes wanted.
+ * @return the (uninitialized) memory, aligned for any of luau's structures
+ */
+gpointer
+luau_arena_alloc(AArena *arena, gsize size) {
+	AArenaBlock *block;
+	gpointer mem;
+	
+	size = ALIGN_UP(MAX(size, 1));
+	
+	block = arena->blocks;
+	if (block == NULL || block->size - block->used < size)
+		block = newBlock(arena, size);
+	
+	mem = BLOCK_DATA(block) + block->used;
+	block->used += size;
+	
+	return mem;
+}
+
+/**
+ * Copy a string into an arena.
+ *
+ * @arg <i>arena</i> is the arena.
+ * @arg <i>str</i> is the string to copy.
+ * @return the copy, or NULL if \c str is NULL
+ */
+char *
+luau_arena_strdup(AArena *arena, const char *str) {
+	char *copy;
+	gsize len;
+	
+	if (str == NULL)
+		return NULL;
+	
+	len = strlen(str) + 1;
+	copy = luau_arena_alloc(arena, len);
+	memcpy(copy, str, len);
+	
+	return copy;
+}
+
+/**
+ * Copy part of a string into an arena.
+ *
+ * @arg <i>arena</i> is the arena.
+ * @arg <i>str</i> is the start of the part to copy (it needn't be NUL-terminated).
+ * @arg <i>len</i> is the number of bytes to copy.
+ * @return the copy, with a NUL added to the end
+ */
+char *
+luau_arena_strndup(AArena *arena, const char *str, gsize len) {
+	char *copy;
+	
+	copy = luau_arena_alloc(arena, len + 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	
+	return copy;
+}
+
+/**
+ * Concatenate strings into an arena (like lutil_vstrcreate, but without the
+ * intermediate allocation).
+ *
+ * @arg <i>arena</i> is the arena.
+ * @arg <i>first</i> is the first of a NULL-terminated list of strings.
+ * @return the concatenation
+ */
+char *
+luau_arena_strconcat(AArena *arena, const char *first, ...) {
+	va_list args;
+	const char *str;
+	char *result, *pos;
+	gsize len = 1;
+	
+	va_start(args, first);
+	for (str = first; str != NULL; str = va_arg(args, const char *))
+		len += strlen(str);
+	va_end(args);
+	
+	result = pos = luau_arena_alloc(arena, len);
+	
+	va_start(args, first);
+	for (str = first; str != NULL; str = va_arg(args, const char *)) {
+		len = strlen(str);
+		memcpy(pos, str, len);
+		pos += len;
+	}
+	va_end(args);
+	*pos = '\0';
+	
+	return result;
+}
+
+/**
+ * Look up a string in an arena's table of shared strings, adding it if it isn't
+ * there yet.  Every string interned into the same arena with the same contents
+ * comes back as the same pointer, so the strings repeated all over a repository
+ * file (keywords, versions) are only stored once, and can be compared
+ * by address.  The result must not be changed.
+ *
+ * @arg <i>arena</i> is the arena.
+ * @arg <i>str</i> is the string to intern.
+ * @return the shared copy, or NULL if \c str is NULL
+ */
+const char *
+luau_arena_intern(AArena *arena, const char *str) {
+	char *shared;
+	
+	if (str == NULL)
+		return NULL;
+	
+	if (arena->strings == NULL)
+		arena->strings = g_hash_table_new(g_str_hash, g_str_equal);
+	
+	shared = g_hash_table_lookup(arena->strings, str);
+	if (shared == NULL) {
+		shared = luau_arena_strdup(arena, str);
+		g_hash_table_insert(arena->strings, shared, shared);
+	}
+	
+	return shared;
+}
+
+/**
+ * Intern part of a string (see \ref luau_arena_intern).  Short strings are only
+ * copied into the arena if they aren't there already.
+ *
+ * @arg <i>arena</i> is the arena.
+ * @arg <i>str</i> is the start of the part to intern (it needn't be NUL-terminated).
+ * @arg <i>len</i> is the number of bytes in it.
+ * @return the shared copy
+ */
+const char *
+luau_arena_internLen(AArena *arena, const char *str, gsize len) {
+	char small[128], *key;
+	const char *shared;
+	
+	/* The table needs a NUL-terminated key to look up */
+	key = (len < sizeof(small)) ? small : g_malloc(len + 1);
+	memcpy(key, str, len);
+	key[len] = '\0';
+	
+	shared = luau_arena_intern(arena, key);
+	
+	if (key != small)
+		g_free(key);
+	
+	return shared;
+}
+
+/**
+ * Check whether a string is an arena's shared copy (see \ref luau_arena_intern).
+ * This is a single table lookup which doesn't change the arena, so any number of
+ * threads can ask at once once the arena is no longer being filled in.
+ *
+ * @arg <i>arena</i> is the arena (may be NULL).
+ * @arg <i>str</i> is the string.
+ * @return TRUE if \c str is the string interned in \c arena (not just an equal one)
+ */
+gboolean
+luau_arena_isInterned(const AArena *arena, const char *str) {
+	if (arena == NULL || str == NULL || arena->strings == NULL)
+		return FALSE;
+	
+	return (g_hash_table_lookup(arena->strings, str) == str);
+}
+
+/**
+ * Create a pointer array which belongs to an arena: it is free'd along with the
+ * arena's memory (what it points to isn't), so it mustn't be free'd by itself.
+ *
+ * @arg <i>arena</i> is the arena.
+ * @return the (empty) array
+ */
+GPtrArray *
+luau_arena_newPtrArray(AArena *arena) {
+	GPtrArray *array;
+	
+	array = g_ptr_array_new();
+	arena->arrays = g_slist_prepend(arena->arrays, array);
+	
+	return array;
+}
+
+/* Non-Interface Methods */
+
+/* Add a block with room for at least \c size bytes to an arena and return it */
+static AArenaBlock *
+newBlock(AArena *arena, gsize size) {
+	AArenaBlock *block;
+	gsize blockSize;
+	
+	blockSize = MAX(arena->nextSize, size);
+	
+	block = g_malloc(BLOCK_HEADER + blockSize);
+	block->size = blockSize;
+	block->used = 0;
+	
+	if (size > arena->nextSize && arena->blocks != NULL) {
+		/* A one-off: keep allocating from the current block afterwards */
+		block->next = arena->blocks->next;
+		arena->blocks->next = block;
+	} else {
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->nextSize = MIN(arena->nextSize * 2, ARENA_MAX_BLOCK);
+	}
+	
+	return block;
+}
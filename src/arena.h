@@ -0,0 +1,70 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+
+/** @file arena.h
+ * \brief Region allocator for parsed updates
+ *
+ * Everything the parser allocates for the updates in one repository file (their
+ * strings, dates, packages and quantifiers) is carved out of a few large blocks
+ * belonging to one arena, instead of being allocated piece by piece.  Each update
+ * holds a reference to its arena, and the blocks are released all at once when
+ * the last of those updates is free'd.  Strings that recur throughout a file can
+ * be interned, so that all the updates share one copy.
+ *
+ * Allocating from an arena isn't thread-safe (only the parser filling it in does
+ * that); taking and dropping references is.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "libuau.h"
+
+/// Create a new arena (with one reference, held by the caller)
+AArena* luau_arena_new(void);
+/// Take another reference to an arena
+AArena* luau_arena_ref(AArena *arena);
+/// Drop a reference to an arena, releasing its memory when the last one goes
+void luau_arena_unref(AArena *arena);
+
+/// Allocate \c size bytes from an arena
+gpointer luau_arena_alloc(AArena *arena, gsize size);
+/// Copy a string into an arena (NULL stays NULL)
+char* luau_arena_strdup(AArena *arena, const char *str);
+/// Copy \c len bytes of a string into an arena, NUL-terminated
+char* luau_arena_strndup(AArena *arena, const char *str, gsize len);
+/// Concatenate a NULL-terminated list of strings into an arena
+char* luau_arena_strconcat(AArena *arena, const char *first, ...);
+/// Get the arena's single shared copy of a string (NULL stays NULL)
+const char* luau_arena_intern(AArena *arena, const char *str);
+/// Get the arena's single shared copy of the \c len bytes at \c str
+const char* luau_arena_internLen(AArena *arena, const char *str, gsize len);
+/// Whether \c str is the string interned in \c arena (FALSE for a NULL arena)
+gboolean luau_arena_isInterned(const AArena *arena, const char *str);
+/// Create a pointer array which is free'd along with an arena
+GPtrArray* luau_arena_newPtrArray(AArena *arena);
+
+#endif /* ARENA_H */
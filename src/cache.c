@@ -0,0 +1,440 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __unix__
+#  include <unistd.h>
+#endif
+
+#include <glib.h>
+
+#include "cache.h"
+#include "util.h"
+#include "error.h"
+#include "md5.h"
+
+#ifdef WITH_DMALLOC
+#  include <dmalloc.h>
+#endif
+
+static char* getCacheDir(gboolean create);
+static char* getCacheFilename(const char *url, const char *suffix, gboolean create);
+static gboolean writeFile(const char *filename, const char *data, gsize len);
+
+/**
+ * Look up the cached copy of \c url.  If found, \c entry is filled in with the file's
+ * contents and the validators the server sent along with it (either may be NULL).
+ * Use \ref luau_cache_freeEntry to free the associated data.
+ *
+ * @arg <i>url</i> is the URL the file was downloaded from.
+ * @arg <i>entry</i> is where to store the cached data.
+ * @return whether a cached copy of \c url exists
+ */
+gboolean
+luau_cache_load(const char *url, ACacheEntry *entry) {
+	char *bodyFile, *data;
+	gsize len;
+	
+	if (!luau_cache_lookup(url, entry))
+		return FALSE;
+	
+	bodyFile = getCacheFilename(url, "", FALSE);
+	if (bodyFile == NULL || !g_file_get_contents(bodyFile, &data, &len, NULL)) {
+		g_free(bodyFile);
+		luau_cache_freeEntry(entry);
+		return FALSE;
+	}
+	g_free(bodyFile);
+	
+	entry->contents = g_string_new_len(data, len);
+	g_free(data);
+	
+	return TRUE;
+}
+
+/**
+ * Like \ref luau_cache_load, but only fills in the validators of the cached copy
+ * (\c entry->contents is left NULL).  Use \ref luau_cache_openBody to read the file
+ * itself.
+ *
+ * @arg <i>url</i> is the URL the file was downloaded from.
+ * @arg <i>entry</i> is where to store the cached data.
+ * @return whether a cached copy of \c url exists
+ */
+gboolean
+luau_cache_lookup(const char *url, ACacheEntry *entry) {
+	char *bodyFile, *metaFile, *data, **lines;
+	gsize len;
+	int i;
+	
+	g_return_val_if_fail(url != NULL && entry != NULL, FALSE);
+	
+	entry->contents = NULL;
+	entry->etag = NULL;
+	entry->lastModified = NULL;
+	
+	bodyFile = getCacheFilename(url, "", FALSE);
+	metaFile = getCacheFilename(url, ".meta", FALSE);
+	if (bodyFile == NULL || metaFile == NULL || !lutil_fileExists(bodyFile)) {
+		g_free(bodyFile);
+		g_free(metaFile);
+		return FALSE;
+	}
+	g_free(bodyFile);
+	
+	if (!g_file_get_contents(metaFile, &data, &len, NULL)) {
+		g_free(metaFile);
+		return FALSE;
+	}
+	g_free(metaFile);
+	
+	lines = g_strsplit(data, "\n", 0);
+	g_free(data);
+	
+	for (i = 0; lines[i] != NULL; ++i) {
+		if (strncmp(lines[i], "url: ", 5) == 0 && !lutil_streq(lines[i]+5, url)) {
+			/* Hash collision (or stale file): not ours */
+			g_strfreev(lines);
+			luau_cache_freeEntry(entry);
+			return FALSE;
+		} else if (strncmp(lines[i], "etag: ", 6) == 0) {
+			entry->etag = g_strdup(lines[i]+6);
+		} else if (strncmp(lines[i], "last-modified: ", 15) == 0) {
+			entry->lastModified = g_strdup(lines[i]+15);
+		}
+	}
+	g_strfreev(lines);
+	
+	DBUGOUT("Found cached copy of %s (ETag: %s, Last-Modified: %s)", url,
+	        (entry->etag ? entry->etag : "none"), (entry->lastModified ? entry->lastModified : "none"));
+	
+	return TRUE;
+}
+
+/**
+ * Open the cached copy of \c url, so that it can be read a piece at a time.
+ *
+ * @arg <i>url</i> is the URL the file was downloaded from.
+ * @return the open file (to be closed with fclose), or NULL if there is no cached copy
+ */
+FILE *
+luau_cache_openBody(const char *url) {
+	char *bodyFile;
+	FILE *file;
+	
+	g_return_val_if_fail(url != NULL, NULL);
+	
+	bodyFile = getCacheFilename(url, "", FALSE);
+	if (bodyFile == NULL)
+		return NULL;
+	
+	file = fopen(bodyFile, "rb");
+	g_free(bodyFile);
+	
+	return file;
+}
+
+/**
+ * Store a copy of \c url in the cache, replacing any previous copy.  Files served
+ * without any validators aren't cached, since there would be no way to tell if the
+ * cached copy is still current.
+ *
+ * @arg <i>url</i> is the URL the file was downloaded from.
+ * @arg <i>contents</i> is the (raw, as downloaded) file data.
+ * @arg <i>etag</i> is the value of the ETag header the server sent (or NULL).
+ * @arg <i>lastModified</i> is the value of the Last-Modified header the server sent (or NULL).
+ * @return whether the file was cached
+ */
+gboolean
+luau_cache_store(const char *url, const GString *contents, const char *etag, const char *lastModified) {
+	ACacheWriter writer;
+	
+	g_return_val_if_fail(url != NULL && contents != NULL, FALSE);
+	
+	if (etag == NULL && lastModified == NULL)
+		return FALSE;
+	
+	if (!luau_cache_beginStore(&writer, url))
+		return FALSE;
+	luau_cache_write(&writer, contents->str, contents->len);
+	
+	return luau_cache_commitStore(&writer, etag, lastModified);
+}
+
+/**
+ * Start storing a copy of \c url in the cache while it is being downloaded: pass the
+ * data to \ref luau_cache_write as it arrives, then call \ref luau_cache_commitStore
+ * once the download is complete (or \ref luau_cache_abortStore if it failed).  The
+ * previous copy (if any) stays in place until the new one is committed.
+ *
+ * @arg <i>writer</i> is the struct to keep track of the copy in.
+ * @arg <i>url</i> is the URL the file is being downloaded from.
+ * @return whether the file can be cached (if not, the other calls do nothing)
+ */
+gboolean
+luau_cache_beginStore(ACacheWriter *writer, const char *url) {
+	char *bodyFile;
+	int fd;
+	
+	g_return_val_if_fail(writer != NULL && url != NULL, FALSE);
+	
+	writer->url = NULL;
+	writer->tempFile = NULL;
+	writer->file = NULL;
+	
+	bodyFile = getCacheFilename(url, "", TRUE);
+	if (bodyFile == NULL)
+		return FALSE;
+	
+	writer->tempFile = lutil_vstrcreate(bodyFile, ".XXXXXX", NULL);
+	g_free(bodyFile);
+	
+	fd = mkstemp(writer->tempFile);
+	if (fd < 0 || (writer->file = fdopen(fd, "wb")) == NULL) {
+		DBUGOUT("Couldn't open %s for writing: %s", writer->tempFile, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			unlink(writer->tempFile);
+		}
+		g_free(writer->tempFile);
+		writer->tempFile = NULL;
+		return FALSE;
+	}
+	
+	writer->url = g_strdup(url);
+	
+	return TRUE;
+}
+
+/**
+ * Append data to a copy started with \ref luau_cache_beginStore.  If writing fails,
+ * the copy is abandoned.
+ *
+ * @arg <i>writer</i> is the copy being stored.
+ * @arg <i>data</i> is the data to add.
+ * @arg <i>len</i> is the length of \c data.
+ */
+void
+luau_cache_write(ACacheWriter *writer, const char *data, gsize len) {
+	if (writer->file == NULL)
+		return;
+	
+	if (fwrite(data, 1, len, writer->file) != len) {
+		DBUGOUT("Couldn't write %s: %s", writer->tempFile, strerror(errno));
+		luau_cache_abortStore(writer);
+	}
+}
+
+/**
+ * Finish storing a copy started with \ref luau_cache_beginStore: it replaces the
+ * previous copy of the file (if any).  As with \ref luau_cache_store, files without
+ * validators aren't kept.
+ *
+ * @arg <i>writer</i> is the copy being stored.
+ * @arg <i>etag</i> is the value of the ETag header the server sent (or NULL).
+ * @arg <i>lastModified</i> is the value of the Last-Modified header the server sent (or NULL).
+ * @return whether the file was cached
+ */
+gboolean
+luau_cache_commitStore(ACacheWriter *writer, const char *etag, const char *lastModified) {
+	char *bodyFile, *metaFile;
+	GString *meta;
+	gboolean result;
+	
+	if (writer->file == NULL)
+		return FALSE;
+	
+	if (etag == NULL && lastModified == NULL) {
+		luau_cache_abortStore(writer);
+		return FALSE;
+	}
+	
+	result = (fclose(writer->file) == 0);
+	writer->file = NULL;
+	
+	bodyFile = getCacheFilename(writer->url, "", TRUE);
+	metaFile = getCacheFilename(writer->url, ".meta", TRUE);
+	
+	meta = g_string_new("");
+	g_string_append_printf(meta, "url: %s\n", writer->url);
+	if (etag != NULL)
+		g_string_append_printf(meta, "etag: %s\n", etag);
+	if (lastModified != NULL)
+		g_string_append_printf(meta, "last-modified: %s\n", lastModified);
+	
+	/* Write the body first: a body without matching metadata is never used */
+	if (bodyFile == NULL || metaFile == NULL)
+		result = FALSE;
+	if (result == TRUE) {
+		unlink(metaFile);
+		result = (rename(writer->tempFile, bodyFile) == 0);
+		if (result == TRUE) {
+			g_free(writer->tempFile);
+			writer->tempFile = NULL;
+			result = writeFile(metaFile, meta->str, meta->len);
+		}
+		if (result == FALSE)
+			unlink(metaFile);
+		else
+			DBUGOUT("Cached %s as %s", writer->url, bodyFile);
+	}
+	
+	g_string_free(meta, TRUE);
+	g_free(bodyFile);
+	g_free(metaFile);
+	
+	luau_cache_abortStore(writer);
+	
+	return result;
+}
+
+/**
+ * Throw away a copy started with \ref luau_cache_beginStore (eg. because the
+ * download failed).  The previous copy of the file (if any) is left alone.
+ *
+ * @arg <i>writer</i> is the copy being stored.
+ */
+void
+luau_cache_abortStore(ACacheWriter *writer) {
+	if (writer->file != NULL)
+		fclose(writer->file);
+	if (writer->tempFile != NULL)
+		unlink(writer->tempFile);
+	
+	g_free(writer->url);
+	g_free(writer->tempFile);
+	writer->url = NULL;
+	writer->tempFile = NULL;
+	writer->file = NULL;
+}
+
+/**
+ * Free data associated with the given cache entry (not including the struct itself).
+ *
+ * @arg <i>entry</i> is the cache entry to free.
+ */
+void
+luau_cache_freeEntry(ACacheEntry *entry) {
+	if (entry->contents != NULL)
+		g_string_free(entry->contents, TRUE);
+	g_free(entry->etag);
+	g_free(entry->lastModified);
+	
+	entry->contents = NULL;
+	entry->etag = NULL;
+	entry->lastModified = NULL;
+}
+
+
+/* Non-Interface Methods */
+
+static char *
+getCacheDir(gboolean create) {
+	char *luauDir, *cacheDir;
+	const char *home;
+	
+	home = getenv("HOME");
+	if (home == NULL)
+		return NULL;
+	
+	cacheDir = lutil_vstrcreate(home, "/" CACHE_LOCAL_DIR, NULL);
+	
+	if (create && !lutil_isDirectory(cacheDir)) {
+		luauDir = g_path_get_dirname(cacheDir);
+		if (mkdir(luauDir, 0755) != 0 && errno != EEXIST) {
+			DBUGOUT("Couldn't create %s: %s", luauDir, strerror(errno));
+			g_free(luauDir);
+			g_free(cacheDir);
+			return NULL;
+		}
+		g_free(luauDir);
+		
+		if (mkdir(cacheDir, 0755) != 0 && errno != EEXIST) {
+			DBUGOUT("Couldn't create %s: %s", cacheDir, strerror(errno));
+			g_free(cacheDir);
+			return NULL;
+		}
+	}
+	
+	return cacheDir;
+}
+
+static char *
+getCacheFilename(const char *url, const char *suffix, gboolean create) {
+	char md5[33], *dir, *filename;
+	
+	dir = getCacheDir(create);
+	if (dir == NULL)
+		return NULL;
+	
+	lutil_md5_data((const unsigned char *) url, strlen(url), md5, NULL);
+	filename = lutil_vstrcreate(dir, "/", md5, suffix, NULL);
+	g_free(dir);
+	
+	return filename;
+}
+
+/* Write to a temporary file and rename it into place, so that readers never see a
+   partially written file (the temporary file's name is unique, so threads writing
+   the same file at once don't write into each other's) */
+static gboolean
+writeFile(const char *filename, const char *data, gsize len) {
+	char *tempFile;
+	FILE *file = NULL;
+	gboolean result;
+	int fd;
+	
+	tempFile = lutil_vstrcreate(filename, ".XXXXXX", NULL);
+	
+	fd = mkstemp(tempFile);
+	if (fd < 0 || (file = fdopen(fd, "wb")) == NULL) {
+		DBUGOUT("Couldn't open %s for writing: %s", tempFile, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+			unlink(tempFile);
+		}
+		g_free(tempFile);
+		return FALSE;
+	}
+	
+	result = (fwrite(data, 1, len, file) == len);
+	if (fclose(file) != 0)
+		result = FALSE;
+	
+	if (result == TRUE && rename(tempFile, filename) != 0)
+		result = FALSE;
+	if (result == FALSE) {
+		DBUGOUT("Couldn't write %s: %s", filename, strerror(errno));
+		unlink(tempFile);
+	}
+	
+	g_free(tempFile);
+	
+	return result;
+}
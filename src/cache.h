@@ -0,0 +1,79 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+/** @file cache.h
+ * \brief On-disk cache for downloaded repository files
+ *
+ * Keeps a copy of every repository file luau downloads, together with the HTTP
+ * validators (ETag and Last-Modified) the server sent, so that later checks can
+ * ask the server whether the file has changed instead of downloading it again.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+
+#include <glib.h>
+
+/// Where cached repository files are kept (relative to the user's home directory)
+#define CACHE_LOCAL_DIR ".luau/cache"
+
+/// A cached copy of a downloaded file
+typedef struct {
+	/// The cached file contents
+	GString *contents;
+	/// Value of the ETag header the file was served with (or NULL)
+	char *etag;
+	/// Value of the Last-Modified header the file was served with (or NULL)
+	char *lastModified;
+} ACacheEntry;
+
+/// A copy of a file being written to the cache piece by piece
+typedef struct {
+	char *url;
+	/// Where the data goes until it is complete (NULL if nothing is being written)
+	char *tempFile;
+	FILE *file;
+} ACacheWriter;
+
+/// Look up the cached copy of \c url
+gboolean luau_cache_load(const char *url, ACacheEntry *entry);
+/// Look up the validators of the cached copy of \c url (without reading the file itself)
+gboolean luau_cache_lookup(const char *url, ACacheEntry *entry);
+/// Open the cached copy of \c url for reading
+FILE* luau_cache_openBody(const char *url);
+/// Store a copy of \c url in the cache
+gboolean luau_cache_store(const char *url, const GString *contents, const char *etag, const char *lastModified);
+/// Start storing a copy of \c url in the cache as it is downloaded
+gboolean luau_cache_beginStore(ACacheWriter *writer, const char *url);
+/// Append data to a copy being stored
+void luau_cache_write(ACacheWriter *writer, const char *data, gsize len);
+/// Finish storing a copy, replacing any previous copy of the file
+gboolean luau_cache_commitStore(ACacheWriter *writer, const char *etag, const char *lastModified);
+/// Throw away a partly stored copy
+void luau_cache_abortStore(ACacheWriter *writer);
+/// Free data associated with a cache entry
+void luau_cache_freeEntry(ACacheEntry *entry);
+
+#endif /* CACHE_H */
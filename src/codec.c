@@ -0,0 +1,503 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#ifdef HAVE_LIBZ
+#  include <zlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#  include <lzma.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#  include <zstd.h>
+#endif
+
+#include "libuau.h"
+#include "codec.h"
+#include "util.h"
+#include "error.h"
+
+#ifdef WITH_DMALLOC
+#  include <dmalloc.h>
+#endif
+
+struct _ACodec {
+	/// Name of the format (as used in the Accept-Encoding header)
+	const char *name;
+	/// Bytes every stream in this format starts with
+	const char *magic;
+	gsize magicLength;
+	/// Whether luau was built with support for this format
+	gboolean available;
+	gboolean (*init)  (ADecoder *decoder, GError **err);
+	gboolean (*decode)(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err);
+	/// Get ready for another compressed stream following the one just finished
+	gboolean (*reset) (ADecoder *decoder, GError **err);
+	void     (*end)   (ADecoder *decoder);
+};
+
+struct _ADecoder {
+	const ACodec *codec;
+	gboolean finished;
+	union {
+#ifdef HAVE_LIBZ
+		z_stream gzip;
+#endif
+#ifdef HAVE_LIBLZMA
+		lzma_stream xz;
+#endif
+#ifdef HAVE_LIBZSTD
+		ZSTD_DStream *zstd;
+#endif
+		int unused;
+	} stream;
+};
+
+#ifdef HAVE_LIBZ
+static gboolean gzipInit  (ADecoder *decoder, GError **err);
+static gboolean gzipDecode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err);
+static gboolean gzipReset (ADecoder *decoder, GError **err);
+static void     gzipEnd   (ADecoder *decoder);
+#else
+#  define gzipInit   NULL
+#  define gzipDecode NULL
+#  define gzipReset  NULL
+#  define gzipEnd    NULL
+#endif
+
+#ifdef HAVE_LIBLZMA
+static gboolean xzInit  (ADecoder *decoder, GError **err);
+static gboolean xzDecode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err);
+static gboolean xzReset (ADecoder *decoder, GError **err);
+static void     xzEnd   (ADecoder *decoder);
+#else
+#  define xzInit   NULL
+#  define xzDecode NULL
+#  define xzReset  NULL
+#  define xzEnd    NULL
+#endif
+
+#ifdef HAVE_LIBZSTD
+static gboolean zstdInit  (ADecoder *decoder, GError **err);
+static gboolean zstdDecode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err);
+static gboolean zstdReset (ADecoder *decoder, GError **err);
+static void     zstdEnd   (ADecoder *decoder);
+#else
+#  define zstdInit   NULL
+#  define zstdDecode NULL
+#  define zstdReset  NULL
+#  define zstdEnd    NULL
+#endif
+
+/* All known formats, in order of preference */
+static const ACodec codecs[] = {
+#ifdef HAVE_LIBZSTD
+	{ "zstd", "\x28\xb5\x2f\xfd", 4, TRUE, zstdInit, zstdDecode, zstdReset, zstdEnd },
+#else
+	{ "zstd", "\x28\xb5\x2f\xfd", 4, FALSE, zstdInit, zstdDecode, zstdReset, zstdEnd },
+#endif
+#ifdef HAVE_LIBLZMA
+	{ "xz", "\xfd" "7zXZ\x00", 6, TRUE, xzInit, xzDecode, xzReset, xzEnd },
+#else
+	{ "xz", "\xfd" "7zXZ\x00", 6, FALSE, xzInit, xzDecode, xzReset, xzEnd },
+#endif
+#ifdef HAVE_LIBZ
+	{ "gzip", "\x1f\x8b", 2, TRUE, gzipInit, gzipDecode, gzipReset, gzipEnd },
+#else
+	{ "gzip", "\x1f\x8b", 2, FALSE, gzipInit, gzipDecode, gzipReset, gzipEnd },
+#endif
+};
+
+static char *acceptEncoding = NULL;
+
+G_LOCK_DEFINE_STATIC(codec);
+
+/**
+ * Find the compression format of some data, from its first few bytes.
+ *
+ * @arg <i>data</i> is the start of the data.
+ * @arg <i>len</i> is the length of \c data (at least CODEC_MAGIC_LENGTH, unless the
+ *      data is shorter than that).
+ * @return the format, or NULL if the data doesn't look compressed
+ */
+const ACodec *
+luau_codec_detect(const char *data, gsize len) {
+	unsigned int i;
+	
+	for (i = 0; i < G_N_ELEMENTS(codecs); ++i) {
+		if (len >= codecs[i].magicLength && memcmp(data, codecs[i].magic, codecs[i].magicLength) == 0)
+			return &codecs[i];
+	}
+	
+	return NULL;
+}
+
+/**
+ * Get the name of a compression format.
+ *
+ * @arg <i>codec</i> is the format.
+ * @return the name (as used in the Accept-Encoding header)
+ */
+const char *
+luau_codec_getName(const ACodec *codec) {
+	return codec->name;
+}
+
+/**
+ * Get the list of compression formats luau can read, for use as the value of an
+ * Accept-Encoding header.
+ *
+ * @return a string like "zstd, xz, gzip" (possibly empty), which must not be free'd
+ */
+const char *
+luau_codec_getAcceptEncoding(void) {
+	GString *list;
+	unsigned int i;
+	
+	G_LOCK(codec);
+	if (acceptEncoding == NULL) {
+		list = g_string_new("");
+		for (i = 0; i < G_N_ELEMENTS(codecs); ++i) {
+			if (!codecs[i].available)
+				continue;
+			if (list->len > 0)
+				g_string_append(list, ", ");
+			g_string_append(list, codecs[i].name);
+		}
+		acceptEncoding = g_string_free(list, FALSE);
+	}
+	G_UNLOCK(codec);
+	
+	return acceptEncoding;
+}
+
+/**
+ * Start uncompressing a stream of data.
+ *
+ * @arg <i>codec</i> is the format the stream is in.
+ * @return a new decoder (free with \ref luau_codec_freeDecoder), or NULL if the format
+ *         isn't supported
+ */
+ADecoder *
+luau_codec_newDecoder(const ACodec *codec, GError **err) {
+	ADecoder *decoder;
+	
+	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+	
+	if (!codec->available) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Can't read %s compressed data: luau was built without %s support",
+		            codec->name, codec->name);
+		return NULL;
+	}
+	
+	decoder = g_malloc0(sizeof(ADecoder));
+	decoder->codec = codec;
+	decoder->finished = FALSE;
+	
+	if (!codec->init(decoder, err)) {
+		g_assert(err == NULL || *err != NULL);
+		g_free(decoder);
+		return NULL;
+	}
+	
+	return decoder;
+}
+
+/**
+ * Uncompress the next piece of a stream.  The uncompressed data is passed to
+ * \c sink, in pieces of at most CODEC_WINDOW bytes.  Compressed streams that
+ * follow one another (as several gzip members or zstd frames do when compressed
+ * files are concatenated) come out one after the other, as a single stream.
+ *
+ * @arg <i>decoder</i> is the decoder for the stream.
+ * @arg <i>data</i> is the next piece of compressed data.
+ * @arg <i>len</i> is the length of \c data.
+ * @arg <i>sink</i> is the function to pass uncompressed data to.
+ * @arg <i>userData</i> is passed on to \c sink.
+ * @return FALSE if the data is corrupt or \c sink failed
+ */
+gboolean
+luau_codec_decode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err) {
+	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+	
+	if (len == 0)
+		return TRUE;
+	
+	/* Another compressed stream starts where the last one ended */
+	if (decoder->finished) {
+		if (!decoder->codec->reset(decoder, err))
+			return FALSE;
+		decoder->finished = FALSE;
+	}
+	
+	return decoder->codec->decode(decoder, data, len, sink, userData, err);
+}
+
+/**
+ * Find out whether the end of a compressed stream has been reached (if not once all
+ * of the data has been passed to \ref luau_codec_decode, the data was cut short).
+ *
+ * @arg <i>decoder</i> is the decoder for the stream.
+ * @return whether the whole stream has been uncompressed
+ */
+gboolean
+luau_codec_isFinished(const ADecoder *decoder) {
+	return decoder->finished;
+}
+
+/**
+ * Free a decoder created by \ref luau_codec_newDecoder.
+ *
+ * @arg <i>decoder</i> is the decoder to free.
+ */
+void
+luau_codec_freeDecoder(ADecoder *decoder) {
+	if (decoder == NULL)
+		return;
+	
+	decoder->codec->end(decoder);
+	g_free(decoder);
+}
+
+
+/* Non-Interface Methods */
+
+#ifdef HAVE_LIBZ
+static gboolean
+gzipInit(ADecoder *decoder, GError **err) {
+	z_stream *z = &(decoder->stream.gzip);
+	
+	/* 16+ tells zlib to expect a gzip header */
+	if (inflateInit2(z, 16+MAX_WBITS) != Z_OK) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't initialize compressed stream: %s", z->msg ? z->msg : "out of memory");
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static gboolean
+gzipDecode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err) {
+	z_stream *z = &(decoder->stream.gzip);
+	char window[CODEC_WINDOW];
+	int ret;
+	
+	z->next_in = (Bytef *) data;
+	z->avail_in = len;
+	
+	do {
+		z->next_out = (Bytef *) window;
+		z->avail_out = sizeof(window);
+		
+		ret = inflate(z, Z_NO_FLUSH);
+		if (ret == Z_BUF_ERROR) {
+			/* Everything so far has been uncompressed */
+			break;
+		} else if (ret != Z_OK && ret != Z_STREAM_END) {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't uncompress gzip data: %s", z->msg ? z->msg : "invalid data");
+			return FALSE;
+		}
+		
+		if (!sink(window, sizeof(window) - z->avail_out, userData, err))
+			return FALSE;
+		
+		/* Another member follows this one */
+		if (ret == Z_STREAM_END && z->avail_in > 0) {
+			if (!gzipReset(decoder, err))
+				return FALSE;
+			ret = Z_OK;
+		}
+	} while (ret != Z_STREAM_END && (z->avail_in > 0 || z->avail_out == 0));
+	
+	decoder->finished = (ret == Z_STREAM_END);
+	
+	return TRUE;
+}
+
+static gboolean
+gzipReset(ADecoder *decoder, GError **err) {
+	z_stream *z = &(decoder->stream.gzip);
+	
+	if (inflateReset(z) != Z_OK) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't uncompress gzip data: %s", z->msg ? z->msg : "invalid data");
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static void
+gzipEnd(ADecoder *decoder) {
+	inflateEnd(&(decoder->stream.gzip));
+}
+#endif /* HAVE_LIBZ */
+
+#ifdef HAVE_LIBLZMA
+static gboolean
+xzInit(ADecoder *decoder, GError **err) {
+	lzma_stream init = LZMA_STREAM_INIT;
+	
+	decoder->stream.xz = init;
+	if (lzma_stream_decoder(&(decoder->stream.xz), UINT64_MAX, 0) != LZMA_OK) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't initialize compressed stream: out of memory");
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static gboolean
+xzDecode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err) {
+	lzma_stream *xz = &(decoder->stream.xz);
+	char window[CODEC_WINDOW];
+	lzma_ret ret;
+	
+	xz->next_in = (const uint8_t *) data;
+	xz->avail_in = len;
+	
+	do {
+		xz->next_out = (uint8_t *) window;
+		xz->avail_out = sizeof(window);
+		
+		ret = lzma_code(xz, LZMA_RUN);
+		if (ret == LZMA_BUF_ERROR) {
+			break;
+		} else if (ret != LZMA_OK && ret != LZMA_STREAM_END) {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't uncompress xz data: %s",
+			            (ret == LZMA_MEM_ERROR) ? "out of memory" : "invalid data");
+			return FALSE;
+		}
+		
+		if (!sink(window, sizeof(window) - xz->avail_out, userData, err))
+			return FALSE;
+		
+		/* Another stream follows this one */
+		if (ret == LZMA_STREAM_END && xz->avail_in > 0) {
+			if (!xzReset(decoder, err))
+				return FALSE;
+			ret = LZMA_OK;
+		}
+	} while (ret != LZMA_STREAM_END && (xz->avail_in > 0 || xz->avail_out == 0));
+	
+	decoder->finished = (ret == LZMA_STREAM_END);
+	
+	return TRUE;
+}
+
+static gboolean
+xzReset(ADecoder *decoder, GError **err) {
+	lzma_stream *xz = &(decoder->stream.xz);
+	const uint8_t *next_in = xz->next_in;
+	size_t avail_in = xz->avail_in;
+	
+	/* liblzma has no reset as such: starting a new decoder on the same stream reuses its memory */
+	if (lzma_stream_decoder(xz, UINT64_MAX, 0) != LZMA_OK) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't initialize compressed stream: out of memory");
+		return FALSE;
+	}
+	xz->next_in = next_in;
+	xz->avail_in = avail_in;
+	
+	return TRUE;
+}
+
+static void
+xzEnd(ADecoder *decoder) {
+	lzma_end(&(decoder->stream.xz));
+}
+#endif /* HAVE_LIBLZMA */
+
+#ifdef HAVE_LIBZSTD
+static gboolean
+zstdInit(ADecoder *decoder, GError **err) {
+	decoder->stream.zstd = ZSTD_createDStream();
+	if (decoder->stream.zstd == NULL || ZSTD_isError(ZSTD_initDStream(decoder->stream.zstd))) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't initialize compressed stream: out of memory");
+		ZSTD_freeDStream(decoder->stream.zstd);
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static gboolean
+zstdDecode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err) {
+	char window[CODEC_WINDOW];
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t ret;
+	
+	in.src = data;
+	in.size = len;
+	in.pos = 0;
+	
+	do {
+		out.dst = window;
+		out.size = sizeof(window);
+		out.pos = 0;
+		
+		ret = ZSTD_decompressStream(decoder->stream.zstd, &out, &in);
+		if (ZSTD_isError(ret)) {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't uncompress zstd data: %s", ZSTD_getErrorName(ret));
+			return FALSE;
+		}
+		
+		if (!sink(window, out.pos, userData, err))
+			return FALSE;
+		
+		/* 0 means a frame has just been completed: another follows it */
+		if (ret == 0 && in.pos < in.size && !zstdReset(decoder, err))
+			return FALSE;
+	} while (in.pos < in.size || out.pos == out.size);
+	
+	decoder->finished = (ret == 0);
+	
+	return TRUE;
+}
+
+static gboolean
+zstdReset(ADecoder *decoder, GError **err) {
+	size_t ret;
+	
+	/* Keeps the context (and its buffers), dropping only what's left of the last frame */
+#if ZSTD_VERSION_NUMBER >= 10400
+	ret = ZSTD_DCtx_reset(decoder->stream.zstd, ZSTD_reset_session_only);
+#else
+	ret = ZSTD_initDStream(decoder->stream.zstd);
+#endif
+	if (ZSTD_isError(ret)) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't uncompress zstd data: %s", ZSTD_getErrorName(ret));
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static void
+zstdEnd(ADecoder *decoder) {
+	ZSTD_freeDStream(decoder->stream.zstd);
+}
+#endif /* HAVE_LIBZSTD */
@@ -0,0 +1,70 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+/** @file codec.h
+ * \brief Decompressors for repository files
+ *
+ * A small registry of the compression formats repository files can be served in
+ * (gzip, and xz and zstd if luau was built with liblzma and libzstd).  Formats are
+ * recognised by their magic bytes rather than by file name, and the formats
+ * available are what luau advertises to servers in its Accept-Encoding header.
+ * Data is uncompressed a piece at a time and handed on to a sink function, so the
+ * uncompressed file never needs to be held in memory.
+ */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+
+/// Number of bytes needed to recognise any of the formats
+#define CODEC_MAGIC_LENGTH 6
+
+/// Data is uncompressed in pieces of (at most) this size
+#define CODEC_WINDOW (16 * 1024)
+
+/// A compression format
+typedef struct _ACodec ACodec;
+/// The state of one stream being uncompressed
+typedef struct _ADecoder ADecoder;
+
+/// Receives uncompressed data; returns FALSE (and sets \c err) to stop
+typedef gboolean (*ACodecSink)(const char *data, gsize len, gpointer userData, GError **err);
+
+/// Find the format of compressed data from its first few bytes
+const ACodec* luau_codec_detect(const char *data, gsize len);
+/// The name of a format (as used in the Accept-Encoding header)
+const char* luau_codec_getName(const ACodec *codec);
+/// The formats luau can read, in order of preference, for an Accept-Encoding header
+const char* luau_codec_getAcceptEncoding(void);
+
+/// Start uncompressing a stream
+ADecoder* luau_codec_newDecoder(const ACodec *codec, GError **err);
+/// Uncompress the next piece of a stream, passing the result to \c sink
+gboolean luau_codec_decode(ADecoder *decoder, const char *data, gsize len, ACodecSink sink, gpointer userData, GError **err);
+/// Whether the end of the compressed stream has been reached
+gboolean luau_codec_isFinished(const ADecoder *decoder);
+/// Free a decoder
+void luau_codec_freeDecoder(ADecoder *decoder);
+
+#endif /* CODEC_H */
@@ -44,6 +44,10 @@
 #include "util.h"
 #include "install.h"
 #include "ftp.h"
+#include "mirrorstats.h"
+#include "transfer.h"
+#include "arena.h"
+#include "versionkey.h"
 
 #ifdef WITH_DMALLOC
 #  include <dmalloc.h>
@@ -53,12 +57,32 @@
 #  include <leakbug.h>
 #endif
 
-static int compareAlphaNumeric(const char *v1, const char *v2);
-
+/// The program updates are being categorized for
+typedef struct {
+	const AProgInfo *info;
+	/// info->version and info->pkgVersion, split up once for all the updates
+	AVersionKey *version;
+	AVersionKey *pkgVersion;
+} AInstalled;
+
+/// Where updates go as they're read in by luau_checkForUpdates_stream
+typedef struct {
+	AInstalled installed;
+	ACallbackWithData callback;
+	void *userData;
+} AUpdateStream;
+
+static GList* queryServer(const AProgInfo *info, AUpdateFields fields, const AUpdateFilter *filter,
+                          ACallbackWithData callback, void *userData, GError **err);
 static void categorizeUpdates(GContainer *updates, const AProgInfo *progInfo);
-static void categorizeUpdate(AUpdate *update, const AProgInfo *progInfo);
+static void categorizeArriving(void *update, void *stream);
+
+static void expandMirrorSet(GPtrArray *mirrors, const AMirrorSet *mirrorSet, const char *path);
+static void initInstalled(AInstalled *installed, const AProgInfo *info);
+static void freeInstalled(AInstalled *installed);
+static void categorizeUpdate(AUpdate *update, const AInstalled *installed);
 static gboolean isIncompatible(AUpdate *update, const AProgInfo *progInfo);
-static gboolean isOld(AUpdate *update, const AProgInfo *progInfo);
+static gboolean isOld(AUpdate *update, const AInstalled *installed);
 
 
 gboolean
@@ -68,7 +92,7 @@ luau_getProgInfoFromXML_url(AProgInfo *progInfo, const char *url, GError **err)
 	
 	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 	
-	data = lutil_ftp_getURL(url, err);
+	data = luau_net_getURL(url, err);
 	if (data == NULL) {
 		g_assert(err == NULL || *err != NULL);
 		return FALSE;
@@ -120,11 +144,12 @@ luau_getUpdateInfo(AUpdate *updateInfo, const char* updateID, const AProgInfo *p
 	GList *updateList;
 	GIterator iter;
 	AUpdate *temp;
+	AInstalled installed;
 	gboolean found;
 	
 	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 	
-	allUpdates = luau_net_queryServer(progInfo, err);
+	allUpdates = luau_net_queryServer(progInfo, LUAU_FIELDS_FULL, NULL, NULL, NULL, err);
 	if (allUpdates == NULL) {
 		g_assert(err == NULL || *err != NULL);
 		return FALSE;
@@ -143,9 +168,11 @@ luau_getUpdateInfo(AUpdate *updateInfo, const char* updateID, const AProgInfo *p
 	updateList = g_container_free(allUpdates, FALSE);
 	luau_freeUpdateList(updateList);
 	
-	if (found)
-		categorizeUpdate(updateInfo, progInfo);
-	else
+	if (found) {
+		initInstalled(&installed, progInfo);
+		categorizeUpdate(updateInfo, &installed);
+		freeInstalled(&installed);
+	} else
 		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_INVALID_ARG,
 	                "No such update ID: %s (%s)", updateID, progInfo->id);
 	
@@ -164,23 +191,106 @@ luau_getUpdateInfo(AUpdate *updateInfo, const char* updateID, const AProgInfo *p
  */
 GList *
 luau_checkForUpdates(const AProgInfo *info, GError **err) {
-	GContainer *result;
-	GList *ret;
-	
 	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
 	
-	DBUGOUT("Checking for updates for %s: %s", info->id, info->url);
-	result = luau_net_queryServer(info, err);
-	if (result == NULL) {
-		g_assert(err == NULL || *err != NULL);
-		return NULL;
-	}
+	return luau_checkForUpdates_stream(info, LUAU_FIELDS_FULL, NULL, NULL, err);
+}
+
+/**
+ * Check for updates as with \ref luau_checkForUpdates, but only read in the parts of
+ * each update given by \c fields.  A program that only lists the updates available
+ * can leave out their packages' mirrors, long descriptions and so on, which makes
+ * the check quicker and the list much smaller.  Updates read in this way can still
+ * be downloaded and installed (the rest of the update is fetched then), or read in
+ * full with \ref luau_getUpdateInfo once the user has picked one.
+ *
+ * @arg info describes the program we want to check updates for.
+ * @arg fields says which parts of the updates are wanted.
+ * @return a list of updates for the program in question (must be free'd).
+ *
+ * @see luau_freeUpdateList
+ */
+GList *
+luau_checkForUpdates_fields(const AProgInfo *info, AUpdateFields fields, GError **err) {
+	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
 	
-	categorizeUpdates(result, info);
+	return luau_checkForUpdates_stream(info, fields, NULL, NULL, err);
+}
+
+/**
+ * Check for updates as with \ref luau_checkForUpdates, but also hand each update to
+ * \c callback as soon as it has been read in and categorized, while the rest of
+ * the updates file may still be downloading.  Once the whole file has been read,
+ * the complete list is returned as usual.
+ *
+ * The updates passed to \c callback belong to the list being built up, so they
+ * must not be free'd (and are only valid until the list is).  If the query fails
+ * part way through, NULL is returned even though some updates have already been
+ * passed to \c callback.
+ *
+ * @arg info describes the program we want to check updates for.
+ * @arg fields says which parts of the updates are wanted (see \ref luau_checkForUpdates_fields).
+ * @arg callback is called with each update (an AUpdate*, as \c callback_data) and \c userData.
+ *      May be NULL.
+ * @arg userData is passed on to \c callback.
+ * @return a list of updates for the program in question (must be free'd).
+ *
+ * @see luau_freeUpdateList
+ */
+GList *
+luau_checkForUpdates_stream(const AProgInfo *info, AUpdateFields fields, ACallbackWithData callback, void *userData, GError **err) {
+	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
 	
-	ret = g_container_free(result, FALSE);
+	return queryServer(info, fields, NULL, callback, userData, err);
+}
+
+/**
+ * Set up an update filter that lets every update through, for the caller to then
+ * narrow down.
+ *
+ * @arg filter is the filter to set up.
+ */
+void
+luau_initUpdateFilter(AUpdateFilter *filter) {
+	g_return_if_fail(filter != NULL);
+	
+	filter->type = -1;
+	filter->formats = 0;
+	filter->newerOnly = FALSE;
+	filter->interfaceMajor = -1;
+	filter->limit = 0;
+	filter->order = LUAU_ORDER_NEWEST;
+}
+
+/**
+ * Check for updates as with \ref luau_checkForUpdates_fields, but only return the
+ * updates which pass \c filter.  The rest are skipped over as the file is read in,
+ * without any memory being allocated for them, so a program only interested in
+ * (say) newer versions of itself in one package format doesn't pay for every
+ * update listed.
+ *
+ * If \c filter->limit is set, only that many updates are kept while the file is
+ * read in (the best so far, by \c filter->order), so however long the repository's
+ * history is, no more than that are ever held in memory at once.  They come back
+ * best first.
+ *
+ * Filtered updates come back in an empty list (ie., NULL) if none of them pass, so
+ * check \c err to tell that apart from failure.
+ *
+ * @arg info describes the program we want to check updates for (its version is
+ *      the one \c filter->newerOnly compares against).
+ * @arg filter says which updates are wanted.
+ * @arg fields says which parts of them are wanted.
+ * @return a list of updates for the program in question (must be free'd).
+ *
+ * @see luau_freeUpdateList
+ */
+GList *
+luau_checkForUpdates_filtered(const AProgInfo *info, const AUpdateFilter *filter, AUpdateFields fields, GError **err) {
+	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+	g_return_val_if_fail(filter != NULL, NULL);
 	
-	return ret;
+	return queryServer(info, fields, filter, NULL, NULL, err);
 }
 
 GList *
@@ -195,6 +305,46 @@ luau_checkForUpdates_url(const char *url, GError **err) {
 	return luau_checkForUpdates(&progInfo, err);
 }
 
+/**
+ * Check for updates for several programs at once.  The update files for up to
+ * \c maxConcurrent programs are downloaded simultaneously, and are then parsed and
+ * categorized in the order the programs were given.
+ *
+ * @arg infos is an array of AProgInfo pointers describing the programs to check.
+ * @arg fields says which parts of the updates are wanted (see \ref luau_checkForUpdates_fields).
+ * @arg maxConcurrent is the maximum number of simultaneous downloads (<= 0 means
+ *      \ref LUAU_DEFAULT_CONCURRENCY).
+ * @arg errors is an (optional) array which receives one GError pointer per program
+ *      (NULL on success).  The errors must be free'd.
+ * @return an array with one update list (GList*) per program, in the same order as
+ *      \c infos, or NULL entries for programs which couldn't be checked.  Each list
+ *      must be free'd with \ref luau_freeUpdateList, and the array with g_ptr_array_free.
+ */
+GPtrArray *
+luau_checkForUpdates_all(const GPtrArray *infos, AUpdateFields fields, int maxConcurrent, GPtrArray *errors) {
+	GPtrArray *results;
+	GContainer *result;
+	const AProgInfo *info;
+	unsigned int i;
+	
+	g_return_val_if_fail(infos != NULL, NULL);
+	
+	DBUGOUT("Checking for updates for %d programs", infos->len);
+	results = luau_net_queryServers(infos, fields, maxConcurrent, errors);
+	
+	for (i = 0; i < results->len; ++i) {
+		result = g_ptr_array_index(results, i);
+		if (result == NULL)
+			continue;
+		
+		info = g_ptr_array_index(infos, i);
+		categorizeUpdates(result, info);
+		g_ptr_array_index(results, i) = g_container_free(result, FALSE);
+	}
+	
+	return results;
+}
+
 
 
 /**
@@ -249,13 +399,27 @@ luau_installUpdate(const AProgInfo *info, const AUpdate *newUpdate, const APkgTy
  */
 char *
 luau_downloadUpdate(const AProgInfo *info, const AUpdate *newUpdate, const APkgType type, const char* downloadTo, GError **err) {
-	char *actualFilename = NULL, *temp;
+	char *actualFilename = NULL, *temp, *url;
 	APackage *pkg;
 	struct stat fileinfo;
 	int ret;
 	gboolean result = FALSE;
 	
 	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+	
+	/* Only a summary of the update was read in: fetch the rest (packages, mirrors) now */
+	if (newUpdate->fields != LUAU_FIELDS_FULL) {
+		AUpdate full;
+		
+		if (!luau_getUpdateInfo(&full, newUpdate->id, info, err)) {
+			g_assert(err == NULL || *err != NULL);
+			return NULL;
+		}
+		actualFilename = luau_downloadUpdate(info, &full, type, downloadTo, err);
+		luau_freeUpdateInfo(&full);
+		
+		return actualFilename;
+	}
 
 	if (downloadTo != NULL && downloadTo[0] != '\0') {
 		while (result == FALSE) {
@@ -284,14 +448,15 @@ luau_downloadUpdate(const AProgInfo *info, const AUpdate *newUpdate, const APkgT
 						g_assert(err == NULL || *err != NULL);
 						return NULL;
 					}
-					temp = luau_getPackageURL(pkg, err);
-					if (temp == NULL) {
+					url = luau_getPackageURL(pkg, err);
+					if (url == NULL) {
 						g_assert(err == NULL || *err != NULL);
 						return NULL;
 					}
 					
-					DBUGOUT("Preparing to download: %s", temp);
-					temp = g_path_get_basename(temp);
+					DBUGOUT("Preparing to download: %s", url);
+					temp = g_path_get_basename(url);
+					g_free(url);
 					actualFilename = lutil_vstrcreate(downloadTo, "/", temp, NULL);
 					g_free(temp);
 					downloadTo = actualFilename;
@@ -321,6 +486,38 @@ luau_downloadUpdate(const AProgInfo *info, const AUpdate *newUpdate, const APkgT
 	return actualFilename;
 }
 
+/**
+ * Download a single package to \c filename.  The package's mirrors are tried in turn
+ * until one of them delivers the file (with the right md5 sum, if the package has one).
+ * Unlike \ref luau_downloadUpdate, the user is never prompted: if no mirror delivers
+ * a file with the right md5 sum, the download fails.
+ *
+ * @arg package is the package to download (see \ref luau_getUpdatePackage).
+ * @arg filename is where to download the package to.
+ * @return whether the operation succeeded
+ *
+ * @see luau_setDownloadMode
+ */
+gboolean
+luau_downloadPackage(const APackage *package, const char *filename, GError **err) {
+	char md5[33];
+	
+	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+	
+	if (!luau_net_downloadPackage(package, filename, md5, err)) {
+		g_assert(err == NULL || *err != NULL);
+		return FALSE;
+	}
+	
+	if (package->md5sum[0] != '\0' && !lutil_streq(md5, package->md5sum)) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "MD5 sum mismatch (found %s, expected %s)", md5, package->md5sum);
+		unlink(filename);
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
 /**
  * Installs a package that has already been downloaded.
  *
@@ -399,6 +596,60 @@ luau_registerPromptFunc(APromptFunc promptFunc) {
 void
 luau_registerProgressCallback(AProgressCallback callback) {
 	lutil_ftp_setCallbackFunc(callback);
+	luau_net_setProgressCallback(callback);
+}
+
+/**
+ * Choose how packages are downloaded.  The default, \ref LUAU_DOWNLOAD_SINGLE, downloads
+ * each package from a single (randomly chosen, according to the mirror weights) mirror.
+ * \ref LUAU_DOWNLOAD_SEGMENTED splits large packages into pieces and downloads them in
+ * parallel from all available mirrors.
+ *
+ * @arg mode is the new download mode.
+ *
+ * @see ADownloadMode
+ */
+void
+luau_setDownloadMode(ADownloadMode mode) {
+	luau_net_setDownloadMode(mode);
+}
+
+/**
+ * Get a curl easy handle for a transfer of your own.  The handle uses the same DNS,
+ * connection and TLS session caches as libuau's transfers, so (for example)
+ * downloading a package from the server an update was just found on can reuse the
+ * connection.  All options are at their defaults.  Instead of cleaning the handle
+ * up, give it back with \ref luau_releaseTransferHandle.
+ *
+ * @return a CURL* handle
+ */
+void *
+luau_acquireTransferHandle(void) {
+	return luau_transfer_acquire();
+}
+
+/**
+ * Give back a handle obtained from \ref luau_acquireTransferHandle once its transfer
+ * is finished.
+ *
+ * @arg handle is the CURL* handle to give back.
+ */
+void
+luau_releaseTransferHandle(void *handle) {
+	luau_transfer_release((CURL *) handle);
+}
+
+/**
+ * Let go of everything libuau holds on to from one call to the next: the idle curl
+ * handles (and the connections they keep open) and the DNS, connection and TLS
+ * session caches they share.  Mirror statistics not yet saved are written to disk.
+ * Call this once the program is done with libuau; handles obtained from
+ * \ref luau_acquireTransferHandle mustn't be used afterwards.
+ */
+void
+luau_cleanup(void) {
+	luau_mirrorstats_save();
+	luau_transfer_cleanup();
 }
 
 /**
@@ -431,6 +682,7 @@ luau_resetPromptFunc(void) {
 void
 luau_resetProgressCallback(void) {
 	lutil_ftp_resetCallbackFunc();
+	luau_net_setProgressCallback(NULL);
 }
 
 
@@ -651,87 +903,10 @@ luau_datecmp(ADate *d1, ADate *d2) {
  *    compareVersions  "1.6.x"     "1.5.7"     --->  1 [ FAIL ]
  *    compareVersions  "1.x"       "1.5.7"     --->  0 [ PASS ]
  */
-/* FIXME - don't reference indices of the GContainer explicitly!  use iterator! */
 int
 luau_versioncmp(const char *required, const char *current) {
-	GContainer *reqElements, *curElements;
-	char *req, *cur;
-	int result, x, y;
-	unsigned int i, len, max;
-	
-	result = 0;
-	
-	req = g_strdup(required);
-	cur = g_strdup(current);
-	
-	lutil_strToLower(req);
-	lutil_strToLower(cur);
-	
-	/* replace all '-' '_' '/' '+' with '.' to index for arrays */
-	len = strlen(req);
-	for (i = 0; i < len; ++i) {
-		if (req[i] == '-' || req[i] == '_' || req[i] == '/' || req[i] == '+' || req[i] == '\\')
-				req[i] = '.';
-	}
-	
-	len = strlen(cur);
-	for (i = 0; i < len; ++i) {
-		if (cur[i] == '-' || cur[i] == '_' || cur[i] == '/' || cur[i] == '+' || cur[i] == '\\')
-				cur[i] = '.';
-	}
-	
-	/* create arrays from parameters */
-	reqElements = lutil_gsplit(".", req);
-	curElements = lutil_gsplit(".", cur);
-	
-	g_free(req);
-	g_free(cur);
-	
-	/* obtain maximum count of elements from either array */
-	if (reqElements->len > curElements->len)
-		max = reqElements->len;
-	else
-		max = curElements->len;
-
-	for (i = 0; i < max; ++i) {
-		/* process each respective decimal group ...
-		 * if alphanumeric group then extend the compare to compareAlphaNumeric, otherwise do integer comparisons */
-		
-		req = (i < reqElements->len) ? g_container_index(reqElements, i) : NULL;
-		cur = (i < curElements->len) ? g_container_index(curElements, i) : NULL;
-		
-		/* special case: if wildcard in either decimal group then they are "equal" */
-		if ((req != NULL && lutil_streq(req, "x")) || (cur != NULL && lutil_streq(cur, "x"))) {
-			result = 0;
-			break;
-		}
-		
-		if (lutil_containsAlpha(cur) || lutil_containsAlpha(req)) {
-			result = compareAlphaNumeric(req, cur);
-			
-			if (result != 0)
-				break;
-		} else if (req == NULL) {
-			result = -1;
-			break;
-		} else if (cur == NULL) {
-			result = 1;
-			break;
-		} else {
-			x = atoi(req);
-			y = atoi(cur);
-			
-			if (x != y) {
-				result = (x < y) ? -1 : 1;
-				break;
-			}
-		}
-	}
-	
-	g_container_destroy(reqElements);
-	g_container_destroy(curElements);
-	
-	return result;
+	/* Split up on the stack, with nothing allocated */
+	return luau_versionkey_cmpCached(required, NULL, current, NULL);
 }
 
 /**
@@ -826,53 +1001,135 @@ luau_packageTypeString(APkgType type) {
  */
 APkgType
 luau_parsePkgType(const char* typeString) {
+	const char *name;
 	APkgType type = LUAU_UNKNOWN;
-	if      (lutil_strcaseeq(typeString, "RPM")) type = LUAU_RPM;
-	else if (lutil_strcaseeq(typeString, "DEB")) type = LUAU_DEB;
-	else if (lutil_strcaseeq(typeString, "SRC")) type = LUAU_SRC;
-	else if (lutil_strcaseeq(typeString, "EXEC")) type = LUAU_EXEC;
-	else if (lutil_strcaseeq(typeString, "autopackage")) type = LUAU_AUTOPKG;
-	else if (lutil_strcaseeq(typeString, "AUTOPKG")) type = LUAU_AUTOPKG;
-	return type;
+	
+	if (typeString == NULL)
+		return LUAU_UNKNOWN;
+	
+	/* Only one name can have the same length and first letter (see LUAU_TAG_KEY) */
+	switch (LUAU_TAG_KEY(strlen(typeString), g_ascii_tolower(typeString[0]))) {
+		case LUAU_TAG_KEY( 3, 'r'): name = "RPM";         type = LUAU_RPM;     break;
+		case LUAU_TAG_KEY( 3, 'd'): name = "DEB";         type = LUAU_DEB;     break;
+		case LUAU_TAG_KEY( 3, 's'): name = "SRC";         type = LUAU_SRC;     break;
+		case LUAU_TAG_KEY( 4, 'e'): name = "EXEC";        type = LUAU_EXEC;    break;
+		case LUAU_TAG_KEY(11, 'a'): name = "autopackage"; type = LUAU_AUTOPKG; break;
+		case LUAU_TAG_KEY( 7, 'a'): name = "AUTOPKG";     type = LUAU_AUTOPKG; break;
+		default:                    return LUAU_UNKNOWN;
+	}
+	
+	return lutil_strcaseeq(typeString, name) ? type : LUAU_UNKNOWN;
 }
 
+/**
+ * Choose a mirror of a package to download it from (see \ref luau_getPackageURLs).
+ *
+ * Up to libuau interface 3 (luau 0.1.x) the URL returned belonged to the package.
+ * Packages found on a shared mirror set don't hold their URLs any more (they're
+ * pieced together from the set and \c pkgInfo->mirrorPath), so the URL is now a
+ * copy which the caller must free.
+ *
+ * @arg pkgInfo is the package to download.
+ * @return the URL of the package on the chosen mirror (must be free'd)
+ */
 char *
-luau_getPackageURL(APackage *pkgInfo, GError **err) {
-	GPtrArray *mirrors = pkgInfo->mirrors;
-	char *loc = NULL;
-	int percentage, random;
+luau_getPackageURL(const APackage *pkgInfo, GError **err) {
+	GPtrArray *urls;
+	char *loc;
 	unsigned int i;
 	
 	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+	
+	urls = luau_getPackageURLs(pkgInfo, err);
+	if (urls == NULL) {
+		g_assert(err == NULL || *err != NULL);
+		return NULL;
+	}
+	
+	loc = g_ptr_array_index(urls, 0);
+	for (i = 1; i < urls->len; ++i)
+		g_free(g_ptr_array_index(urls, i));
+	g_ptr_array_free(urls, TRUE);
+	
+	return loc;
+}
+
+/**
+ * Order all the mirrors of a package by preference, for trying one after the other.
+ * The order is random, but mirrors with a higher weight in the XML file (adjusted for
+ * how well the mirror has performed before) are more likely to come first.  The
+ * first URL is chosen exactly as \ref luau_getPackageURL would choose it.
+ *
+ * @arg pkgInfo is the package to list the mirrors of.
+ * @return an array of URLs; free the URLs and then the array itself (with g_ptr_array_free).
+ */
+GPtrArray *
+luau_getPackageURLs(const APackage *pkgInfo, GError **err) {
+	GPtrArray *mirrors, *ordered;
+	const char **urls;
+	double *weights, total, random;
+	unsigned int i, n, chosen;
+	
+	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+	
+	mirrors = luau_getPackageMirrors(pkgInfo);
 
 #ifdef DEBUG
 	for (i = 0; i < mirrors->len; i += 2)
 		DBUGOUT("URL: %s; weight: %d\n", (char*)g_ptr_array_index(mirrors, i+1), GPOINTER_TO_INT (g_ptr_array_index(mirrors, i)));
 #endif /* DEBUG */
 	
-	if (mirrors == NULL || mirrors->len == 0) {
+	if (mirrors->len == 0) {
 		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_INVALID_ARG, "Cannot retrieve package URL: none available in supplied argument");
+		luau_freePackageMirrors(mirrors);
 		return NULL;
 	}
-	else if (mirrors->len == 2)
-		return g_ptr_array_index(mirrors, 1);
 	
-	random = rand() % 100; /* integer between 0 and 100 */
+	/* Start from the weights given in the XML file, and favor mirrors that have
+	   served us well before.  The URLs end up in the ordered array. */
+	n = mirrors->len / 2;
+	urls = g_malloc(n * sizeof(char*));
+	weights = g_malloc(n * sizeof(double));
+	for (i = 0; i < n; ++i) {
+		weights[i] = GPOINTER_TO_INT( g_ptr_array_index(mirrors, 2*i) );
+		urls[i] = g_ptr_array_index(mirrors, 2*i+1);
+	}
 	
-	for (i = 0; i < mirrors->len; i+=2) {
-		percentage = GPOINTER_TO_INT( g_ptr_array_index(mirrors, i) );
-		if (random <= percentage) {
-			loc = g_ptr_array_index(mirrors, i+1);
-			break;
-		} else {
-			random -= percentage;
+	if (n > 1)
+		luau_mirrorstats_adjustWeights(urls, weights, n);
+	
+	/* Weighted selection without replacement */
+	ordered = g_ptr_array_sized_new(n);
+	while (ordered->len < n) {
+		total = 0;
+		for (i = 0; i < n; ++i)
+			if (weights[i] > 0)
+				total += weights[i];
+		
+		random = total * (rand() / (RAND_MAX + 1.0));
+		
+		chosen = n;
+		for (i = 0; i < n; ++i) {
+			if (weights[i] < 0)
+				continue; /* already chosen */
+			if (chosen == n)
+				chosen = i; /* fallback if all remaining weights are 0 */
+			if (random < weights[i]) {
+				chosen = i;
+				break;
+			}
+			random -= weights[i];
 		}
+		
+		g_ptr_array_add(ordered, (char *) urls[chosen]);
+		weights[chosen] = -1;
 	}
 	
-	if (loc == NULL && mirrors->len >= 2)
-		loc = g_ptr_array_index(mirrors, 1);
+	g_free(urls);
+	g_free(weights);
+	g_ptr_array_free(mirrors, TRUE);
 	
-	return loc;
+	return ordered;
 }
 
 /**
@@ -1008,16 +1265,18 @@ luau_unsetKeyword(GPtrArray *keywords, const char *oldKeyword) {
  */
 gboolean
 luau_checkKeyword(const GPtrArray *keywords, const char *needle) {
-	GContainer *cont;
-	gboolean result;
+	unsigned int i;
+	const char *curr;
+	gboolean result = FALSE;
 	
 	if (keywords != NULL && needle != NULL) {
-		cont = g_container_new_from_data(GCONT_PTR_ARRAY, (void*)keywords);
-		result = lutil_findString(cont, needle);
-		g_container_free(cont, FALSE);
+		/* Keywords read from a repository file are interned (see arena.h), so checking
+		   for one taken from the same file usually finds it without comparing strings */
+		for (i = 0; i < keywords->len && !result; ++i) {
+			curr = g_ptr_array_index(keywords, i);
+			result = (curr == needle || lutil_streq(curr, needle));
+		}
 	}
-	else
-		result = FALSE;
 	
 	return result;
 }
@@ -1129,20 +1388,22 @@ luau_satisfiesQuant(const AQuantifier *needed, const AProgInfo *installed) {
 
 AQuantDataType
 luau_parseQuantDataType(const char *str) {
+	const char *name;
 	AQuantDataType type;
 	
-	if (lutil_strcaseeq(str, "version"))
-		type = LUAU_QUANT_DATA_VERSION;
-	else if (lutil_strcaseeq(str, "interface"))
-		type = LUAU_QUANT_DATA_INTERFACE;
-	else if (lutil_strcaseeq(str, "date"))
-		type = LUAU_QUANT_DATA_DATE;
-	else if (lutil_strcaseeq(str, "keyword"))
-		type = LUAU_QUANT_DATA_KEYWORD;
-	else
-		type = LUAU_QUANT_DATA_INVALID;
+	if (str == NULL)
+		return LUAU_QUANT_DATA_INVALID;
+	
+	/* Only one name can have the same length and first letter (see LUAU_TAG_KEY) */
+	switch (LUAU_TAG_KEY(strlen(str), g_ascii_tolower(str[0]))) {
+		case LUAU_TAG_KEY(7, 'v'): name = "version";   type = LUAU_QUANT_DATA_VERSION;   break;
+		case LUAU_TAG_KEY(9, 'i'): name = "interface"; type = LUAU_QUANT_DATA_INTERFACE; break;
+		case LUAU_TAG_KEY(4, 'd'): name = "date";      type = LUAU_QUANT_DATA_DATE;      break;
+		case LUAU_TAG_KEY(7, 'k'): name = "keyword";   type = LUAU_QUANT_DATA_KEYWORD;   break;
+		default:                   return LUAU_QUANT_DATA_INVALID;
+	}
 	
-	return type;
+	return lutil_strcaseeq(str, name) ? type : LUAU_QUANT_DATA_INVALID;
 }
 
 /**
@@ -1217,21 +1478,22 @@ luau_copyUpdate(AUpdate *dest, const AUpdate *src) {
 		dest->shortDesc = g_strdup(src->shortDesc);
 		dest->fullDesc = g_strdup(src->fullDesc);
 		dest->newVersion = g_strdup(src->newVersion);
+		dest->newVersionKey = (src->newVersionKey != NULL) ? luau_versionkey_new(dest->newVersion) : NULL;
+		dest->newDisplayVersion = g_strdup(src->newDisplayVersion);
 		dest->newURL = g_strdup(src->newURL);
 		
 		dest->type = src->type;
 		dest->availableFormats = src->availableFormats;
 		luau_copyInterface(&(dest->interface), &(src->interface));
 		
+		/* The copy has its own everything, wherever the original's came from */
+		dest->arena = NULL;
+		dest->fields = src->fields;
+		
 		if (src->keywords != NULL) {
-			GContainer *destCont, *srcCont;
-
-			dest->keywords = g_ptr_array_new();
-			destCont = g_container_new_from_data(GCONT_PTR_ARRAY, dest->keywords);
-			srcCont = g_container_new_from_data(GCONT_PTR_ARRAY, src->keywords);
-			g_container_copy(destCont, srcCont);
-			g_container_free(srcCont, FALSE);
-			g_container_free(destCont, FALSE);
+			dest->keywords = g_ptr_array_sized_new(src->keywords->len);
+			for (i = 0; i < src->keywords->len; ++i)
+				g_ptr_array_add(dest->keywords, g_strdup(g_ptr_array_index(src->keywords, i)));
 		} else {
 			dest->keywords = NULL;
 		}
@@ -1271,6 +1533,126 @@ luau_copyUpdate(AUpdate *dest, const AUpdate *src) {
 	}
 }
 
+/**
+ * Make \c dest an update with the same contents as \c src, for a list of its own.  An
+ * update read from a repository file isn't copied: \c dest shares everything that
+ * was read with \c src (and with the other updates from the same file), and gets
+ * only arrays of its own, so that it can be categorized separately.  Keywords added
+ * to \c src since it was read (such as those luau adds when categorizing it) aren't
+ * passed on.  Other updates are copied with \ref luau_copyUpdate.
+ *
+ * @arg dest is the AUpdate struct to fill in.
+ * @arg src is the update to share.
+ */
+void
+luau_shareUpdate(AUpdate *dest, const AUpdate *src) {
+	const char *keyword;
+	unsigned int i;
+	
+	if (src->arena == NULL) {
+		luau_copyUpdate(dest, src);
+		return;
+	}
+	
+	*dest = *src;
+	dest->arena = luau_arena_ref(src->arena);
+	
+	if (src->keywords != NULL) {
+		dest->keywords = g_ptr_array_sized_new(src->keywords->len);
+		for (i = 0; i < src->keywords->len; ++i) {
+			keyword = g_ptr_array_index(src->keywords, i);
+			if (luau_arena_isInterned(src->arena, keyword))
+				g_ptr_array_add(dest->keywords, (char *) keyword);
+		}
+	}
+	if (src->packages != NULL) {
+		dest->packages = g_ptr_array_sized_new(src->packages->len);
+		for (i = 0; i < src->packages->len; ++i)
+			g_ptr_array_add(dest->packages, g_ptr_array_index(src->packages, i));
+	}
+	if (src->quantifiers != NULL) {
+		dest->quantifiers = g_ptr_array_sized_new(src->quantifiers->len);
+		for (i = 0; i < src->quantifiers->len; ++i)
+			g_ptr_array_add(dest->quantifiers, g_ptr_array_index(src->quantifiers, i));
+	}
+}
+
+/**
+ * Make an update from a list returned by \ref luau_checkForUpdates (or the like)
+ * independent of the rest of the list.  The contents of the updates read from one
+ * repository file are allocated together, and are only released once every one of
+ * those updates has been free'd; a program that hangs on to a single update after
+ * freeing the rest of its list can detach it first, so that it no longer keeps the
+ * memory of the whole list alive.
+ *
+ * The update stays where it is (so pointers to it remain valid), but all its strings,
+ * packages, etc. are replaced by copies of their own.  Updates which aren't shared
+ * (such as those made by \ref luau_copyUpdate) are left alone.
+ *
+ * @arg update is the update to detach.
+ */
+void
+luau_detachUpdate(AUpdate *update) {
+	AUpdate copy;
+	
+	if (update == NULL || update->arena == NULL)
+		return;
+	
+	luau_copyUpdate(&copy, update);
+	luau_freeUpdateInfo(update);
+	*update = copy;
+}
+
+/**
+ * Get the full list of mirrors of a package, as (weight, URL) pairs.  Packages read
+ * from a repository file that are found on mirrors defined elsewhere in the file
+ * just point to those mirrors (see \ref AMirrorSet); this spells out their URLs
+ * along with the ones in \c pkgInfo->mirrors.  The package itself isn't changed, so
+ * any number of threads can look up the mirrors of the same package at once.
+ *
+ * @arg pkgInfo is the package to list the mirrors of.
+ * @return a new array (empty if the package has no mirrors), to be free'd with
+ *         \ref luau_freePackageMirrors.
+ */
+GPtrArray *
+luau_getPackageMirrors(const APackage *pkgInfo) {
+	GPtrArray *mirrors;
+	unsigned int i;
+	
+	g_return_val_if_fail(pkgInfo != NULL, NULL);
+	
+	mirrors = g_ptr_array_sized_new(((pkgInfo->mirrors != NULL) ? pkgInfo->mirrors->len : 0) +
+	                                ((pkgInfo->mirrorSet != NULL) ? 2 * pkgInfo->mirrorSet->n : 0));
+	
+	if (pkgInfo->mirrors != NULL) {
+		for (i = 0; i + 1 < pkgInfo->mirrors->len; i += 2) {
+			g_ptr_array_add(mirrors, g_ptr_array_index(pkgInfo->mirrors, i));
+			g_ptr_array_add(mirrors, g_strdup(g_ptr_array_index(pkgInfo->mirrors, i+1)));
+		}
+	}
+	if (pkgInfo->mirrorSet != NULL)
+		expandMirrorSet(mirrors, pkgInfo->mirrorSet, pkgInfo->mirrorPath);
+	
+	return mirrors;
+}
+
+/**
+ * Free a list of mirrors returned by \ref luau_getPackageMirrors.
+ *
+ * @arg mirrors is the list to free.
+ */
+void
+luau_freePackageMirrors(GPtrArray *mirrors) {
+	unsigned int i;
+	
+	if (mirrors == NULL)
+		return;
+	
+	for (i = 1; i < mirrors->len; i += 2)
+		g_free(g_ptr_array_index(mirrors, i));
+	g_ptr_array_free(mirrors, TRUE);
+}
+
 void
 luau_copyPackage(APackage *dest, const APackage *src) {
 	unsigned int i;
@@ -1281,8 +1663,12 @@ luau_copyPackage(APackage *dest, const APackage *src) {
 	} else {
 		dest->type = src->type;
 		dest->size = src->size;
+		dest->version = g_strdup(src->version);
+		dest->versionKey = (src->versionKey != NULL) ? luau_versionkey_new(dest->version) : NULL;
 		strncpy(dest->md5sum, src->md5sum, 33);
-		if (src->mirrors != NULL) {
+		if (src->mirrors == NULL) {
+			dest->mirrors = NULL;
+		} else {
 			dest->mirrors = g_ptr_array_new();
 			for (i = 0; i < src->mirrors->len; i++) {
 				if (i%2) /* odd entries => strings */
@@ -1293,6 +1679,16 @@ luau_copyPackage(APackage *dest, const APackage *src) {
 				}
 			}
 		}
+		
+		/* The copy gets the shared mirrors spelled out, since they belong to the
+		   original's arena */
+		if (src->mirrorSet != NULL) {
+			if (dest->mirrors == NULL)
+				dest->mirrors = g_ptr_array_sized_new(2 * src->mirrorSet->n);
+			expandMirrorSet(dest->mirrors, src->mirrorSet, src->mirrorPath);
+		}
+		dest->mirrorSet = NULL;
+		dest->mirrorPath = NULL;
 	}
 	
 #ifdef DEBUG
@@ -1399,8 +1795,11 @@ luau_copyQuant(AQuantifier *dest, const AQuantifier *src) {
 			luau_copyDate(dest->data, src->data);
 			break;
 
-		case LUAU_QUANT_DATA_VERSION:
 		case LUAU_QUANT_DATA_INTERFACE:
+			dest->data = g_memdup(src->data, sizeof(AInterface));
+			break;
+
+		case LUAU_QUANT_DATA_VERSION:
 		case LUAU_QUANT_DATA_KEYWORD:
 			dest->data = g_strdup(src->data);
 			break;
@@ -1461,7 +1860,11 @@ luau_freeProgInfo(AProgInfo *ptr) {
 }
 
 /**
- * Free an AUpdate struct
+ * Free an AUpdate struct.  For an update read from a repository file, this drops
+ * its hold on the memory it shares with the other updates from that file (see
+ * \ref luau_detachUpdate), which goes once all of them have been free'd: apart
+ * from its arrays and any keywords added since it was read, nothing of the update
+ * is free'd by itself.
  *
  * @arg ptr is the struct to free
  */
@@ -1469,39 +1872,63 @@ void
 luau_freeUpdateInfo(AUpdate *ptr) {
 	APackage *pkg;
 	AQuantifier *quant;
+	char *keyword;
 	unsigned int i;
 	
-	if (ptr != NULL) {
-		nnull_g_free(ptr->id);
-		nnull_g_free(ptr->date);
-		nnull_g_free(ptr->shortDesc);
-		nnull_g_free(ptr->fullDesc);
-		nnull_g_free(ptr->newVersion);
-		nnull_g_free(ptr->newURL);
-		
+	if (ptr == NULL) {
+		DBUGOUT("Attempt to free NULL pointer");
+		return;
+	}
+	
+	if (ptr->arena != NULL) {
+		/* The keywords read from the file are interned; luau_setKeyword adds copies of its own */
 		if (ptr->keywords != NULL) {
-			for (i = 0; i < ptr->keywords->len; ++i)
-				g_free(g_ptr_array_index(ptr->keywords, i));
+			for (i = 0; i < ptr->keywords->len; ++i) {
+				keyword = g_ptr_array_index(ptr->keywords, i);
+				if (!luau_arena_isInterned(ptr->arena, keyword))
+					g_free(keyword);
+			}
 			g_ptr_array_free(ptr->keywords, TRUE);
 		}
-		if (ptr->packages != NULL) {
-			for (i = 0; i < ptr->packages->len; ++i) {
-				pkg = g_ptr_array_index(ptr->packages, i);
-				luau_freePkgInfo(pkg);
-				g_free(pkg);
-			}
+		if (ptr->packages != NULL)
 			g_ptr_array_free(ptr->packages, TRUE);
-		}
-		if (ptr->quantifiers != NULL) {
-			for (i = 0; i < ptr->quantifiers->len; ++i) {
-				quant = g_ptr_array_index(ptr->quantifiers, i);
-				g_free(quant->data);
-				g_free(quant);
-			}
+		if (ptr->quantifiers != NULL)
 			g_ptr_array_free(ptr->quantifiers, TRUE);
+		
+		luau_arena_unref(ptr->arena);
+		ptr->arena = NULL;
+		return;
+	}
+	
+	nnull_g_free(ptr->id);
+	nnull_g_free(ptr->date);
+	nnull_g_free(ptr->shortDesc);
+	nnull_g_free(ptr->fullDesc);
+	nnull_g_free(ptr->newVersion);
+	nnull_g_free(ptr->newVersionKey);
+	nnull_g_free(ptr->newDisplayVersion);
+	nnull_g_free(ptr->newURL);
+	
+	if (ptr->keywords != NULL) {
+		for (i = 0; i < ptr->keywords->len; ++i)
+			g_free(g_ptr_array_index(ptr->keywords, i));
+		g_ptr_array_free(ptr->keywords, TRUE);
+	}
+	if (ptr->packages != NULL) {
+		for (i = 0; i < ptr->packages->len; ++i) {
+			pkg = g_ptr_array_index(ptr->packages, i);
+			luau_freePkgInfo(pkg);
+			g_free(pkg);
 		}
-	} else {
-		DBUGOUT("Attempt to free NULL pointer");
+		g_ptr_array_free(ptr->packages, TRUE);
+	}
+	if (ptr->quantifiers != NULL) {
+		for (i = 0; i < ptr->quantifiers->len; ++i) {
+			quant = g_ptr_array_index(ptr->quantifiers, i);
+			g_free(quant->data);
+			g_free(quant);
+		}
+		g_ptr_array_free(ptr->quantifiers, TRUE);
 	}
 }
 
@@ -1515,6 +1942,9 @@ luau_freePkgInfo(APackage *ptr) {
 	unsigned int i;
 	
 	if (ptr != NULL) {
+		nnull_g_free(ptr->version);
+		nnull_g_free(ptr->versionKey);
+		nnull_g_free(ptr->mirrorPath);
 		if (ptr->mirrors != NULL) {
 			for (i = 1; i < ptr->mirrors->len; i+=2)
 				g_free(g_ptr_array_index(ptr->mirrors, i));
@@ -1528,90 +1958,6 @@ luau_freePkgInfo(APackage *ptr) {
 
 /* Non-Interface Methods */
 
-/* compareAlphaNumeric <VERSION1> <VERSION2>
- * Returns: 1 or 0.
- *
- * Compare two strings and return 1 if VERSION1 > VERSION2, otherwise 0.
- * Otherwise, gathers digits forward to compare full numbers.
- */
-
-static int
-compareAlphaNumeric(const char *v1, const char *v2) {
-	int i, len1, len2, limit, result = 0;
-	
-	if (v1 == NULL)
-		v1 = "";
-	if (v2 == NULL)
-		v2 = "";
-	
-	/* get length of the longest string to index with over as $limit */
-	len1 = strlen(v1);
-	len2 = strlen(v2);
-	if (len1 > len2)
-		limit = len1;
-	else
-		limit = len2;
-	
-	for (i = 0; i < limit; ++i) {
-		char char1, char2;
-		int val1, val2;
-		
-		/* compare character by character indexing up the string */
-		if (i < len1)
-			char1 = v1[i];
-		else
-			char1 = '\0';
-		
-		if (i < len2)
-			char2 = v2[i];
-		else
-			char2 = '\0';
-		
-		/* special case: point release is higher than alphabetic release
-		 * example: REQUIRED 2.5-pre3 < CURRENT 2.5 or REQUIRED alpha-char < CURRENT no char */
-		if (! isdigit(char1) && char2 == '\0')
-			return -1;
-
-		/* look forward to find next index digit to complete the full number */
-		if (isdigit(v1[i]))
-			val1 = atoi(v1 + i);
-		else if (char1 == '\0')
-			val1 = 0;
-		else
-			val1 = -1;
-		
-		if (isdigit(v2[i]))
-			val2 = atoi(v2 + i);
-		else if (char2 == '\0')
-			val2 = 0;
-		else
-			val2 = -1;
-
-		/* if comparing numbers do an integer compare - otherwise do a string compare */
-		if (val1 != -1 || val2 != -1) {
-			if (val1 > val2) {
-				result = 1;
-				break;
-			} else if (val1 < val2) {
-				result = -1;
-				break;
-			} else if (val1 >= 10) {
-				/* Skip over digits of number we just checked */
-				i += (int)log10(val1);
-			}
-		} else if (char1 < char2) {
-			result = -1;
-			break;
-		} else if (char1 > char2) {
-			result = 1;
-			break;
-		}
-	}
-	
-	return result;
-}
-
-
 /**
  * Take an updates array and apply the appropriate internal keywords ("_hidden" and/or "_incompatible")
  * to them.
@@ -1621,6 +1967,7 @@ compareAlphaNumeric(const char *v1, const char *v2) {
  */
 static void
 categorizeUpdates(GContainer *updates, const AProgInfo *progInfo) {
+	AInstalled installed;
 	GIterator iter;
 	AUpdate *curr;
 	
@@ -1629,18 +1976,79 @@ categorizeUpdates(GContainer *updates, const AProgInfo *progInfo) {
 		return;
 	}
 	
+	initInstalled(&installed, progInfo);
 	g_container_get_iter(&iter, updates);
 	while (g_iterator_hasNext(&iter)) {
 		curr = g_iterator_next(&iter);
-		categorizeUpdate(curr, progInfo);
+		categorizeUpdate(curr, &installed);
 	}
+	freeInstalled(&installed);
 }
 
+/* Fetch, read in and categorize the updates for a program */
+static GList *
+queryServer(const AProgInfo *info, AUpdateFields fields, const AUpdateFilter *filter,
+            ACallbackWithData callback, void *userData, GError **err) {
+	AUpdateStream stream;
+	GContainer *result;
+	
+	initInstalled(&(stream.installed), info);
+	stream.callback = callback;
+	stream.userData = userData;
+	
+	/* Updates are categorized as they arrive, rather than all at once at the end */
+	DBUGOUT("Checking for updates for %s: %s", info->id, info->url);
+	result = luau_net_queryServer(info, fields, filter, categorizeArriving, &stream, err);
+	freeInstalled(&(stream.installed));
+	if (result == NULL) {
+		g_assert(err == NULL || *err != NULL);
+		return NULL;
+	}
+	
+	return g_container_free(result, FALSE);
+}
+
+/* Parser callback for queryServer */
 static void
-categorizeUpdate(AUpdate *update, const AProgInfo *progInfo) {
-	if (isIncompatible(update, progInfo))
+categorizeArriving(void *update, void *stream) {
+	AUpdateStream *dest = (AUpdateStream *) stream;
+	
+	categorizeUpdate((AUpdate *) update, &(dest->installed));
+	
+	if (dest->callback != NULL)
+		dest->callback(update, dest->userData);
+}
+
+/* Add the (weight, URL) pairs for a package at path on each of a set of mirrors to mirrors */
+static void
+expandMirrorSet(GPtrArray *mirrors, const AMirrorSet *mirrorSet, const char *path) {
+	unsigned int i;
+	
+	for (i = 0; i < mirrorSet->n; ++i) {
+		g_ptr_array_add(mirrors, GINT_TO_POINTER (mirrorSet->weights[i]));
+		g_ptr_array_add(mirrors, g_strconcat(mirrorSet->urls[i], "/", path, NULL));
+	}
+}
+
+/* Split up the installed versions of a program, for categorizeUpdate */
+static void
+initInstalled(AInstalled *installed, const AProgInfo *info) {
+	installed->info = info;
+	installed->version = luau_versionkey_new(info->version);
+	installed->pkgVersion = luau_versionkey_new(info->pkgVersion);
+}
+
+static void
+freeInstalled(AInstalled *installed) {
+	g_free(installed->version);
+	g_free(installed->pkgVersion);
+}
+
+static void
+categorizeUpdate(AUpdate *update, const AInstalled *installed) {
+	if (isIncompatible(update, installed->info))
 		luau_setKeyword(update->keywords, "_incompatible");
-	if (isOld(update, progInfo))
+	if (isOld(update, installed))
 		luau_setKeyword(update->keywords, "_old");
 }
 
@@ -1674,7 +2082,9 @@ isIncompatible(AUpdate *update, const AProgInfo *progInfo) {
 }
 
 static gboolean
-isOld(AUpdate *update, const AProgInfo *progInfo) {
+isOld(AUpdate *update, const AInstalled *installed) {
+	const AProgInfo *progInfo = installed->info;
+	const AVersionKey *newPkgKey;
 	gboolean result;
 	int ret;
 	
@@ -1684,11 +2094,11 @@ isOld(AUpdate *update, const AProgInfo *progInfo) {
 	}
 	else
 	{
-		ret = luau_versioncmp(update->newVersion, progInfo->version);
+		ret = luau_versionkey_cmpCached(update->newVersion, update->newVersionKey, progInfo->version, installed->version);
 		if (ret == 0 && progInfo->pkgVersion != NULL)
 		{
-			char *newPkgVersion = luau_getMostRecentPkgVersion(update->packages);
-			ret = luau_versioncmp(newPkgVersion, progInfo->pkgVersion);
+			const char *newPkgVersion = luau_versionkey_mostRecent(update->packages, &newPkgKey);
+			ret = luau_versionkey_cmpCached(newPkgVersion, newPkgKey, progInfo->pkgVersion, installed->pkgVersion);
 		}
 		result = (ret != 1);
 	}
@@ -1699,19 +2109,9 @@ isOld(AUpdate *update, const AProgInfo *progInfo) {
 char *
 luau_getMostRecentPkgVersion(GPtrArray *packages)
 {
-	APackage *pkg;
-	char *mostRecent;
-	int i;
-	mostRecent = "0";
-	for (i = 0; i < packages->len; ++i)
-	{
-		pkg = g_ptr_array_index(packages, i);
-		if (luau_versioncmp(pkg->version, mostRecent) > 0)
-		{
-			mostRecent = pkg->version;
-		}
-	}
-	return mostRecent;
+	const AVersionKey *key;
+	
+	return (char *) luau_versionkey_mostRecent(packages, &key);
 }
 
 
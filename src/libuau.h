@@ -40,6 +40,9 @@
 #define LUAU_XML_INTERFACE_MAJOR 1
 #define LUAU_XML_INTERFACE_MINOR 2
 
+/// Default number of simultaneous repository downloads for \ref luau_checkForUpdates_all
+#define LUAU_DEFAULT_CONCURRENCY 8
+
 #define LUAU_EMPTY   0
 #define LUAU_RPM     1 << 0
 #define LUAU_DEB     1 << 1
@@ -117,6 +120,39 @@ typedef void (*AFloatCallback) (float data);
 typedef void (*ACallbackWithData) (void *callback_data, void *user_data);
 typedef int  (*AProgressCallback) (void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
 
+/// How packages are downloaded
+typedef enum { LUAU_DOWNLOAD_SINGLE,      /**< Download the whole file from one mirror          */
+               LUAU_DOWNLOAD_SEGMENTED    /**< Download pieces of the file from several mirrors */
+} ADownloadMode;
+
+/// Which parts of each update to read in when checking for updates.  Anything left out is
+/// simply NULL (or empty) in the updates returned; \ref luau_getUpdateInfo reads an update in full.
+typedef enum { LUAU_FIELDS_FULL,          /**< Everything                                               */
+               LUAU_FIELDS_SUMMARY,       /**< What a list of updates shows: \c LUAU_FIELDS_CATEGORIZE
+                                               plus the short description, display version and date  */
+               LUAU_FIELDS_CATEGORIZE     /**< Only what updates are categorized by: ID, type, version,
+                                               interface, keywords, quantifiers, and the type and
+                                               version of each package (without any mirrors)         */
+} AUpdateFields;
+
+/// How updates are ranked when only the best few are wanted (updates that rank the same
+/// keep the order they're listed in)
+typedef enum { LUAU_ORDER_NEWEST,         /**< Newest version first (then newest package version) */
+               LUAU_ORDER_INTERFACE       /**< Highest interface version first                     */
+} AUpdateOrder;
+
+/// Which updates to read in when checking for updates (see \ref luau_checkForUpdates_filtered).
+/// Updates that don't pass are skipped over by the parser without being read in at all.
+/// Set one up with \ref luau_initUpdateFilter, which lets everything through.
+typedef struct {
+	int type;            /**< Only updates of this AUpdateType (-1 for any)                        */
+	APkgType formats;    /**< Only updates available in one of these package formats (0 for any)  */
+	gboolean newerOnly;  /**< Only updates newer than the installed program (ie., not "_old")      */
+	int interfaceMajor;  /**< Only updates with this interface major version (-1 for any)          */
+	unsigned int limit;  /**< Only this many of the updates passing, the best by \c order (0 for all) */
+	AUpdateOrder order;  /**< How updates are ranked when there's a \c limit                      */
+} AUpdateFilter;
+
 /// Date structure
 typedef struct {
 	short day;
@@ -124,13 +160,29 @@ typedef struct {
 	int year;
 } ADate;
 
+/// A set of mirrors shared by all the packages from one repository file that use the
+/// same mirrors (from a mirror-list, say).  Never changed once it has been read.
+typedef struct {
+	unsigned int n;     /**< Number of mirrors                       */
+	const char **urls;  /**< Base URL of each mirror                 */
+	const int *weights; /**< Weight of each mirror (adding up to 100) */
+} AMirrorSet;
+
+/// A version string split up for comparing (see versionkey.h)
+typedef struct _AVersionKey AVersionKey;
+
 /// Describe a specific package (ie, an RPM for an update)
 typedef struct {
 	APkgType type;      /**< Type of given package             */
-	GPtrArray *mirrors; /**< list of mirrors for given package */
+	GPtrArray *mirrors; /**< list of mirrors for given package (weight, URL, weight, URL...), not
+	                         counting \c mirrorSet: use \ref luau_getPackageMirrors to list them all */
 	char md5sum[33];    /**< Computed md5 sum of given package */
 	char *version;      /**< Version number of this package    */
 	guint32 size;       /**< Size (in bytes) of given package  */
+	const AMirrorSet *mirrorSet; /**< Shared mirrors the package is also found on (or NULL) */
+	char *mirrorPath;   /**< Location of the package relative to each of the mirrors in \c mirrorSet */
+	AVersionKey *versionKey; /**< \c version split up for comparing (or NULL, in which case it's
+	                              split up each time it's compared) */
 } APackage;
 
 /// Describe the interface of a program.  Only really relevant for libraries.
@@ -139,6 +191,9 @@ typedef struct {
 	int minor; /**< Specifies a "patch" version - is compatible with all packages with lower minor number */
 } AInterface;
 
+/// Block of memory the contents of parsed updates are allocated from (see arena.h)
+typedef struct _AArena AArena;
+
 /// Describe all aspects of any type of update (software, message, etc.)
 typedef struct {
 	/* Valid for all update types */
@@ -162,6 +217,15 @@ typedef struct {
 	
 	/* extra LIBUPDATE parameters */
 	char *newURL;                /**< New location of Luau XML file. */
+	
+	AArena *arena;               /**< Memory the update's contents were allocated from, shared with
+	                                  the other updates from the same file (NULL if each part was
+	                                  allocated separately).  The contents of such an update mustn't
+	                                  be replaced (other than adding keywords with \ref luau_setKeyword)
+	                                  without detaching it first: see \ref luau_detachUpdate. */
+	AUpdateFields fields;        /**< Which parts of the update were read in */
+	AVersionKey *newVersionKey;  /**< \c newVersion split up for comparing (or NULL, in which case
+	                                  it's split up each time it's compared) */
 } AUpdate;
 
 typedef struct {
@@ -197,11 +261,23 @@ LUAU_DLL_EXPORT gboolean luau_getProgInfoFromXML_data(AProgInfo *progInfo, const
 LUAU_DLL_EXPORT gboolean luau_getUpdateInfo(AUpdate *update, const char* updateID, const AProgInfo *progInfo, GError **err);
 /// Retrieve any new updates for the specified program
 LUAU_DLL_EXPORT GList* luau_checkForUpdates(const AProgInfo *info, GError **err);
+/// Retrieve any new updates for the specified program, reading in only the given parts of them
+LUAU_DLL_EXPORT GList* luau_checkForUpdates_fields(const AProgInfo *info, AUpdateFields fields, GError **err);
+/// Set up an update filter that lets every update through
+LUAU_DLL_EXPORT void luau_initUpdateFilter(AUpdateFilter *filter);
+/// Retrieve the updates for the specified program which pass \c filter
+LUAU_DLL_EXPORT GList* luau_checkForUpdates_filtered(const AProgInfo *info, const AUpdateFilter *filter, AUpdateFields fields, GError **err);
+/// Retrieve any new updates for the specified program, passing each to \c callback as soon as it arrives
+LUAU_DLL_EXPORT GList* luau_checkForUpdates_stream(const AProgInfo *info, AUpdateFields fields, ACallbackWithData callback, void *userData, GError **err);
 /// Retrieve all updates from the specified URL
 LUAU_DLL_EXPORT GList* luau_checkForUpdates_url(const char *url, GError **err);
+/// Retrieve any new updates for several programs, contacting their servers concurrently
+LUAU_DLL_EXPORT GPtrArray* luau_checkForUpdates_all(const GPtrArray *infos, AUpdateFields fields, int maxConcurrent, GPtrArray *errors);
 
 /// Download and install an update of type \c type
 LUAU_DLL_EXPORT gboolean luau_installUpdate(const AProgInfo *info, const AUpdate *newUpdate, const APkgType type, GError **err);
+/// Download a package to \c filename (using the current download mode)
+LUAU_DLL_EXPORT gboolean luau_downloadPackage(const APackage *package, const char *filename, GError **err);
 /// Download but do not install an update of type \c type to \c filename
 LUAU_DLL_EXPORT char* luau_downloadUpdate(const AProgInfo *info, const AUpdate *newUpdate, const APkgType type, const char* filename, GError **err);
 /// Install an already downloaded package
@@ -213,6 +289,14 @@ LUAU_DLL_EXPORT void luau_registerErrorFunc(AErrorFunc errorFunc);*/
 LUAU_DLL_EXPORT void luau_registerPromptFunc(APromptFunc promptFunc);
 /// Set a new function to callback (in order to show download progress) when downloading 
 LUAU_DLL_EXPORT void luau_registerProgressCallback(AProgressCallback callback);
+/// Choose how packages are downloaded (from one mirror or from several in parallel)
+LUAU_DLL_EXPORT void luau_setDownloadMode(ADownloadMode mode);
+/// Get a curl handle which shares connections, DNS lookups and TLS sessions with libuau's own transfers
+LUAU_DLL_EXPORT void* luau_acquireTransferHandle(void);
+/// Give back a handle obtained from \ref luau_acquireTransferHandle
+LUAU_DLL_EXPORT void luau_releaseTransferHandle(void *handle);
+/// Free the connections and caches libuau keeps between calls (and save what it has learned about mirrors)
+LUAU_DLL_EXPORT void luau_cleanup(void);
 /*/// Reset the error function to the default function
 LUAU_DLL_EXPORT void luau_resetErrorFunc(void);*/
 /// Reset the prompting function to the default function
@@ -254,7 +338,15 @@ LUAU_DLL_EXPORT GSList* luau_packageTypeList(APkgType types);
 LUAU_DLL_EXPORT APackage* luau_getUpdatePackage(const AUpdate *update, APkgType pkgType, GError **err);
 /// Check if package type \c type is included in package aggregate \c query
 LUAU_DLL_EXPORT gboolean luau_isOfType(APkgType query, APkgType type);
-LUAU_DLL_EXPORT char * luau_getPackageURL(APackage *pkgInfo, GError **err);
+/// Choose a mirror to download a package from.  Since libuau interface 4 the URL is the
+/// caller's to g_free (it used to point into the package, which may no longer hold it)
+LUAU_DLL_EXPORT char * luau_getPackageURL(const APackage *pkgInfo, GError **err);
+/// Order all the mirrors of a package by preference (the URLs and the array are the caller's to free)
+LUAU_DLL_EXPORT GPtrArray * luau_getPackageURLs(const APackage *pkgInfo, GError **err);
+/// List all the mirrors of a package as (weight, URL) pairs, to be free'd with \ref luau_freePackageMirrors
+LUAU_DLL_EXPORT GPtrArray * luau_getPackageMirrors(const APackage *pkgInfo);
+/// Free a list of mirrors returned by \ref luau_getPackageMirrors
+LUAU_DLL_EXPORT void luau_freePackageMirrors(GPtrArray *mirrors);
 LUAU_DLL_EXPORT char * luau_getMostRecentPkgVersion(GPtrArray *packages);
 
 /* Date utilites */
@@ -264,6 +356,10 @@ LUAU_DLL_EXPORT int luau_datecmp(ADate *d1, ADate *d2);
 /* Version utilities */
 /// Compare two versions (works like \c strcmp but for version strings)
 LUAU_DLL_EXPORT int luau_versioncmp(const char *required, const char *current);
+/// Split up a version string once, for comparing many times with luau_versionkey_cmp
+LUAU_DLL_EXPORT AVersionKey* luau_versionkey_new(const char *version);
+/// Compare two split-up versions (works like \c luau_versioncmp on the strings)
+LUAU_DLL_EXPORT int luau_versionkey_cmp(const AVersionKey *required, const AVersionKey *current);
 
 /* Keyword utilities */
 /// Sets a keyword
@@ -293,6 +389,10 @@ LUAU_DLL_EXPORT AQuantDataType luau_parseQuantDataType(const char *str);
 /* Structure copying utilities */
 /// Copy an AUpdate struct
 LUAU_DLL_EXPORT void luau_copyUpdate(AUpdate *dest, const AUpdate *src);
+/// Make another update sharing the contents of an AUpdate struct
+LUAU_DLL_EXPORT void luau_shareUpdate(AUpdate *dest, const AUpdate *src);
+/// Give an update its own copy of everything it shares with the rest of its update list
+LUAU_DLL_EXPORT void luau_detachUpdate(AUpdate *update);
 /// Copy an APackage struct
 LUAU_DLL_EXPORT void luau_copyPackage(APackage *dest, const APackage *src);
 /// Copy an AProgInfo struct
@@ -0,0 +1,348 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __unix__
+#  include <unistd.h>
+#endif
+
+#include <glib.h>
+
+#include "mirrorstats.h"
+#include "util.h"
+#include "error.h"
+
+#ifdef WITH_DMALLOC
+#  include <dmalloc.h>
+#endif
+
+/// Weight given to the newest sample in the running averages
+#define MIRRORSTATS_ALPHA 0.3
+/// Percentage of selections which ignore the statistics, so that every mirror keeps being tried
+#define MIRRORSTATS_EXPLORE_PERCENT 10
+/// Bounds on how much the statistics may scale a mirror's weight
+#define MIRRORSTATS_MIN_FACTOR 0.05
+#define MIRRORSTATS_MAX_FACTOR 20.0
+/// Number of downloads recorded between saves of the statistics file
+#define MIRRORSTATS_SAVE_INTERVAL 16
+
+G_LOCK_DEFINE_STATIC(mirrorstats);
+static GHashTable *allStats = NULL;
+/// Number of downloads recorded since the statistics were last saved
+static unsigned int unsaved = 0;
+
+static void loadStats(void);
+static void saveStats(void);
+static void saveStat(gpointer key, gpointer value, gpointer data);
+static char* getStatsFilename(gboolean create);
+static char* getHost(const char *url);
+
+/**
+ * Record the outcome of a download from \c url.  Statistics are kept per host (not
+ * per URL), since it is the host that is fast or slow.  So that later runs can make
+ * use of them, they are saved to disk every MIRRORSTATS_SAVE_INTERVAL downloads and
+ * by \ref luau_mirrorstats_save (which luau_cleanup calls), rather than rewriting
+ * the file after every download.
+ *
+ * @arg <i>url</i> is the URL that was downloaded.
+ * @arg <i>success</i> is whether the download succeeded.
+ * @arg <i>throughput</i> is the average download speed in bytes per second (ignored on failure).
+ * @arg <i>ttfb</i> is the time, in seconds, until the first byte arrived (ignored on failure).
+ */
+void
+luau_mirrorstats_record(const char *url, gboolean success, double throughput, double ttfb) {
+	AMirrorStats *stats;
+	char *host;
+	
+	host = getHost(url);
+	if (host == NULL)
+		return;
+	
+	G_LOCK(mirrorstats);
+	
+	loadStats();
+	
+	stats = g_hash_table_lookup(allStats, host);
+	if (stats == NULL) {
+		stats = g_malloc0(sizeof(AMirrorStats));
+		g_hash_table_insert(allStats, host, stats);
+		
+		stats->failureRate = (success ? 0.0 : 1.0);
+		if (success) {
+			stats->throughput = throughput;
+			stats->ttfb = ttfb;
+		}
+	} else {
+		g_free(host);
+		
+		stats->failureRate = (1-MIRRORSTATS_ALPHA) * stats->failureRate + MIRRORSTATS_ALPHA * (success ? 0.0 : 1.0);
+		if (success) {
+			if (stats->throughput == 0)
+				stats->throughput = throughput;
+			else
+				stats->throughput = (1-MIRRORSTATS_ALPHA) * stats->throughput + MIRRORSTATS_ALPHA * throughput;
+			if (stats->ttfb == 0)
+				stats->ttfb = ttfb;
+			else
+				stats->ttfb = (1-MIRRORSTATS_ALPHA) * stats->ttfb + MIRRORSTATS_ALPHA * ttfb;
+		}
+	}
+	++stats->samples;
+	
+	if (++unsaved >= MIRRORSTATS_SAVE_INTERVAL)
+		saveStats();
+	
+	G_UNLOCK(mirrorstats);
+}
+
+/**
+ * Write the statistics to disk if any downloads have been recorded since they were
+ * last saved.
+ */
+void
+luau_mirrorstats_save(void) {
+	G_LOCK(mirrorstats);
+	if (unsaved > 0)
+		saveStats();
+	G_UNLOCK(mirrorstats);
+}
+
+/**
+ * Look up the recorded statistics for the host serving \c url.
+ *
+ * @arg <i>url</i> is a URL served by the host in question.
+ * @arg <i>stats</i> is where to store the statistics.
+ * @return whether any statistics were recorded for the host
+ */
+gboolean
+luau_mirrorstats_lookup(const char *url, AMirrorStats *stats) {
+	AMirrorStats *found;
+	char *host;
+	
+	host = getHost(url);
+	if (host == NULL)
+		return FALSE;
+	
+	G_LOCK(mirrorstats);
+	
+	loadStats();
+	found = g_hash_table_lookup(allStats, host);
+	if (found != NULL)
+		*stats = *found;
+	
+	G_UNLOCK(mirrorstats);
+	
+	g_free(host);
+	
+	return (found != NULL);
+}
+
+/**
+ * Scale the (XML supplied) weights of a set of mirrors by how well each mirror has
+ * performed in the past.  A mirror's weight is multiplied by its throughput relative
+ * to the average throughput of the mirrors with known statistics, and by the chance
+ * it won't fail.  Mirrors without any history keep their weight, so new mirrors get
+ * tried.  Every so often (see MIRRORSTATS_EXPLORE_PERCENT) the weights are left alone
+ * altogether, so that mirrors that did badly once get another chance.
+ *
+ * @arg <i>urls</i> are the mirror URLs.
+ * @arg <i>weights</i> are the corresponding mirror weights, which are adjusted in place.
+ * @arg <i>n</i> is the number of mirrors.
+ */
+void
+luau_mirrorstats_adjustWeights(const char **urls, double *weights, int n) {
+	AMirrorStats *stats;
+	double totalThroughput = 0, meanThroughput, factor;
+	gboolean *known;
+	int i, nKnown = 0;
+	
+	if (n < 2 || rand() % 100 < MIRRORSTATS_EXPLORE_PERCENT)
+		return;
+	
+	stats = g_malloc(n * sizeof(AMirrorStats));
+	known = g_malloc(n * sizeof(gboolean));
+	
+	for (i = 0; i < n; ++i) {
+		known[i] = luau_mirrorstats_lookup(urls[i], &stats[i]);
+		if (known[i] && stats[i].throughput > 0) {
+			totalThroughput += stats[i].throughput;
+			++nKnown;
+		}
+	}
+	meanThroughput = (nKnown > 0) ? totalThroughput / nKnown : 0;
+	
+	for (i = 0; i < n; ++i) {
+		if (!known[i])
+			continue;
+		
+		if (stats[i].throughput > 0 && meanThroughput > 0)
+			factor = stats[i].throughput / meanThroughput;
+		else
+			factor = 1.0;
+		factor *= 1.0 - stats[i].failureRate;
+		
+		factor = MAX(MIRRORSTATS_MIN_FACTOR, MIN(MIRRORSTATS_MAX_FACTOR, factor));
+		DBUGOUT("Mirror %s: %.0f B/s, %.2fs to first byte, %.0f%% failures: weight x %.2f",
+		        urls[i], stats[i].throughput, stats[i].ttfb, stats[i].failureRate * 100, factor);
+		
+		weights[i] *= factor;
+	}
+	
+	g_free(stats);
+	g_free(known);
+}
+
+
+/* Non-Interface Methods */
+
+/* Read the statistics file (once) */
+static void
+loadStats(void) {
+	AMirrorStats *stats;
+	char *filename, *data, **lines, host[256];
+	int i;
+	
+	if (allStats != NULL)
+		return;
+	
+	allStats = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	
+	filename = getStatsFilename(FALSE);
+	if (filename == NULL)
+		return;
+	
+	if (g_file_get_contents(filename, &data, NULL, NULL)) {
+		lines = g_strsplit(data, "\n", 0);
+		g_free(data);
+		
+		for (i = 0; lines[i] != NULL; ++i) {
+			if (lines[i][0] == '#' || lines[i][0] == '\0')
+				continue;
+			
+			stats = g_malloc0(sizeof(AMirrorStats));
+			if (sscanf(lines[i], "%255s %lf %lf %lf %d", host, &(stats->throughput), &(stats->ttfb),
+			           &(stats->failureRate), &(stats->samples)) == 5)
+				g_hash_table_replace(allStats, g_strdup(host), stats);
+			else
+				g_free(stats);
+		}
+		
+		g_strfreev(lines);
+	}
+	
+	g_free(filename);
+}
+
+/* Write the statistics file (called with the lock held) */
+static void
+saveStats(void) {
+	char *filename, *tempFile;
+	FILE *file;
+	
+	unsaved = 0;
+	
+	filename = getStatsFilename(TRUE);
+	if (filename == NULL)
+		return;
+	
+	tempFile = lutil_mprintf("%s.%d", filename, (int) getpid());
+	file = fopen(tempFile, "w");
+	if (file == NULL) {
+		DBUGOUT("Couldn't write mirror statistics to %s: %s", tempFile, strerror(errno));
+		g_free(tempFile);
+		g_free(filename);
+		return;
+	}
+	
+	fprintf(file, "# host throughput(B/s) ttfb(s) failure-rate samples\n");
+	g_hash_table_foreach(allStats, saveStat, file);
+	
+	if (fclose(file) != 0 || rename(tempFile, filename) != 0) {
+		DBUGOUT("Couldn't write mirror statistics to %s: %s", filename, strerror(errno));
+		unlink(tempFile);
+	}
+	
+	g_free(tempFile);
+	g_free(filename);
+}
+
+static void
+saveStat(gpointer key, gpointer value, gpointer data) {
+	AMirrorStats *stats = (AMirrorStats *) value;
+	
+	fprintf((FILE *) data, "%s %.0f %.3f %.3f %d\n", (char *) key, stats->throughput, stats->ttfb,
+	        stats->failureRate, stats->samples);
+}
+
+static char *
+getStatsFilename(gboolean create) {
+	char *filename, *dir;
+	const char *home;
+	
+	home = getenv("HOME");
+	if (home == NULL)
+		return NULL;
+	
+	filename = lutil_vstrcreate(home, "/" MIRRORSTATS_LOCAL_FILE, NULL);
+	
+	if (create) {
+		dir = g_path_get_dirname(filename);
+		if (!lutil_isDirectory(dir) && mkdir(dir, 0755) != 0 && errno != EEXIST) {
+			DBUGOUT("Couldn't create %s: %s", dir, strerror(errno));
+			g_free(dir);
+			g_free(filename);
+			return NULL;
+		}
+		g_free(dir);
+	}
+	
+	return filename;
+}
+
+/* Extract the host (and port) part of a URL: "http://host:port/path" -> "host:port" */
+static char *
+getHost(const char *url) {
+	const char *start, *end;
+	
+	if (url == NULL)
+		return NULL;
+	
+	start = strstr(url, "://");
+	start = (start == NULL) ? url : start + 3;
+	
+	/* Skip any user:password@ */
+	end = start + strcspn(start, "/?#");
+	if (memchr(start, '@', end - start) != NULL)
+		start = (const char *) memchr(start, '@', end - start) + 1;
+	
+	if (end == start)
+		return NULL;
+	
+	return g_strndup(start, end - start);
+}
@@ -0,0 +1,61 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+/** @file mirrorstats.h
+ * \brief Mirror health statistics
+ *
+ * Records how well each mirror host has performed on past downloads (throughput,
+ * time to first byte and how often it failed) and uses that to steer mirror
+ * selection towards hosts that have been fast and reliable.
+ */
+
+#ifndef MIRRORSTATS_H
+#define MIRRORSTATS_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+
+/// Where mirror statistics are kept (relative to the user's home directory)
+#define MIRRORSTATS_LOCAL_FILE ".luau/mirrorstats"
+
+/// Observed performance of one mirror host
+typedef struct {
+	/// Average download speed, in bytes per second
+	double throughput;
+	/// Average time to first byte, in seconds
+	double ttfb;
+	/// Average failure rate (0 = never fails, 1 = always fails)
+	double failureRate;
+	/// Number of downloads these figures are based on
+	int samples;
+} AMirrorStats;
+
+/// Record the outcome of a download from \c url
+void luau_mirrorstats_record(const char *url, gboolean success, double throughput, double ttfb);
+/// Write any statistics recorded since they were last saved to disk
+void luau_mirrorstats_save(void);
+/// Look up the statistics for the host serving \c url
+gboolean luau_mirrorstats_lookup(const char *url, AMirrorStats *stats);
+/// Scale mirror weights according to the mirrors' past performance
+void luau_mirrorstats_adjustWeights(const char **urls, double *weights, int n);
+
+#endif /* MIRRORSTATS_H */
@@ -21,12 +21,22 @@
 #  include <config.h>
 #endif
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 #ifdef __unix__
 #  include <unistd.h>
 #endif
 
+#include <curl/curl.h>
+
+
 #include "libuau.h"
 #include "network.h"
 #include "ftp.h"
@@ -34,24 +44,202 @@
 #include "error.h"
 #include "parseupdates.h"
 #include "md5.h"
+#include "cache.h"
+#include "mirrorstats.h"
+#include "transfer.h"
+#include "codec.h"
 
 #ifdef WITH_DMALLOC
 #  include <dmalloc.h>
 #endif
 
+/// HTTP validators (ETag / Last-Modified) sent along with a response
+typedef struct {
+	char *etag;
+	char *lastModified;
+} AValidators;
+
+/// One (conditional) repository transfer
+typedef struct {
+	const char *url;
+	CURL *handle;
+	struct curl_slist *headers;
+	/// The downloaded file, if it is wanted as a whole...
+	GString *contents;
+	/// ...or the parser it is fed to as it arrives
+	AUpdatesParser *parser;
+	/// First bytes of the file, kept until its compression format is known
+	char magic[CODEC_MAGIC_LENGTH];
+	size_t magicLength;
+	gboolean detected;
+	/// Decoder the file is passed through before parsing (NULL if it isn't compressed)
+	ADecoder *decoder;
+	/// Copy of the file being stored in the cache as it arrives (uncompressed, so the
+	/// cached copy doesn't depend on the Accept-Encoding the request was sent with)
+	ACacheWriter cacheWriter;
+	gboolean checkedResponse;
+	gboolean notModified;
+	/// Previously downloaded copy of \c url, if any
+	ACacheEntry cached;
+	gboolean haveCached;
+	/// Validators sent with this response
+	AValidators validators;
+	char errorBuffer[CURL_ERROR_SIZE];
+	GContainer *updates;
+	GError *error;
+} ARepoFetch;
+
+/// A repository fetch which other threads asking for the same URL wait for
+typedef struct {
+	/// The URL and the parts of the updates being read in from it (see joinFlight)
+	char *key;
+	gboolean done;
+	/// Number of threads waiting for the result
+	int waiters;
+	/// The result, shared in turn with each waiting thread (see shareUpdates)
+	GContainer *updates;
+	GError *error;
+} AFlight;
+
+/// What is known about the data in a partial download
+typedef struct {
+	AValidators validators;
+	/// MD5 sum of the file so far, still open for more data (never saved: the layout of
+	/// an MD5_CTX is up to the md5 code libuau was built with)
+	MD5_CTX md5Context;
+} APartialState;
+
+/// A (possibly resumed) package download
+typedef struct {
+	CURL *handle;
+	FILE *file;
+	/// Number of bytes already on disk when the transfer started
+	curl_off_t offset;
+	/// Number of bytes on disk now
+	curl_off_t written;
+	/// Expected size of the complete file (0 if unknown)
+	curl_off_t expectedSize;
+	gboolean tooLarge;
+	gboolean checkedResponse;
+	AValidators validators;
+	/// Running MD5 sum of everything on disk
+	MD5_CTX md5Context;
+} ADownload;
+
+/// One byte range of a segmented download
+typedef struct {
+	CURL *handle;
+	int fd;
+	/// Index (into the mirror URL list) of the mirror this range is being fetched from
+	int mirror;
+	/// First byte requested from the mirror
+	curl_off_t requestStart;
+	/// Next byte to write and end (exclusive) of the range; \c end may shrink while the transfer runs
+	curl_off_t pos, end;
+	gboolean checkedResponse;
+	char errorBuffer[CURL_ERROR_SIZE];
+} ASegment;
+
+/// Don't bother splitting a package into segments smaller than this
+#define MIN_SEGMENT_SIZE (256 * 1024)
+
+/// Give up on a mirror if it doesn't accept the connection within this many seconds
+#define MIRROR_CONNECT_TIMEOUT 15
+/// Give up on a mirror if the transfer is slower than MIRROR_LOW_SPEED_LIMIT bytes/second...
+#define MIRROR_LOW_SPEED_LIMIT 512
+/// ...for MIRROR_LOW_SPEED_TIME seconds
+#define MIRROR_LOW_SPEED_TIME 30
+/// Maximum number of download attempts (across all mirrors) for one package
+#define MAX_DOWNLOAD_ATTEMPTS 5
+
+/// Suffix for partially downloaded files
+#define PARTIAL_SUFFIX ".part"
+/// Suffix for the state files kept alongside partial downloads
+#define STATE_SUFFIX ".state"
+
+static AProgressCallback progressCallback = NULL;
+static ADownloadMode downloadMode = LUAU_DOWNLOAD_SINGLE;
+
+#ifdef USE_GTHREADS
+/* Repository fetches in progress, by URL (see luau_net_queryServer) */
+static GHashTable *flights = NULL;
+static GCond *flightLanded = NULL;
+G_LOCK_DEFINE_STATIC(flights);
+#endif
+
+static void initRepoFetch(ARepoFetch *fetch, const char *url, gboolean parse);
+static GString* finishRepoFetch(ARepoFetch *fetch, CURLcode result, GError **err);
+static GContainer* finishRepoParse(ARepoFetch *fetch, CURLcode result, GError **err);
+static GContainer* shareUpdates(const GContainer *updates);
+#ifdef USE_GTHREADS
+static AFlight* joinFlight(const char *url, AUpdateFields fields, gboolean *first);
+static GContainer* awaitFlight(AFlight *flight, GError **err);
+static void landFlight(AFlight *flight, const GContainer *updates, const GError *error);
+static void freeFlight(AFlight *flight);
+#endif
+static gboolean feedRepoData(ARepoFetch *fetch, const char *data, size_t len, GError **err);
+static gboolean feedParser(const char *data, gsize len, gpointer userData, GError **err);
+static gboolean feedCachedCopy(ARepoFetch *fetch, GError **err);
+static gboolean checkRepoComplete(ARepoFetch *fetch, GError **err);
+static size_t appendCallback(void *ptr, size_t size, size_t nmemb, void *data);
+static size_t parseCallback(void *ptr, size_t size, size_t nmemb, void *data);
+static size_t headerCallback(void *ptr, size_t size, size_t nmemb, void *data);
+static void freeValidators(AValidators *validators);
+static gboolean downloadPartial(const char *url, const char *partFile, const char *stateFile, curl_off_t offset,
+                                const APackage *package, APartialState *state, gboolean *rangeRejected, GError **err);
+static gboolean loadDownloadState(const char *stateFile, const char *url, const APackage *package, APartialState *state);
+static void saveDownloadState(const char *stateFile, const char *url, const APackage *package, const APartialState *state);
+static void resetPartialState(APartialState *state);
+static gboolean hashFileRange(const char *filename, curl_off_t start, curl_off_t end, MD5_CTX *context);
+static size_t downloadWriteCallback(void *ptr, size_t size, size_t nmemb, void *data);
+static int downloadProgressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow);
+static void setMirrorTimeouts(CURL *handle);
+static void recordMirrorStats(CURL *handle, const char *url, gboolean success);
+static gboolean checkMD5(const char *filename, const APackage *package, char *md5);
+static curl_off_t getRemoteSize(const char *url);
+static curl_off_t getContentLength(CURL *handle);
+static gboolean downloadSegmented(const GPtrArray *urls, curl_off_t size, const char *downloadTo, GError **err);
+static void startSegment(CURLM *multi, ASegment *segment, const char *url);
+static ASegment* splitSegment(GPtrArray *segments);
+static size_t segmentWriteCallback(void *ptr, size_t size, size_t nmemb, void *data);
+
 /**
  * Downloads the update file from the luau server for the given program and parses
  * it to read in the updates listed.  Note that it returns an array of <b>all</b>
  * the updates listed, including ones that have already been installed.
  *
+ * The file is parsed (and, if compressed, uncompressed) piece by piece as it
+ * arrives, so neither the downloaded nor the uncompressed file is ever held in
+ * memory as a whole.
+ *
+ * If \c callback is given, each update is passed to it as soon as it has been
+ * read (see luau_parseXML_updatesSetCallback), so the caller can start on the
+ * first updates in a large file while the rest of it is still downloading.
+ *
+ * Programs often share a repository.  If another thread is already fetching the
+ * same URL (for the same \c fields), this waits for that fetch and returns a copy
+ * of its result rather than downloading and parsing the file again (the copied
+ * updates are passed to \c callback one after the other once the fetch is done).
+ *
  * @arg <i>info</i> is a struct describing the program updates are wanted for.
+ * @arg <i>fields</i> says which parts of the updates to read in.
+ * @arg <i>filter</i> (optionally) says which updates to read in at all.  Filtered
+ *      fetches are never shared, since the result depends on the program's version.
+ * @arg <i>callback</i> is (optionally) called with each update as it is read.
+ * @arg <i>userData</i> is passed to \c callback.
  * @return a GPtrArray of updates
  */
 GContainer *
-luau_net_queryServer(const AProgInfo *info, GError **err) {
+luau_net_queryServer(const AProgInfo *info, AUpdateFields fields, const AUpdateFilter *filter, ACallbackWithData callback, void *userData, GError **err) {
+	ARepoFetch fetch;
+	CURLcode result;
 	GContainer *updates;
-	GString *contents, *temp;
-	int len;
+	GError *error = NULL;
+#ifdef USE_GTHREADS
+	AFlight *flight = NULL;
+	GIterator iter;
+	gboolean first = TRUE;
+#endif
 	
 	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
 	
@@ -59,33 +247,413 @@ luau_net_queryServer(const AProgInfo *info, GError **err) {
 		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_INVALID_ARG, "Can't check for updates: no URL specified");
 		return NULL;
 	}
-	contents = lutil_ftp_getURL(info->url, err);
-	if (contents == NULL) {
-		g_assert(err == NULL || *err != NULL);
-		return NULL;
+	
+#ifdef USE_GTHREADS
+	if (filter == NULL)
+		flight = joinFlight(info->url, fields, &first);
+	if (!first) {
+		DBUGOUT("Waiting for the fetch of %s already in progress", info->url);
+		updates = awaitFlight(flight, err);
+		if (updates != NULL && callback != NULL) {
+			g_container_get_iter(&iter, updates);
+			while (g_iterator_hasNext(&iter))
+				callback(g_iterator_next(&iter), userData);
+		}
+		return updates;
 	}
+#endif
+	
+	initRepoFetch(&fetch, info->url, TRUE);
+	luau_parseXML_updatesSetFields(fetch.parser, fields);
+	if (filter != NULL)
+		luau_parseXML_updatesSetFilter(fetch.parser, filter, info);
+	if (callback != NULL)
+		luau_parseXML_updatesSetCallback(fetch.parser, callback, userData);
+	result = curl_easy_perform(fetch.handle);
+	updates = finishRepoParse(&fetch, result, &error);
 	
-	len = strlen(info->url);
-	if (len > 3 && lutil_streq(info->url+len-3, ".gz")) {
-		DBUGOUT("Updates file is compressed: uncompressing");
-		temp = lutil_uncompress(contents, err);
-		g_string_free(contents, TRUE);
-		if (temp == NULL) {
-			g_assert(err == NULL || *err != NULL);
-			return NULL;
+#ifdef USE_GTHREADS
+	if (flight != NULL)
+		landFlight(flight, updates, error);
+#endif
+	
+	if (error != NULL)
+		g_propagate_error(err, error);
+	
+	return updates;
+}
+
+/**
+ * Retrieve the file at \c url.  A copy of the file is kept in the repository cache
+ * (see cache.h); if the file was downloaded before, the server is only asked whether
+ * it has changed since (using the ETag and Last-Modified validators it sent last
+ * time), and the cached copy is returned if it hasn't.
+ *
+ * @arg <i>url</i> is the location of the file to retrieve.
+ * @return the file contents (must be free'd), or NULL on error
+ */
+GString *
+luau_net_getURL(const char *url, GError **err) {
+	ARepoFetch fetch;
+	CURLcode result;
+	
+	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
+	
+	initRepoFetch(&fetch, url, FALSE);
+	result = curl_easy_perform(fetch.handle);
+	
+	return finishRepoFetch(&fetch, result, err);
+}
+
+/**
+ * Query the luau servers of several programs at once.  Up to \c maxConcurrent
+ * repository files are kept in flight at the same time (using libcurl's multi
+ * interface), so one slow server no longer holds up every program after it.
+ * Each repository is parsed as it arrives (as with luau_net_queryServer), and
+ * the results come back in the order given, exactly as a series of
+ * luau_net_queryServer calls would have returned them.  Programs sharing a
+ * repository URL share one fetch and one parse; each gets its own list of the
+ * updates (see \ref luau_shareUpdate).
+ *
+ * @arg <i>infos</i> is an array of AProgInfo pointers describing the programs to check.
+ * @arg <i>fields</i> says which parts of the updates to read in.
+ * @arg <i>maxConcurrent</i> is the maximum number of simultaneous transfers (<= 0 for the default).
+ * @arg <i>errors</i> is an (optional) array which will receive one GError pointer per program
+ *      (NULL if the query for that program succeeded).  The errors must be free'd.
+ * @return an array with one GContainer of updates per program, in the same order as
+ *      \c infos; an entry is NULL if the query for that program failed.
+ */
+GPtrArray *
+luau_net_queryServers(const GPtrArray *infos, AUpdateFields fields, int maxConcurrent, GPtrArray *errors) {
+	ARepoFetch *fetches, *fetch;
+	GPtrArray *results;
+	GHashTable *urls;
+	/* Index of the earlier fetch of the same URL, or -1 */
+	int *sameAs;
+	gpointer first;
+	CURLM *multi;
+	CURLMsg *msg;
+	struct timeval timeout;
+	fd_set readSet, writeSet, excSet;
+	unsigned int i, next;
+	int running, stillRunning, maxfd, left;
+	long wait;
+	
+	g_return_val_if_fail(infos != NULL, NULL);
+	
+	if (maxConcurrent <= 0)
+		maxConcurrent = LUAU_DEFAULT_CONCURRENCY;
+	
+	fetches = g_malloc0(infos->len * sizeof(ARepoFetch));
+	sameAs = g_malloc(infos->len * sizeof(int));
+	urls = g_hash_table_new(g_str_hash, g_str_equal);
+	
+	multi = curl_multi_init();
+	next = 0;
+	running = 0;
+	
+	while (next < infos->len || running > 0) {
+		/* Top up the pool of active transfers */
+		while (running < maxConcurrent && next < infos->len) {
+			fetch = &fetches[next];
+			fetch->url = ((AProgInfo *) g_ptr_array_index(infos, next))->url;
+			sameAs[next] = -1;
+			if (fetch->url == NULL) {
+				g_set_error(&(fetch->error), LUAU_NET_ERROR, LUAU_NET_ERROR_INVALID_ARG, "Can't check for updates: no URL specified");
+			} else if (g_hash_table_lookup_extended(urls, fetch->url, NULL, &first)) {
+				DBUGOUT("%s is shared with an earlier program: fetching it once", fetch->url);
+				sameAs[next] = GPOINTER_TO_INT(first);
+			} else {
+				g_hash_table_insert(urls, (gpointer) fetch->url, GINT_TO_POINTER(next));
+				initRepoFetch(fetch, fetch->url, TRUE);
+				luau_parseXML_updatesSetFields(fetch->parser, fields);
+				curl_multi_add_handle(multi, fetch->handle);
+				++running;
+			}
+			++next;
 		}
-		contents = temp;
+		
+		while (curl_multi_perform(multi, &stillRunning) == CURLM_CALL_MULTI_PERFORM)
+			;
+		
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &fetch);
+			curl_multi_remove_handle(multi, fetch->handle);
+			fetch->updates = finishRepoParse(fetch, msg->data.result, &(fetch->error));
+			--running;
+		}
+		
+		if (running == 0)
+			continue;
+		
+		/* Wait for activity on any of the open transfers */
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		FD_ZERO(&excSet);
+		maxfd = -1;
+		curl_multi_fdset(multi, &readSet, &writeSet, &excSet, &maxfd);
+		
+		wait = -1;
+		curl_multi_timeout(multi, &wait);
+		if (wait < 0 || wait > 1000)
+			wait = 1000;
+		
+		if (maxfd == -1) {
+			/* Nothing to select() on yet (eg. name resolution in progress) */
+			g_usleep(100 * 1000);
+		} else {
+			timeout.tv_sec = wait / 1000;
+			timeout.tv_usec = (wait % 1000) * 1000;
+			select(maxfd+1, &readSet, &writeSet, &excSet, &timeout);
+		}
+	}
+	
+	curl_multi_cleanup(multi);
+	g_hash_table_destroy(urls);
+	
+	/* Categorizing changes the updates' keywords, so every program needs its own list */
+	for (i = 0; i < infos->len; ++i) {
+		if (sameAs[i] < 0)
+			continue;
+		
+		fetch = &fetches[sameAs[i]];
+		if (fetch->updates != NULL)
+			fetches[i].updates = shareUpdates(fetch->updates);
+		else
+			fetches[i].error = g_error_copy(fetch->error);
+	}
+	g_free(sameAs);
+	
+	results = g_ptr_array_new();
+	for (i = 0; i < infos->len; ++i) {
+		fetch = &fetches[i];
+		
+		g_ptr_array_add(results, fetch->updates);
+		if (errors != NULL)
+			g_ptr_array_add(errors, fetch->error);
+		else if (fetch->error != NULL)
+			g_error_free(fetch->error);
+	}
+	
+	g_free(fetches);
+	
+	return results;
+}
+
+/**
+ * Download \c url to \c downloadTo.  The file is first downloaded to
+ * <tt>downloadTo.part</tt>, with a small state file (<tt>downloadTo.part.state</tt>)
+ * recording where it came from.  If the download is interrupted, both are left in
+ * place and the next call for the same package picks up where the last one stopped
+ * (using a Range request, guarded by If-Range so that a changed file is downloaded
+ * from scratch).  Once complete, the file is renamed to \c downloadTo.
+ *
+ * The file's md5 sum is computed as the data arrives, so it is ready as soon as the
+ * transfer finishes without reading the file back from disk (only the part already
+ * there when a download is resumed is read back).  If \c package gives
+ * the size of the file, the download is abandoned (and the partial file discarded)
+ * as soon as the server turns out to be sending more than that.
+ *
+ * @arg <i>url</i> is the location of the file to download.
+ * @arg <i>downloadTo</i> is where the file should end up.
+ * @arg <i>package</i> describes the file being downloaded (used to decide whether a partial
+ *      download belongs to the same file), or NULL.
+ * @arg <i>md5</i> is an (optional) 33 byte buffer which receives the md5 sum of the file.
+ * @return whether the download was successful
+ */
+gboolean
+luau_net_downloadToFile(const char *url, const char *downloadTo, const APackage *package, char *md5, GError **err) {
+	char *partFile, *stateFile;
+	APartialState state;
+	struct stat partInfo;
+	curl_off_t offset = 0;
+	gboolean result, rangeRejected = FALSE;
+	GError *tempErr = NULL;
+	
+	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+	
+	partFile = lutil_vstrcreate(downloadTo, PARTIAL_SUFFIX, NULL);
+	stateFile = lutil_vstrcreate(partFile, STATE_SUFFIX, NULL);
+	
+	if (loadDownloadState(stateFile, url, package, &state) && stat(partFile, &partInfo) == 0) {
+		offset = partInfo.st_size;
+		if (package != NULL && package->size > 0 && offset > (curl_off_t) package->size)
+			offset = 0;
 	}
 	
-	updates = luau_parseXML_updates(contents->str, err);
-	g_string_free(contents, TRUE);
+	/* The md5 sum of what was downloaded before isn't kept: hash it back from disk */
+	if (offset > 0 && !hashFileRange(partFile, 0, offset, &(state.md5Context)))
+		offset = 0;
 	
-	if (updates == NULL) {
+	if (offset == 0) {
+		resetPartialState(&state);
+		unlink(partFile);
+	}
+	
+	if (package != NULL && package->size > 0 && offset == (curl_off_t) package->size) {
+		DBUGOUT("%s already completely downloaded", partFile);
+		result = TRUE;
+	} else {
+		result = downloadPartial(url, partFile, stateFile, offset, package, &state, &rangeRejected, &tempErr);
+		if (result == FALSE && offset > 0 && rangeRejected) {
+			/* The server won't serve the rest of the partial file: start over */
+			DBUGOUT("Couldn't resume download (%s): starting over", tempErr->message);
+			g_error_free(tempErr);
+			tempErr = NULL;
+			resetPartialState(&state);
+			unlink(partFile);
+			result = downloadPartial(url, partFile, stateFile, 0, package, &state, &rangeRejected, &tempErr);
+		}
+	}
+	freeValidators(&(state.validators));
+	
+	if (result == TRUE) {
+		if (md5 != NULL)
+			MD5End(&(state.md5Context), md5);
+		if (rename(partFile, downloadTo) != 0) {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't move downloaded file to %s: %s", downloadTo, strerror(errno));
+			result = FALSE;
+		}
+		unlink(stateFile);
+	} else {
+		g_propagate_error(err, tempErr);
+	}
+	
+	g_free(partFile);
+	g_free(stateFile);
+	
+	return result;
+}
+
+/**
+ * Download a package to \c downloadTo.  In the default (\ref LUAU_DOWNLOAD_SINGLE) mode,
+ * the package's mirrors are tried one after another (in the order given by
+ * \ref luau_getPackageURLs) until one of them delivers the file.  Each mirror gets a
+ * limited time to connect and must keep up a minimum transfer rate, and at most
+ * MAX_DOWNLOAD_ATTEMPTS downloads are attempted in total, so that dead or hopeless
+ * mirrors cost seconds rather than the whole download.  If the package has an md5
+ * sum, a mirror which delivers a file with the wrong sum is treated as failed too.
+ *
+ * In \ref LUAU_DOWNLOAD_SEGMENTED mode the file is split into byte ranges which are
+ * fetched in parallel from all of the package's mirrors; whenever a mirror finishes
+ * its range it takes over half of the largest range still outstanding, so faster
+ * mirrors end up doing most of the work.  Segmented mode falls back to trying the
+ * mirrors one at a time if the package has only one mirror, is small, its size can't
+ * be determined, or the segmented download fails.
+ *
+ * @arg <i>package</i> is the package to download.
+ * @arg <i>downloadTo</i> is where the file should end up.
+ * @arg <i>md5</i> is an (optional) 33 byte buffer which receives the md5 sum of the
+ *      downloaded file.  If no mirror delivered a file with the expected sum, the last
+ *      file downloaded is kept and this is the only way to tell.
+ * @return whether a file was downloaded
+ */
+gboolean
+luau_net_downloadPackage(const APackage *package, const char *downloadTo, char *md5, GError **err) {
+	GPtrArray *urls;
+	GError *tempErr = NULL;
+	curl_off_t size;
+	char computed[33], *url;
+	gboolean result = FALSE, done = FALSE, *badMirror;
+	unsigned int i, attempt, nBad = 0;
+	
+	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+	
+	urls = luau_getPackageURLs(package, err);
+	if (urls == NULL) {
 		g_assert(err == NULL || *err != NULL);
-		return NULL;
+		return FALSE;
 	}
+	computed[0] = '\0';
 	
-	return updates;
+	if (downloadMode == LUAU_DOWNLOAD_SEGMENTED && urls->len >= 2) {
+		size = (package->size > 0) ? (curl_off_t) package->size : getRemoteSize(g_ptr_array_index(urls, 0));
+		if (size >= 2 * MIN_SEGMENT_SIZE) {
+			result = downloadSegmented(urls, size, downloadTo, &tempErr);
+			if (result == TRUE && checkMD5(downloadTo, package, computed)) {
+				done = TRUE;
+			} else if (result == TRUE) {
+				DBUGOUT("Segmented download has the wrong md5 sum: trying mirrors one at a time");
+				unlink(downloadTo);
+			} else {
+				DBUGOUT("Segmented download failed (%s): trying mirrors one at a time", tempErr->message);
+			}
+		} else {
+			DBUGOUT("Package too small (or size unknown): not downloading in segments");
+		}
+	}
+	
+	badMirror = g_malloc0(urls->len * sizeof(gboolean));
+	
+	for (attempt = 0, i = 0; !done && attempt < MAX_DOWNLOAD_ATTEMPTS && nBad < urls->len; ++attempt, i = (i+1) % urls->len) {
+		/* Go round the mirrors (again, if there are only a few), skipping ones that sent bad data */
+		while (badMirror[i])
+			i = (i+1) % urls->len;
+		url = g_ptr_array_index(urls, i);
+		
+		if (tempErr != NULL) {
+			g_error_free(tempErr);
+			tempErr = NULL;
+		}
+		
+		result = luau_net_downloadToFile(url, downloadTo, package, computed, &tempErr);
+		if (result == FALSE) {
+			DBUGOUT("Download from %s failed (%s): trying next mirror", url, tempErr->message);
+			continue;
+		}
+		
+		if (package->md5sum[0] == '\0' || lutil_streq(computed, package->md5sum)) {
+			done = TRUE;
+		} else {
+			DBUGOUT("File from %s has the wrong md5 sum (%s, expected %s): trying next mirror", url, computed, package->md5sum);
+			luau_mirrorstats_record(url, FALSE, 0, 0);
+			badMirror[i] = TRUE;
+			++nBad;
+			
+			/* Keep the last file around: the caller decides what to do with it */
+			if (attempt+1 < MAX_DOWNLOAD_ATTEMPTS && nBad < urls->len)
+				unlink(downloadTo);
+		}
+	}
+	
+	g_free(badMirror);
+	for (i = 0; i < urls->len; ++i)
+		g_free(g_ptr_array_index(urls, i));
+	g_ptr_array_free(urls, TRUE);
+	
+	if (md5 != NULL)
+		strcpy(md5, computed);
+	
+	if (result == FALSE)
+		g_propagate_error(err, tempErr);
+	else if (tempErr != NULL)
+		g_error_free(tempErr);
+	
+	return result;
+}
+
+/**
+ * Choose how packages are downloaded (see \ref luau_net_downloadPackage).
+ *
+ * @arg <i>mode</i> is the download mode to use from now on.
+ */
+void
+luau_net_setDownloadMode(ADownloadMode mode) {
+	downloadMode = mode;
+}
+
+/**
+ * Set the function used to report progress of package downloads (see
+ * \ref luau_registerProgressCallback).
+ *
+ * @arg <i>callback</i> is the progress callback to use, or NULL for none.
+ */
+void
+luau_net_setProgressCallback(AProgressCallback callback) {
+	progressCallback = callback;
 }
 
 /**
@@ -100,8 +668,9 @@ luau_net_queryServer(const AProgInfo *info, GError **err) {
  */
 gboolean
 luau_net_downloadUpdate(const AProgInfo* info, const AUpdate *update, APkgType pkgType, const char* downloadTo, GError **err) {
-	char md5[33], *loc;
+	char md5[33];
 	APackage *package;
+	GPtrArray *mirrors;
 	gboolean loopAgain, result;
 	int choice;
 	
@@ -114,30 +683,24 @@ luau_net_downloadUpdate(const AProgInfo* info, const AUpdate *update, APkgType p
 	if (package == NULL) {
 		g_assert(err == NULL || *err != NULL);
 		return FALSE;
-	} else if (package->mirrors == NULL || package->mirrors->len == 0) {
-		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_INVALID_ARG, "Couldn't find filename of specified type for this update");
-		return FALSE;
 	}
 	
-	loc = luau_getPackageURL(package, err);
-	if (loc == NULL) {
-		g_assert(err == NULL || *err != NULL);
+	mirrors = luau_getPackageMirrors(package);
+	result = (mirrors->len > 0);
+	luau_freePackageMirrors(mirrors);
+	if (result == FALSE) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_INVALID_ARG, "Couldn't find filename of specified type for this update");
 		return FALSE;
 	}
 	
-	result = lutil_ftp_downloadToFile(loc, downloadTo, err);
+	/* Tries every mirror before giving up on an md5 mismatch */
+	result = luau_net_downloadPackage(package, downloadTo, md5, err);
 	if (result == FALSE) {
 		g_assert(err == NULL || *err != NULL);
 		return FALSE;
 	}
 	
 	if (package->md5sum[0] != '\0') {
-		lutil_md5_file(downloadTo, md5, err);
-		if (md5[0] == '\0') {
-			g_assert(err == NULL || *err != NULL);
-			return FALSE;
-		}
-		
 		result = FALSE;
 		if (! lutil_streq(md5, package->md5sum)) {
 			while (1) {
@@ -179,4 +742,1069 @@ luau_net_downloadUpdate(const AProgInfo* info, const AUpdate *update, APkgType p
 	return result;
 }
 
+/* Non-Interface Methods */
+
+/* Set up a transfer of \c url, making it conditional on the cached copy (if any).
+   If \c parse is TRUE, the file is fed to the repository parser as it arrives
+   (see finishRepoParse); otherwise it is collected in \c fetch->contents. */
+static void
+initRepoFetch(ARepoFetch *fetch, const char *url, gboolean parse) {
+	char *header;
+	
+	DBUGOUT("Retrieving url: %s", url);
+	
+	fetch->url = url;
+	fetch->contents = parse ? NULL : g_string_new("");
+	fetch->parser = parse ? luau_parseXML_updatesNew() : NULL;
+	fetch->magicLength = 0;
+	fetch->detected = FALSE;
+	fetch->decoder = NULL;
+	fetch->cacheWriter.url = NULL;
+	fetch->cacheWriter.tempFile = NULL;
+	fetch->cacheWriter.file = NULL;
+	fetch->checkedResponse = FALSE;
+	fetch->notModified = FALSE;
+	fetch->errorBuffer[0] = '\0';
+	fetch->validators.etag = NULL;
+	fetch->validators.lastModified = NULL;
+	fetch->headers = NULL;
+	fetch->error = NULL;
+	fetch->haveCached = parse ? luau_cache_lookup(url, &(fetch->cached)) : luau_cache_load(url, &(fetch->cached));
+	
+	/* Repository files are uncompressed as they're parsed, so the server may
+	   compress them in any format luau can read */
+	if (parse && *luau_codec_getAcceptEncoding() != '\0') {
+		header = lutil_vstrcreate("Accept-Encoding: ", luau_codec_getAcceptEncoding(), NULL);
+		fetch->headers = curl_slist_append(fetch->headers, header);
+		g_free(header);
+	}
+	
+	if (fetch->haveCached) {
+		if (fetch->cached.etag != NULL) {
+			header = lutil_vstrcreate("If-None-Match: ", fetch->cached.etag, NULL);
+			fetch->headers = curl_slist_append(fetch->headers, header);
+			g_free(header);
+		}
+		if (fetch->cached.lastModified != NULL) {
+			header = lutil_vstrcreate("If-Modified-Since: ", fetch->cached.lastModified, NULL);
+			fetch->headers = curl_slist_append(fetch->headers, header);
+			g_free(header);
+		}
+	}
+	
+	fetch->handle = luau_transfer_acquire();
+	curl_easy_setopt(fetch->handle, CURLOPT_URL, url);
+	if (parse) {
+		curl_easy_setopt(fetch->handle, CURLOPT_WRITEFUNCTION, parseCallback);
+		curl_easy_setopt(fetch->handle, CURLOPT_WRITEDATA, (void *)fetch);
+	} else {
+		curl_easy_setopt(fetch->handle, CURLOPT_WRITEFUNCTION, appendCallback);
+		curl_easy_setopt(fetch->handle, CURLOPT_WRITEDATA, (void *)fetch->contents);
+	}
+	curl_easy_setopt(fetch->handle, CURLOPT_HEADERFUNCTION, headerCallback);
+	curl_easy_setopt(fetch->handle, CURLOPT_HEADERDATA, (void *)&(fetch->validators));
+	curl_easy_setopt(fetch->handle, CURLOPT_ERRORBUFFER, fetch->errorBuffer);
+	curl_easy_setopt(fetch->handle, CURLOPT_FAILONERROR, 1);
+	curl_easy_setopt(fetch->handle, CURLOPT_FOLLOWLOCATION, 1);
+	curl_easy_setopt(fetch->handle, CURLOPT_PRIVATE, (char *)fetch);
+	if (fetch->headers != NULL)
+		curl_easy_setopt(fetch->handle, CURLOPT_HTTPHEADER, fetch->headers);
+}
+
+/* Clean up after a transfer and return the file contents: either what was just
+   downloaded (which then replaces the cached copy) or, if the server says the file
+   hasn't changed, the cached copy. */
+static GString *
+finishRepoFetch(ARepoFetch *fetch, CURLcode result, GError **err) {
+	GString *contents = NULL;
+	long responseCode = 0;
+	
+	curl_easy_getinfo(fetch->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+	luau_transfer_release(fetch->handle);
+	curl_slist_free_all(fetch->headers);
+	fetch->handle = NULL;
+	fetch->headers = NULL;
+	
+	if (result != CURLE_OK) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download %s: %s",
+		            fetch->url, (fetch->errorBuffer[0] != '\0') ? fetch->errorBuffer : curl_easy_strerror(result));
+		g_string_free(fetch->contents, TRUE);
+	} else if (responseCode == 304) {
+		g_string_free(fetch->contents, TRUE);
+		if (fetch->haveCached) {
+			DBUGOUT("%s not modified: using cached copy", fetch->url);
+			contents = fetch->cached.contents;
+			fetch->cached.contents = NULL;
+		} else {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download %s: unexpected \"304 Not Modified\" response", fetch->url);
+		}
+	} else {
+		contents = fetch->contents;
+		luau_cache_store(fetch->url, contents, fetch->validators.etag, fetch->validators.lastModified);
+	}
+	
+	fetch->contents = NULL;
+	if (fetch->haveCached)
+		luau_cache_freeEntry(&(fetch->cached));
+	fetch->haveCached = FALSE;
+	freeValidators(&(fetch->validators));
+	
+	return contents;
+}
+
+/* Clean up after a transfer started with initRepoFetch(fetch, url, TRUE) and return
+   the updates in the file: either the one just downloaded (which then replaces the
+   cached copy) or, if the server says the file hasn't changed, the cached copy. */
+static GContainer *
+finishRepoParse(ARepoFetch *fetch, CURLcode result, GError **err) {
+	GContainer *updates = NULL;
+	GError *streamErr = fetch->error;
+	long responseCode = 0;
+	
+	/* \c err may well be &(fetch->error) */
+	fetch->error = NULL;
+	
+	curl_easy_getinfo(fetch->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+	luau_transfer_release(fetch->handle);
+	curl_slist_free_all(fetch->headers);
+	fetch->handle = NULL;
+	fetch->headers = NULL;
+	
+	if (result != CURLE_OK) {
+		/* The transfer was aborted if the file couldn't be uncompressed or parsed */
+		if (streamErr != NULL) {
+			g_propagate_error(err, streamErr);
+			streamErr = NULL;
+		} else {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download %s: %s",
+			            fetch->url, (fetch->errorBuffer[0] != '\0') ? fetch->errorBuffer : curl_easy_strerror(result));
+		}
+	} else if (responseCode == 304) {
+		if (fetch->haveCached) {
+			DBUGOUT("%s not modified: using cached copy", fetch->url);
+			if (feedCachedCopy(fetch, err) && checkRepoComplete(fetch, err)) {
+				updates = luau_parseXML_updatesFinish(fetch->parser, err);
+				fetch->parser = NULL;
+			}
+		} else {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download %s: unexpected \"304 Not Modified\" response", fetch->url);
+		}
+	} else if (checkRepoComplete(fetch, err)) {
+		updates = luau_parseXML_updatesFinish(fetch->parser, err);
+		fetch->parser = NULL;
+		if (updates != NULL)
+			luau_cache_commitStore(&(fetch->cacheWriter), fetch->validators.etag, fetch->validators.lastModified);
+	}
+	
+	if (streamErr != NULL)
+		g_error_free(streamErr);
+	if (fetch->parser != NULL)
+		luau_parseXML_updatesFree(fetch->parser);
+	fetch->parser = NULL;
+	luau_codec_freeDecoder(fetch->decoder);
+	fetch->decoder = NULL;
+	luau_cache_abortStore(&(fetch->cacheWriter));
+	if (fetch->haveCached)
+		luau_cache_freeEntry(&(fetch->cached));
+	fetch->haveCached = FALSE;
+	freeValidators(&(fetch->validators));
+	
+	g_assert(updates != NULL || err == NULL || *err != NULL);
+	
+	return updates;
+}
+
+/* Make a list of updates sharing the contents of \c updates (see luau_shareUpdate),
+   for another program to categorize */
+static GContainer *
+shareUpdates(const GContainer *updates) {
+	GContainer *copy;
+	GIterator iter;
+	AUpdate *update;
+	
+	copy = g_container_new(GCONT_LIST);
+	
+	g_container_get_iter(&iter, updates);
+	while (g_iterator_hasNext(&iter)) {
+		update = g_malloc(sizeof(AUpdate));
+		luau_shareUpdate(update, g_iterator_next(&iter));
+		g_container_add(copy, update);
+	}
+	
+	return copy;
+}
+
+#ifdef USE_GTHREADS
+/* Find the fetch of \c url (reading in \c fields) in progress, or register a new one.
+   \c first is set to TRUE if the caller is to do the fetch (and then call landFlight),
+   or FALSE if it should wait for the result with awaitFlight. */
+static AFlight *
+joinFlight(const char *url, AUpdateFields fields, gboolean *first) {
+	AFlight *flight;
+	char *key;
+	
+	/* A summary is no good to a thread that wants the updates in full (or vice versa) */
+	key = g_strdup_printf("%d %s", (int) fields, url);
+	
+	G_LOCK(flights);
+	if (flights == NULL) {
+		flights = g_hash_table_new(g_str_hash, g_str_equal);
+		flightLanded = g_cond_new();
+	}
+	
+	flight = g_hash_table_lookup(flights, key);
+	if (flight != NULL) {
+		++(flight->waiters);
+		*first = FALSE;
+		g_free(key);
+	} else {
+		flight = g_malloc0(sizeof(AFlight));
+		flight->key = key;
+		g_hash_table_insert(flights, flight->key, flight);
+		*first = TRUE;
+	}
+	G_UNLOCK(flights);
+	
+	return flight;
+}
+
+/* Wait for another thread's fetch to finish and return its result (as a list of the caller's own) */
+static GContainer *
+awaitFlight(AFlight *flight, GError **err) {
+	GContainer *updates = NULL;
+	gboolean last;
+	
+	G_LOCK(flights);
+	while (!flight->done)
+		g_cond_wait(flightLanded, g_static_mutex_get_mutex(&G_LOCK_NAME(flights)));
+	G_UNLOCK(flights);
+	
+	/* The result doesn't change any more, so it can be shared without the lock */
+	if (flight->updates != NULL)
+		updates = shareUpdates(flight->updates);
+	else
+		g_propagate_error(err, g_error_copy(flight->error));
+	
+	G_LOCK(flights);
+	last = (--(flight->waiters) == 0);
+	G_UNLOCK(flights);
+	
+	if (last)
+		freeFlight(flight);
+	
+	return updates;
+}
+
+/* Hand the result of a fetch to the threads waiting for it.  The caller keeps
+   \c updates and \c error. */
+static void
+landFlight(AFlight *flight, const GContainer *updates, const GError *error) {
+	gboolean waited;
+	
+	/* Nobody can start waiting once the fetch is out of the table */
+	G_LOCK(flights);
+	g_hash_table_remove(flights, flight->key);
+	waited = (flight->waiters > 0);
+	G_UNLOCK(flights);
+	
+	if (!waited) {
+		freeFlight(flight);
+		return;
+	}
+	
+	if (updates != NULL)
+		flight->updates = shareUpdates(updates);
+	else
+		flight->error = g_error_copy(error);
+	
+	G_LOCK(flights);
+	flight->done = TRUE;
+	g_cond_broadcast(flightLanded);
+	G_UNLOCK(flights);
+}
+
+static void
+freeFlight(AFlight *flight) {
+	if (flight->updates != NULL)
+		luau_freeUpdateList(g_container_free(flight->updates, FALSE));
+	if (flight->error != NULL)
+		g_error_free(flight->error);
+	g_free(flight->key);
+	g_free(flight);
+}
+#endif /* USE_GTHREADS */
+
+/* Pass the next piece of a repository file to its parser, uncompressing it first
+   if necessary.  The format is recognized by the first few bytes of the file (so
+   it doesn't matter whether the compression came from the file itself or from
+   the server's Content-Encoding). */
+static gboolean
+feedRepoData(ARepoFetch *fetch, const char *data, size_t len, GError **err) {
+	const ACodec *codec;
+	size_t used;
+	
+	if (!fetch->detected) {
+		used = MIN(len, CODEC_MAGIC_LENGTH - fetch->magicLength);
+		memcpy(fetch->magic + fetch->magicLength, data, used);
+		fetch->magicLength += used;
+		data += used;
+		len -= used;
+		
+		if (fetch->magicLength < CODEC_MAGIC_LENGTH)
+			return TRUE;
+		
+		fetch->detected = TRUE;
+		codec = luau_codec_detect(fetch->magic, fetch->magicLength);
+		if (codec != NULL) {
+			DBUGOUT("Updates file is %s compressed: uncompressing", luau_codec_getName(codec));
+			fetch->decoder = luau_codec_newDecoder(codec, err);
+			if (fetch->decoder == NULL)
+				return FALSE;
+		}
+		
+		if (!feedRepoData(fetch, fetch->magic, fetch->magicLength, err))
+			return FALSE;
+	}
+	
+	if (fetch->decoder == NULL)
+		return feedParser(data, len, fetch, err);
+	else
+		return luau_codec_decode(fetch->decoder, data, len, feedParser, fetch, err);
+}
+
+/* Pass a piece of (uncompressed) repository file to the parser and the cached copy */
+static gboolean
+feedParser(const char *data, gsize len, gpointer userData, GError **err) {
+	ARepoFetch *fetch = (ARepoFetch *) userData;
+	
+	luau_cache_write(&(fetch->cacheWriter), data, len);
+	
+	return luau_parseXML_updatesFeed(fetch->parser, data, (int) len, err);
+}
+
+/* Feed the cached copy of a repository file to its parser */
+static gboolean
+feedCachedCopy(ARepoFetch *fetch, GError **err) {
+	char buffer[CODEC_WINDOW];
+	gboolean result = TRUE;
+	size_t len;
+	FILE *file;
+	
+	file = luau_cache_openBody(fetch->url);
+	if (file == NULL) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't read cached copy of %s: %s", fetch->url, strerror(errno));
+		return FALSE;
+	}
+	
+	while (result == TRUE && (len = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		result = feedRepoData(fetch, buffer, len, err);
+	
+	fclose(file);
+	
+	return result;
+}
+
+/* Check that a compressed repository file wasn't cut short (and pass on the
+   start of a file too short to have been checked for compression) */
+static gboolean
+checkRepoComplete(ARepoFetch *fetch, GError **err) {
+	if (!fetch->detected) {
+		fetch->detected = TRUE;
+		if (fetch->magicLength > 0 && !feedParser(fetch->magic, fetch->magicLength, fetch, err))
+			return FALSE;
+	}
+	
+	if (fetch->decoder != NULL && !luau_codec_isFinished(fetch->decoder)) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't uncompress %s: unexpected end of file", fetch->url);
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static size_t
+appendCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	size_t actualSize = size * nmemb;
+	
+	g_string_append_len((GString *)data, ptr, actualSize);
+	
+	return actualSize;
+}
+
+/* Write callback for repository files which are parsed as they arrive */
+static size_t
+parseCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	ARepoFetch *fetch = (ARepoFetch *) data;
+	size_t actualSize = size * nmemb;
+	long responseCode = 0;
+	
+	if (!fetch->checkedResponse) {
+		fetch->checkedResponse = TRUE;
+		
+		/* Any body of a "304 Not Modified" response isn't the file */
+		curl_easy_getinfo(fetch->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+		fetch->notModified = (responseCode == 304);
+		
+		if (!fetch->notModified && (fetch->validators.etag != NULL || fetch->validators.lastModified != NULL))
+			luau_cache_beginStore(&(fetch->cacheWriter), fetch->url);
+	}
+	
+	if (fetch->notModified)
+		return actualSize;
+	
+	if (!feedRepoData(fetch, ptr, actualSize, &(fetch->error)))
+		return 0;
+	
+	return actualSize;
+}
+
+/* Pick the cache validators out of the response headers */
+static size_t
+headerCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	AValidators *validators = (AValidators *) data;
+	size_t actualSize = size * nmemb;
+	char *header, **value;
+	
+	header = g_strndup(ptr, actualSize);
+	g_strchomp(header);
+	
+	if (g_ascii_strncasecmp(header, "HTTP/", 5) == 0) {
+		/* New response (eg. after a redirect): forget the previous one's headers */
+		freeValidators(validators);
+		g_free(header);
+		return actualSize;
+	} else if (g_ascii_strncasecmp(header, "ETag:", 5) == 0) {
+		value = &(validators->etag);
+		memmove(header, header+5, strlen(header+5)+1);
+	} else if (g_ascii_strncasecmp(header, "Last-Modified:", 14) == 0) {
+		value = &(validators->lastModified);
+		memmove(header, header+14, strlen(header+14)+1);
+	} else {
+		g_free(header);
+		return actualSize;
+	}
+	
+	g_strchug(header);
+	g_free(*value);
+	*value = header;
+	
+	return actualSize;
+}
+
+static void
+freeValidators(AValidators *validators) {
+	g_free(validators->etag);
+	g_free(validators->lastModified);
+	validators->etag = NULL;
+	validators->lastModified = NULL;
+}
 
+/* Download \c url to \c partFile, appending to the first \c offset bytes already there */
+static gboolean
+downloadPartial(const char *url, const char *partFile, const char *stateFile, curl_off_t offset,
+                const APackage *package, APartialState *state, gboolean *rangeRejected, GError **err) {
+	AValidators *validators = &(state->validators);
+	ADownload download;
+	struct curl_slist *headers = NULL;
+	char errorBuffer[CURL_ERROR_SIZE], *range, *header;
+	CURLcode ret;
+	
+	download.file = fopen(partFile, (offset > 0) ? "ab" : "wb");
+	if (download.file == NULL) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download file to specified location %s: %s", partFile, strerror(errno));
+		return FALSE;
+	}
+	
+	/* Record where the partial file came from before any data is written */
+	saveDownloadState(stateFile, url, package, state);
+	
+	DBUGOUT("Retrieving url %s to %s (starting at byte %ld)", url, partFile, (long) offset);
+	
+	download.handle = luau_transfer_acquire();
+	download.offset = offset;
+	download.written = offset;
+	download.expectedSize = (package != NULL) ? (curl_off_t) package->size : 0;
+	download.tooLarge = FALSE;
+	download.checkedResponse = FALSE;
+	download.md5Context = state->md5Context;
+	download.validators.etag = NULL;
+	download.validators.lastModified = NULL;
+	errorBuffer[0] = '\0';
+	
+	curl_easy_setopt(download.handle, CURLOPT_URL, url);
+	curl_easy_setopt(download.handle, CURLOPT_WRITEFUNCTION, downloadWriteCallback);
+	curl_easy_setopt(download.handle, CURLOPT_WRITEDATA, (void *)&download);
+	curl_easy_setopt(download.handle, CURLOPT_HEADERFUNCTION, headerCallback);
+	curl_easy_setopt(download.handle, CURLOPT_HEADERDATA, (void *)&(download.validators));
+	curl_easy_setopt(download.handle, CURLOPT_ERRORBUFFER, errorBuffer);
+	curl_easy_setopt(download.handle, CURLOPT_FAILONERROR, 1);
+	curl_easy_setopt(download.handle, CURLOPT_FOLLOWLOCATION, 1);
+	setMirrorTimeouts(download.handle);
+	if (progressCallback != NULL) {
+		curl_easy_setopt(download.handle, CURLOPT_NOPROGRESS, FALSE);
+		curl_easy_setopt(download.handle, CURLOPT_PROGRESSFUNCTION, downloadProgressCallback);
+		curl_easy_setopt(download.handle, CURLOPT_PROGRESSDATA, (void *)&download);
+	}
+	
+	if (offset > 0) {
+		range = lutil_mprintf("%ld-", (long) offset);
+		curl_easy_setopt(download.handle, CURLOPT_RANGE, range);
+		
+		/* Only resume if the file hasn't changed since; otherwise the server sends all of it */
+		if (validators->etag != NULL || validators->lastModified != NULL) {
+			header = lutil_vstrcreate("If-Range: ", (validators->etag != NULL) ? validators->etag : validators->lastModified, NULL);
+			headers = curl_slist_append(headers, header);
+			curl_easy_setopt(download.handle, CURLOPT_HTTPHEADER, headers);
+			g_free(header);
+		}
+	} else {
+		range = NULL;
+	}
+	
+	ret = curl_easy_perform(download.handle);
+	recordMirrorStats(download.handle, url, ret == CURLE_OK);
+	
+	luau_transfer_release(download.handle);
+	curl_slist_free_all(headers);
+	g_free(range);
+	
+	state->md5Context = download.md5Context;
+	
+	if (fclose(download.file) != 0 && ret == CURLE_OK) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't write to %s: %s", partFile, strerror(errno));
+		freeValidators(&(download.validators));
+		return FALSE;
+	}
+	
+	/* Remember the validators for the data we actually have on disk */
+	if (download.validators.etag != NULL || download.validators.lastModified != NULL) {
+		freeValidators(validators);
+		*validators = download.validators;
+	}
+	
+	if (download.tooLarge) {
+		/* Whatever this server is sending, it isn't the package: don't resume from it */
+		*rangeRejected = FALSE;
+		unlink(partFile);
+		unlink(stateFile);
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download URL %s: file is larger than the expected %ld bytes",
+		            url, (long) download.expectedSize);
+		return FALSE;
+	} else if (ret != CURLE_OK) {
+		/* eg. "416 Requested Range Not Satisfiable" or an FTP server without REST */
+		*rangeRejected = (ret == CURLE_HTTP_RETURNED_ERROR || ret == CURLE_RANGE_ERROR || ret == CURLE_BAD_DOWNLOAD_RESUME ||
+		                  ret == CURLE_FTP_COULDNT_USE_REST);
+		saveDownloadState(stateFile, url, package, state);
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download URL %s: %s", url,
+		            (errorBuffer[0] != '\0') ? errorBuffer : curl_easy_strerror(ret));
+		return FALSE;
+	}
+	
+	return TRUE;
+}
+
+/* Load the state of a previous, interrupted download.  Returns whether the partial
+   file is a piece of the same package (and so can be resumed). */
+static gboolean
+loadDownloadState(const char *stateFile, const char *url, const APackage *package, APartialState *state) {
+	char *data, **lines, *savedURL = NULL, *savedMD5 = NULL;
+	gboolean matches;
+	int i;
+	
+	state->validators.etag = NULL;
+	state->validators.lastModified = NULL;
+	resetPartialState(state);
+	
+	if (!g_file_get_contents(stateFile, &data, NULL, NULL))
+		return FALSE;
+	
+	lines = g_strsplit(data, "\n", 0);
+	g_free(data);
+	
+	for (i = 0; lines[i] != NULL; ++i) {
+		if (strncmp(lines[i], "url: ", 5) == 0)
+			savedURL = lines[i]+5;
+		else if (strncmp(lines[i], "md5: ", 5) == 0)
+			savedMD5 = lines[i]+5;
+		else if (strncmp(lines[i], "etag: ", 6) == 0)
+			state->validators.etag = g_strdup(lines[i]+6);
+		else if (strncmp(lines[i], "last-modified: ", 15) == 0)
+			state->validators.lastModified = g_strdup(lines[i]+15);
+	}
+	
+	/* Mirrors carry identical files, so a known MD5 sum identifies the package
+	   regardless of where it was downloaded from */
+	if (package != NULL && package->md5sum[0] != '\0')
+		matches = (savedMD5 != NULL && lutil_streq(savedMD5, package->md5sum));
+	else
+		matches = (savedURL != NULL && lutil_streq(savedURL, url));
+	
+	/* The validators only mean something to the server they came from */
+	if (!matches || savedURL == NULL || !lutil_streq(savedURL, url))
+		freeValidators(&(state->validators));
+	
+	g_strfreev(lines);
+	
+	return matches;
+}
+
+static void
+saveDownloadState(const char *stateFile, const char *url, const APackage *package, const APartialState *state) {
+	FILE *file;
+	
+	file = fopen(stateFile, "w");
+	if (file == NULL) {
+		DBUGOUT("Couldn't write download state to %s: %s", stateFile, strerror(errno));
+		return;
+	}
+	
+	fprintf(file, "url: %s\n", url);
+	if (package != NULL && package->md5sum[0] != '\0')
+		fprintf(file, "md5: %s\n", package->md5sum);
+	if (package != NULL && package->size > 0)
+		fprintf(file, "size: %u\n", package->size);
+	if (state->validators.etag != NULL)
+		fprintf(file, "etag: %s\n", state->validators.etag);
+	if (state->validators.lastModified != NULL)
+		fprintf(file, "last-modified: %s\n", state->validators.lastModified);
+	
+	fclose(file);
+}
+
+/* Forget everything about a partial download (so it starts from an empty file) */
+static void
+resetPartialState(APartialState *state) {
+	freeValidators(&(state->validators));
+	MD5Init(&(state->md5Context));
+}
+
+/* Add bytes \c start to \c end of a file to an md5 sum */
+static gboolean
+hashFileRange(const char *filename, curl_off_t start, curl_off_t end, MD5_CTX *context) {
+	unsigned char buffer[64 * 1024];
+	size_t bytesRead;
+	FILE *file;
+	
+	file = fopen(filename, "rb");
+	if (file == NULL || fseeko(file, (off_t) start, SEEK_SET) != 0) {
+		DBUGOUT("Couldn't read %s to compute its md5 sum: %s", filename, strerror(errno));
+		if (file != NULL)
+			fclose(file);
+		return FALSE;
+	}
+	
+	while (start < end) {
+		bytesRead = fread(buffer, 1, (size_t) MIN((curl_off_t) sizeof(buffer), end - start), file);
+		if (bytesRead == 0)
+			break;
+		MD5Update(context, buffer, (unsigned) bytesRead);
+		start += bytesRead;
+	}
+	
+	fclose(file);
+	
+	return (start == end);
+}
+
+static size_t
+downloadWriteCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	ADownload *download = (ADownload *) data;
+	long responseCode = 0;
+	curl_off_t length;
+	size_t written;
+	
+	if (!download->checkedResponse) {
+		download->checkedResponse = TRUE;
+		
+		curl_easy_getinfo(download->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+		if (download->offset > 0 && responseCode == 200) {
+			/* Server sent the whole file (range not supported, or file changed) */
+			DBUGOUT("Server ignored range request: restarting download from the beginning");
+			if (fflush(download->file) != 0 || ftruncate(fileno(download->file), 0) != 0)
+				return 0;
+			rewind(download->file);
+			download->offset = 0;
+			download->written = 0;
+			MD5Init(&(download->md5Context));
+		}
+		
+		/* Don't even start on a file which is announced as too big */
+		length = getContentLength(download->handle);
+		if (download->expectedSize > 0 && length > 0 && download->offset + length > download->expectedSize) {
+			download->tooLarge = TRUE;
+			return 0;
+		}
+	}
+	
+	if (download->expectedSize > 0 && download->written + (curl_off_t) (size * nmemb) > download->expectedSize) {
+		download->tooLarge = TRUE;
+		return 0;
+	}
+	
+	written = fwrite(ptr, size, nmemb, download->file) * size;
+	MD5Update(&(download->md5Context), ptr, (unsigned) written);
+	download->written += written;
+	
+	return written;
+}
+
+/* Report progress for the whole file, not just the part being downloaded now */
+static int
+downloadProgressCallback(void *clientp, double dltotal, double dlnow, double ultotal, double ulnow) {
+	ADownload *download = (ADownload *) clientp;
+	double offset = (double) download->offset;
+	
+	if (dltotal > 0)
+		dltotal += offset;
+	
+	return progressCallback(NULL, dltotal, dlnow + offset, ultotal, ulnow);
+}
+
+/* Don't let a dead or crawling mirror hold up a download for long */
+static void
+setMirrorTimeouts(CURL *handle) {
+	curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, MIRROR_CONNECT_TIMEOUT);
+	curl_easy_setopt(handle, CURLOPT_LOW_SPEED_LIMIT, MIRROR_LOW_SPEED_LIMIT);
+	curl_easy_setopt(handle, CURLOPT_LOW_SPEED_TIME, MIRROR_LOW_SPEED_TIME);
+}
+
+/* Check a downloaded file against the package's md5 sum (if it has one), storing
+   the computed sum in \c md5 */
+static gboolean
+checkMD5(const char *filename, const APackage *package, char *md5) {
+	md5[0] = '\0';
+	
+	if (package == NULL || package->md5sum[0] == '\0')
+		return TRUE;
+	
+	if (lutil_md5_file(filename, md5, NULL) == NULL) {
+		md5[0] = '\0';
+		return FALSE;
+	}
+	
+	return lutil_streq(md5, package->md5sum);
+}
+
+/* Feed the outcome of a finished transfer into the mirror statistics */
+static void
+recordMirrorStats(CURL *handle, const char *url, gboolean success) {
+	double speed = 0, ttfb = 0;
+	
+	curl_easy_getinfo(handle, CURLINFO_SPEED_DOWNLOAD, &speed);
+	curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME, &ttfb);
+	
+	luau_mirrorstats_record(url, success, speed, ttfb);
+}
+
+/* Ask the server how big the file at \c url is; returns -1 if it won't say */
+static curl_off_t
+getRemoteSize(const char *url) {
+	CURL *handle;
+	curl_off_t size = -1;
+	
+	handle = luau_transfer_acquire();
+	curl_easy_setopt(handle, CURLOPT_URL, url);
+	curl_easy_setopt(handle, CURLOPT_NOBODY, 1);
+	curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1);
+	curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1);
+	setMirrorTimeouts(handle);
+	
+	if (curl_easy_perform(handle) == CURLE_OK)
+		size = getContentLength(handle);
+	
+	luau_transfer_release(handle);
+	
+	return size;
+}
+
+/* The size of the file being transferred, as announced by the server; returns -1 if it didn't say */
+static curl_off_t
+getContentLength(CURL *handle) {
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t length = -1;
+	
+	if (curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) != CURLE_OK)
+		return -1;
+	
+	return length;
+#else
+	/* Older versions only give the length as a double (which is -1 if unknown too) */
+	double length = -1;
+	
+	if (curl_easy_getinfo(handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length) != CURLE_OK)
+		return -1;
+	
+	return (curl_off_t) length;
+#endif
+}
+
+static gboolean
+downloadSegmented(const GPtrArray *urls, curl_off_t size, const char *downloadTo, GError **err) {
+	GPtrArray *segments;
+	ASegment *segment;
+	gboolean *busy, *failed, result;
+	char *partFile, *stateFile, *lastError = NULL;
+	CURLM *multi;
+	CURLMsg *msg;
+	struct timeval timeout;
+	fd_set readSet, writeSet, excSet;
+	curl_off_t remaining;
+	unsigned int i, j, nSegments;
+	int fd, running, stillRunning, maxfd, left;
+	long wait;
+	
+	partFile = lutil_vstrcreate(downloadTo, PARTIAL_SUFFIX, NULL);
+	
+	/* Segmented downloads aren't resumable: make sure nothing tries to */
+	stateFile = lutil_vstrcreate(partFile, STATE_SUFFIX, NULL);
+	unlink(stateFile);
+	g_free(stateFile);
+	
+	fd = open(partFile, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0 || ftruncate(fd, size) != 0) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download file to specified location %s: %s", partFile, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		g_free(partFile);
+		return FALSE;
+	}
+	
+	/* Start off with one equal segment per mirror */
+	nSegments = MIN(urls->len, size / MIN_SEGMENT_SIZE);
+	segments = g_ptr_array_new();
+	for (i = 0; i < nSegments; ++i) {
+		segment = g_malloc0(sizeof(ASegment));
+		segment->fd = fd;
+		segment->mirror = -1;
+		segment->pos = size * i / nSegments;
+		segment->end = size * (i+1) / nSegments;
+		g_ptr_array_add(segments, segment);
+	}
+	
+	DBUGOUT("Downloading %s in %d segments from %d mirrors", downloadTo, nSegments, urls->len);
+	
+	busy = g_malloc0(urls->len * sizeof(gboolean));
+	failed = g_malloc0(urls->len * sizeof(gboolean));
+	multi = curl_multi_init();
+	running = 0;
+	result = TRUE;
+	
+	while (result == TRUE) {
+		/* Put every idle mirror to work: on an unassigned segment if there is one,
+		   otherwise on half of the largest segment still in progress */
+		for (i = 0; i < urls->len; ++i) {
+			if (busy[i] || failed[i])
+				continue;
+			
+			segment = NULL;
+			for (j = 0; j < segments->len; ++j) {
+				segment = g_ptr_array_index(segments, j);
+				if (segment->handle == NULL && segment->pos < segment->end)
+					break;
+				segment = NULL;
+			}
+			if (segment == NULL && (segment = splitSegment(segments)) != NULL)
+				g_ptr_array_add(segments, segment);
+			if (segment == NULL)
+				break;
+			
+			segment->mirror = i;
+			startSegment(multi, segment, g_ptr_array_index(urls, i));
+			busy[i] = TRUE;
+			++running;
+		}
+		
+		if (running == 0)
+			break;
+		
+		while (curl_multi_perform(multi, &stillRunning) == CURLM_CALL_MULTI_PERFORM)
+			;
+		
+		while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+			if (msg->msg != CURLMSG_DONE)
+				continue;
+			
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &segment);
+			curl_multi_remove_handle(multi, segment->handle);
+			recordMirrorStats(segment->handle, g_ptr_array_index(urls, segment->mirror), segment->pos >= segment->end);
+			luau_transfer_release(segment->handle);
+			segment->handle = NULL;
+			busy[segment->mirror] = FALSE;
+			--running;
+			
+			/* A transfer cut short because its range shrank is a success too */
+			if (segment->pos < segment->end) {
+				DBUGOUT("Mirror %s failed: %s", (char*) g_ptr_array_index(urls, segment->mirror), segment->errorBuffer);
+				failed[segment->mirror] = TRUE;
+				g_free(lastError);
+				lastError = lutil_mprintf("%s: %s", (char*) g_ptr_array_index(urls, segment->mirror),
+				                          (segment->errorBuffer[0] != '\0') ? segment->errorBuffer : curl_easy_strerror(msg->data.result));
+			}
+		}
+		
+		if (progressCallback != NULL) {
+			remaining = 0;
+			for (j = 0; j < segments->len; ++j) {
+				segment = g_ptr_array_index(segments, j);
+				remaining += segment->end - segment->pos;
+			}
+			if (progressCallback(NULL, (double) size, (double) (size - remaining), 0, 0) != 0) {
+				g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_ABORTED, "Download of %s aborted", downloadTo);
+				result = FALSE;
+				break;
+			}
+		}
+		
+		if (running == 0)
+			continue;
+		
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		FD_ZERO(&excSet);
+		maxfd = -1;
+		curl_multi_fdset(multi, &readSet, &writeSet, &excSet, &maxfd);
+		
+		wait = -1;
+		curl_multi_timeout(multi, &wait);
+		if (wait < 0 || wait > 1000)
+			wait = 1000;
+		
+		if (maxfd == -1) {
+			g_usleep(100 * 1000);
+		} else {
+			timeout.tv_sec = wait / 1000;
+			timeout.tv_usec = (wait % 1000) * 1000;
+			select(maxfd+1, &readSet, &writeSet, &excSet, &timeout);
+		}
+	}
+	
+	for (i = 0; i < segments->len; ++i) {
+		segment = g_ptr_array_index(segments, i);
+		if (segment->handle != NULL) {
+			curl_multi_remove_handle(multi, segment->handle);
+			luau_transfer_release(segment->handle);
+		}
+		if (segment->pos < segment->end && result == TRUE) {
+			g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't download %s from any mirror (%s)",
+			            downloadTo, (lastError != NULL) ? lastError : "unknown error");
+			result = FALSE;
+		}
+		g_free(segment);
+	}
+	g_ptr_array_free(segments, TRUE);
+	curl_multi_cleanup(multi);
+	g_free(busy);
+	g_free(failed);
+	g_free(lastError);
+	
+	if (close(fd) != 0 && result == TRUE) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't write to %s: %s", partFile, strerror(errno));
+		result = FALSE;
+	}
+	
+	if (result == TRUE && rename(partFile, downloadTo) != 0) {
+		g_set_error(err, LUAU_NET_ERROR, LUAU_NET_ERROR_FAILED, "Couldn't move downloaded file to %s: %s", downloadTo, strerror(errno));
+		result = FALSE;
+	}
+	if (result == FALSE)
+		unlink(partFile);
+	
+	g_free(partFile);
+	
+	return result;
+}
+
+static void
+startSegment(CURLM *multi, ASegment *segment, const char *url) {
+	char *range;
+	
+	DBUGOUT("Retrieving bytes %ld-%ld of %s", (long) segment->pos, (long) segment->end - 1, url);
+	
+	segment->requestStart = segment->pos;
+	segment->checkedResponse = FALSE;
+	segment->errorBuffer[0] = '\0';
+	
+	/* Request the range as it is now: if it is split later, the write callback stops early */
+	range = lutil_mprintf("%ld-%ld", (long) segment->pos, (long) segment->end - 1);
+	
+	segment->handle = luau_transfer_acquire();
+	curl_easy_setopt(segment->handle, CURLOPT_URL, url);
+	curl_easy_setopt(segment->handle, CURLOPT_RANGE, range);
+	curl_easy_setopt(segment->handle, CURLOPT_WRITEFUNCTION, segmentWriteCallback);
+	curl_easy_setopt(segment->handle, CURLOPT_WRITEDATA, (void *)segment);
+	curl_easy_setopt(segment->handle, CURLOPT_ERRORBUFFER, segment->errorBuffer);
+	curl_easy_setopt(segment->handle, CURLOPT_FAILONERROR, 1);
+	curl_easy_setopt(segment->handle, CURLOPT_FOLLOWLOCATION, 1);
+	setMirrorTimeouts(segment->handle);
+	curl_easy_setopt(segment->handle, CURLOPT_PRIVATE, (char *)segment);
+	
+	curl_multi_add_handle(multi, segment->handle);
+	
+	g_free(range);
+}
+
+/* Hand the second half of the largest outstanding segment over to a new segment
+   (or return NULL if there's nothing worth splitting) */
+static ASegment *
+splitSegment(GPtrArray *segments) {
+	ASegment *largest = NULL, *segment;
+	curl_off_t remaining;
+	unsigned int i;
+	
+	for (i = 0; i < segments->len; ++i) {
+		segment = g_ptr_array_index(segments, i);
+		if (segment->handle != NULL && (largest == NULL || segment->end - segment->pos > largest->end - largest->pos))
+			largest = segment;
+	}
+	
+	if (largest == NULL)
+		return NULL;
+	
+	remaining = largest->end - largest->pos;
+	if (remaining < 2 * MIN_SEGMENT_SIZE)
+		return NULL;
+	
+	segment = g_malloc0(sizeof(ASegment));
+	segment->fd = largest->fd;
+	segment->mirror = -1;
+	segment->pos = largest->pos + remaining / 2;
+	segment->end = largest->end;
+	largest->end = segment->pos;
+	
+	return segment;
+}
+
+static size_t
+segmentWriteCallback(void *ptr, size_t size, size_t nmemb, void *data) {
+	ASegment *segment = (ASegment *) data;
+	size_t actualSize = size * nmemb, toWrite, done;
+	long responseCode = 0;
+	ssize_t written;
+	
+	if (!segment->checkedResponse) {
+		segment->checkedResponse = TRUE;
+		
+		curl_easy_getinfo(segment->handle, CURLINFO_RESPONSE_CODE, &responseCode);
+		if (segment->requestStart > 0 && responseCode == 200) {
+			g_strlcpy(segment->errorBuffer, "server doesn't support byte ranges", CURL_ERROR_SIZE);
+			return 0;
+		}
+	}
+	
+	toWrite = MIN(actualSize, (size_t) (segment->end - segment->pos));
+	for (done = 0; done < toWrite; done += written) {
+		written = pwrite(segment->fd, (char *) ptr + done, toWrite - done, segment->pos);
+		if (written < 0) {
+			if (errno == EINTR) {
+				written = 0;
+				continue;
+			}
+			g_strlcpy(segment->errorBuffer, strerror(errno), CURL_ERROR_SIZE);
+			return 0;
+		}
+		segment->pos += written;
+	}
+	
+	/* Once the (possibly shrunk) range is complete, abort the rest of the transfer */
+	return (toWrite == actualSize) ? actualSize : 0;
+}
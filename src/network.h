@@ -35,7 +35,19 @@
 #include "gcontainer.h"
 
 /// Query a luau server for a list of updates
-GContainer* luau_net_queryServer(const AProgInfo *info, GError **err);
+GContainer* luau_net_queryServer(const AProgInfo *info, AUpdateFields fields, const AUpdateFilter *filter, ACallbackWithData callback, void *userData, GError **err);
+/// Retrieve the file at \c url, revalidating a cached copy if there is one
+GString* luau_net_getURL(const char *url, GError **err);
+/// Query the luau servers of several programs concurrently
+GPtrArray* luau_net_queryServers(const GPtrArray *infos, AUpdateFields fields, int maxConcurrent, GPtrArray *errors);
+/// Download \c url to \c downloadTo, resuming an earlier partial download if possible
+gboolean luau_net_downloadToFile(const char *url, const char *downloadTo, const APackage *package, char *md5, GError **err);
+/// Download a package, using the current download mode
+gboolean luau_net_downloadPackage(const APackage *package, const char *downloadTo, char *md5, GError **err);
+/// Choose how packages are downloaded
+void luau_net_setDownloadMode(ADownloadMode mode);
+/// Set the function used to report download progress
+void luau_net_setProgressCallback(AProgressCallback callback);
 /// Download the specified update to downloadTo
 gboolean luau_net_downloadUpdate(const AProgInfo *info, const AUpdate *update, APkgType pkgType, const char* downloadTo, GError **err);
 
@@ -33,7 +33,22 @@
 
 #include <glib.h>
 
+/// Key to look up a name (of length \c len, starting with \c first) in a fixed vocabulary with
+/// a switch.  Each vocabulary is laid out so no two of its names share a key, which the
+/// compiler checks (as duplicate case labels), so a lookup comes down to one jump and one compare.
+#define LUAU_TAG_KEY(len, first) ((int) ((len) << 8) | (unsigned char) (first))
+
+/// Incremental parser for repository files (see luau_parseXML_updatesNew)
+typedef struct _AUpdatesParser AUpdatesParser;
+
 GContainer* luau_parseXML_updates(char *contents, GError **err);
+AUpdatesParser* luau_parseXML_updatesNew(void);
+void luau_parseXML_updatesSetCallback(AUpdatesParser *parser, ACallbackWithData callback, void *userData);
+void luau_parseXML_updatesSetFields(AUpdatesParser *parser, AUpdateFields fields);
+void luau_parseXML_updatesSetFilter(AUpdatesParser *parser, const AUpdateFilter *filter, const AProgInfo *installed);
+gboolean luau_parseXML_updatesFeed(AUpdatesParser *parser, const char *data, int len, GError **err);
+GContainer* luau_parseXML_updatesFinish(AUpdatesParser *parser, GError **err);
+void luau_parseXML_updatesFree(AUpdatesParser *parser);
 gboolean luau_parseXML_progInfo(GString *contents, AProgInfo *progInfo, GError **err);
 
 #endif /* !PARSEUPDATES_H */
@@ -27,6 +27,7 @@
 
 #include <libxml/xmlmemory.h>
 #include <libxml/parser.h>
+#include <libxml/SAX2.h>
 #include <glib.h>
 
 #include "libuau.h"
@@ -34,80 +35,172 @@
 #include "error.h"
 #include "parse.h"
 #include "parseupdates.h"
+#include "arena.h"
+#include "textscan.h"
+#include "versionkey.h"
 
 #ifdef WITH_DMALLOC
 #  include <dmalloc.h>
 #endif
 
-G_LOCK_DEFINE_STATIC (parse);
+/// Attributes of a <package-group> that hold one value (an inner group's value overrides an outer one's)
+typedef enum {
+	ATTR_OPTION,
+	ATTR_TYPE,
+	ATTR_SIZE,
+	ATTR_MD5,
+	ATTR_FILENAME,
+	ATTR_VERSION,
+	N_SING_ATTRIBUTES
+} ASingAttributeID;
 
-typedef struct {
-	char *id;
-	GContainer *mirrors;
-} AMirrorList;
-
-typedef struct {
-	char *id;
-	char *url;
-} AMirror;
+/// Attributes of a <package-group> that hold a list (an inner group's values add to an outer one's)
+typedef enum {
+	ATTR_MIRROR_URL,
+	ATTR_MIRROR_ID,
+	N_MULT_ATTRIBUTES
+} AMultAttributeID;
 
+/* The attributes in effect at one level of the file.  Entering a <package-group> or
+   <package> copies the enclosing level's set by value, which only takes a few pointers,
+   since nothing in a set is ever changed in place: setting a value at the new level
+   replaces the pointer (leaving the enclosing level's value alone), and new list values
+   are put in front of the enclosing level's lists, whose cells are then shared. */
 typedef struct {
-	GContainer *definedMirrors;
-	GContainer *definedMirrorLists;
-	GContainer *multAttributes;
-	GContainer *singAttributes;
+	/// Memory the mirror sets are allocated from (the file's arena)
+	AArena *arena;
+	/// Mirror ID -> GSList of URLs (only added to at the top level, so shared by all levels)
+	GHashTable *definedMirrors;
+	/// Mirror list ID -> GSList of mirror IDs (likewise)
+	GHashTable *definedMirrorLists;
+	/// Mirror URLs and IDs (see resolveMirrorSet) -> the AMirrorSet they come to (likewise)
+	GHashTable *resolvedMirrors;
+	/// Package version (interned in the arena) -> its AVersionKey, also in the arena (likewise)
+	GHashTable *versionKeys;
+	/// The mirrors the list attributes currently come to (or NULL if there aren't any)
+	const AMirrorSet *mirrorSet;
+	/// Value of each single-valued attribute (or NULL)
+	char *singAttributes[N_SING_ATTRIBUTES];
+	/// Values of each list attribute, the last one added first
+	GSList *multAttributes[N_MULT_ATTRIBUTES];
 } ASetAttributes;
 
+/// The text inside a tag, with the whitespace around it left off (see getTagText)
 typedef struct {
-	char *id;
-	char *value;
-} ASingAttribute;
+	/// Start of the text (not NUL-terminated) and its length
+	const char *str;
+	gsize len;
+	/// Where libxml2 put the text together, if it came in several pieces (or NULL)
+	xmlChar *joined;
+} ATagText;
 
+/// An update kept because it's among the best read so far (see keepIfBest)
 typedef struct {
-	char *id;
-	GContainer *values;
-} AMultAttribute;
+	AUpdate *update;
+	/// How many updates were read before it (updates that rank the same stay in this order)
+	unsigned int seq;
+} ARankedUpdate;
+
+struct _AUpdatesParser {
+	xmlParserCtxtPtr context;
+	/// Updates read so far
+	GContainer *updates;
+	/// Memory the contents of those updates are allocated from
+	AArena *arena;
+	/// Mirrors defined so far at the top level of the file
+	ASetAttributes attributes;
+	/// Parts of each update to read in
+	AUpdateFields fields;
+	/// Which updates to read in (or NULL for all of them)
+	AUpdateFilter *filter;
+	/// Installed version and package version the filter compares against (or NULL)
+	char *installedVersion;
+	char *installedPkgVersion;
+	/// Those two, split up for comparing
+	AVersionKey *installedVersionKey;
+	AVersionKey *installedPkgVersionKey;
+	/// The best updates read so far, a heap with the worst of them first (or NULL if the
+	/// filter has no limit, in which case updates go straight into the list)
+	ARankedUpdate *best;
+	unsigned int nBest;
+	/// How many updates have been read in
+	unsigned int nRead;
+	gboolean foundProgInfo;
+	/// Function each update is passed to as soon as it has been read (or NULL)
+	ACallbackWithData callback;
+	void *callbackData;
+};
+
+/// Repository files are passed to libxml2 in pieces of (at most) this size
+#define PARSE_CHUNK_SIZE (64 * 1024)
 
-static GContainer *updates;
-static AUpdate *currUpdate;
+static void endElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI);
+static void parseCompleted(AUpdatesParser *parser, xmlDocPtr doc);
+static gboolean checkRoot (xmlNodePtr node, GError **err);
+static void parseTopLevel (AUpdatesParser *parser, xmlDocPtr doc, xmlNodePtr node);
+static void addUpdate     (AUpdatesParser *parser, AUpdate *update);
+static AUpdate* readUpdate(AUpdatesParser *parser, xmlDocPtr doc, xmlNodePtr node, xmlChar *type);
+static gboolean wantUpdate(AUpdatesParser *parser, xmlNodePtr node, int type, const char *version, gboolean *undecided);
+static int updateType     (const xmlChar *type);
+static APkgType updateFormats(xmlNodePtr node, APkgType groupType);
 
-static void parseUpdates  (xmlDocPtr doc, xmlNodePtr node);
-static void parseUpdate   (xmlDocPtr doc, xmlNodePtr node, xmlChar *type, ASetAttributes *attributes);
+static void keepIfBest   (AUpdatesParser *parser, AUpdate *update);
+static void listBest     (AUpdatesParser *parser);
+static void siftDown     (AUpdatesParser *parser, unsigned int i, ARankedUpdate ranked);
+static int compareRanked (const AUpdatesParser *parser, const ARankedUpdate *a, const ARankedUpdate *b);
+static int compareVersions(const char *a, const AVersionKey *aKey, const char *b, const AVersionKey *bKey);
+static AVersionKey* buildVersionKey(AArena *arena, const char *version);
+static AVersionKey* packageVersionKey(ASetAttributes *attributes, const char *version);
+static AUpdate* parseUpdate(AArena *arena, AUpdateFields fields, xmlDocPtr doc, xmlNodePtr node, xmlChar *type, ASetAttributes *attributes);
+
+static char progInfoTag   (const xmlChar *name);
+static char genericInfoTag(const xmlChar *name);
+static char softwareTag   (const xmlChar *name);
+static char libupdateTag  (const xmlChar *name);
+static char pkgGroupTag   (const xmlChar *name);
+static char matchTag      (const char *name, const char *tag, char symbol);
 
 static void parseProgInfo   (AProgInfo *progInfo, xmlDocPtr doc, xmlNodePtr node, GError **err);
 static void parseProgInfoTag(AProgInfo *progInfo, xmlDocPtr doc, xmlNodePtr node);
 
 static void parseMirrorList(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
 static void parseMirrorDef (xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes, char *list_id);
-static void addToMirrorList(ASetAttributes *attributes, const char *list_id, const char *mirror_id);
+static void addDefinition  (GHashTable *definitions, const char *id, char *value);
+
+static void parseSoftware   (AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
+static void parsePackage    (AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
+static void parseMessage    (AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
+static void parseLibupdate  (AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
+static void parseGenericInfo(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
+static void parseUpdateInfo (AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
+static void parsePkgGroup   (AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
 
-static void parseSoftware   (xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
-static void parsePackage    (xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
-static void parseMessage    (xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
-static void parseLibupdate  (xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
-static void parseGenericInfo(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
-static void parseUpdateInfo (xmlDocPtr doc, xmlNodePtr node, AUpdateType type, ASetAttributes *attributes);
-static void parsePkgGroup   (xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes);
+static void parsePackageProperties  (AUpdate *update, xmlNodePtr node, APackage *pkg, ASetAttributes *attributes);
+static int parsePackageAttrMirrors (AArena *arena, APackage *pkg, const AMirrorSet *mirrorSet, const char *suffix, const char *loc);
+static int parsePackageChildMirrors(AArena *arena, xmlDocPtr doc, xmlNodePtr node, APackage *pkg, const char *suffix);
 
-static GContainer* parsePackageProperties  (xmlNodePtr node, APackage *pkg, ASetAttributes *attributes);
-static int parsePackageAttrMirrors (APackage *pkg, ASetAttributes *attributes, const char *suffix, const char *loc);
-static int parsePackageChildMirrors(xmlDocPtr doc, xmlNodePtr node, APackage *pkg, const char *suffix);
+static gboolean getTagText   (xmlDocPtr doc, xmlNodePtr node, ATagText *text);
+static char*       arenaText (AArena *arena, xmlDocPtr doc, xmlNodePtr node, const char *suffix);
+static const char* internText(AArena *arena, xmlDocPtr doc, xmlNodePtr node);
+static char*       dupText   (xmlDocPtr doc, xmlNodePtr node);
+static void        dateText  (xmlDocPtr doc, xmlNodePtr node, ADate *date);
 
-static gboolean parseQuantData(void **data, char *str, AQuantDataType quantDataType);
+static gboolean parseQuantData(AArena *arena, void **data, char *str, AQuantDataType quantDataType);
 
-static AMultAttribute* appendStringToAttributeList(ASetAttributes *attributes, const char *id, const char *value);
+static void appendStringToAttributeList(ASetAttributes *attributes, AMultAttributeID id, const char *value);
 
-static ASingAttribute* setAttributeValue (ASetAttributes *attributes, const char *id, const char *value);
-static GContainer*     getAttributeList  (ASetAttributes *attributes, const char *id);
-static char*           getAttributeString(ASetAttributes *attributes, const char *id);
+static void        setAttributeValue (ASetAttributes *attributes, ASingAttributeID id, const char *value);
+static GContainer* getAttributeList  (ASetAttributes *attributes, AMultAttributeID id);
+static char*       getAttributeString(ASetAttributes *attributes, ASingAttributeID id);
 
-static GContainer* parseMirrorIDs(GContainer *ids, ASetAttributes *attributes);
+static void addMirrorURLs(GContainer *urls, const char *id, ASetAttributes *attributes);
+static const AMirrorSet* resolveMirrorSet(ASetAttributes *attributes);
+static gboolean hasChildMirrors(xmlNodePtr node);
 
-static void initializeSetAttributes(ASetAttributes *attributes);
-static void copySetAttributes(ASetAttributes *newSet, ASetAttributes *attributes, gboolean deepCopy);
-static void freeSetAttributes(ASetAttributes *attributes, gboolean deepFree);
-static void freeSingAttribute(ASingAttribute *attr);
-static void freeMultAttribute(AMultAttribute *attrs);
+static void initializeSetAttributes(ASetAttributes *attributes, AArena *arena);
+static void copySetAttributes(ASetAttributes *newSet, const ASetAttributes *attributes);
+static void freeSetAttributes(ASetAttributes *attributes, const ASetAttributes *enclosing);
+static void freeStringList(gpointer list);
 
 
 /**
@@ -121,59 +214,268 @@ static void freeMultAttribute(AMultAttribute *attrs);
  */
 GContainer *
 luau_parseXML_updates(char *contents, GError **err) {
-	xmlDocPtr doc;
-	xmlNodePtr node;
-	xmlChar *interfaceStr;
-	AInterface xmlInterface, readableInterface;
-	gboolean result;
-	GContainer *ret;
+	AUpdatesParser *parser;
 	
 	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
 	
-	G_LOCK (parse);
-	
-	/* Tell libxml2 to store line number info for more helpful error output */
-	xmlLineNumbersDefault(1);
-	
-	updates = g_container_new(GCONT_LIST);
-	doc = xmlParseMemory(contents, strlen(contents));
-	node = xmlDocGetRootElement(doc);
-	if (node == NULL) {
-		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_FAILED, "XML file could not be parsed");
-		xmlFreeDoc(doc);
+	parser = luau_parseXML_updatesNew();
+	if (!luau_parseXML_updatesFeed(parser, contents, strlen(contents), err)) {
+		luau_parseXML_updatesFree(parser);
 		return NULL;
 	}
 	
-	if (! xmlStrEqual(node->name, (const xmlChar *) "luau-repository")) {
-		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_FAILED, "XML error: Invalid root element");
-		xmlFreeDoc(doc);
-		return NULL;
+	return luau_parseXML_updatesFinish(parser, err);
+}
+
+/**
+ * Start parsing a Luau XML repository file which is supplied a piece at a time (eg.
+ * as it arrives from the network) through \ref luau_parseXML_updatesFeed, so that
+ * the file never has to be held in memory as a whole.  Once all of it has been fed
+ * in, \ref luau_parseXML_updatesFinish returns the updates (as
+ * \ref luau_parseXML_updates would have).
+ *
+ * Each top-level element of the file (an <update>, <software> or <mirror-list>)
+ * is read as soon as its closing tag arrives and is then thrown away, so only
+ * one of them is held in memory at a time rather than a tree of the whole file.
+ *
+ * All of the state of a parse lives in the parser, so any number of parsers can be
+ * in use at once (in different threads, say) without getting in each other's way.
+ *
+ * @return a new parser, to be finished with \ref luau_parseXML_updatesFinish or
+ *         abandoned with \ref luau_parseXML_updatesFree
+ */
+AUpdatesParser *
+luau_parseXML_updatesNew(void) {
+	AUpdatesParser *parser;
+	
+	/* Sets up libxml2's own globals, if that hasn't been done yet (it's harmless to
+	   call more than once) */
+	xmlInitParser();
+	
+	parser = g_malloc(sizeof(AUpdatesParser));
+	parser->context = NULL;
+	parser->updates = g_container_new(GCONT_LIST);
+	parser->arena = luau_arena_new();
+	initializeSetAttributes(&(parser->attributes), parser->arena);
+	parser->foundProgInfo = FALSE;
+	parser->fields = LUAU_FIELDS_FULL;
+	parser->filter = NULL;
+	parser->installedVersion = NULL;
+	parser->installedPkgVersion = NULL;
+	parser->installedVersionKey = NULL;
+	parser->installedPkgVersionKey = NULL;
+	parser->best = NULL;
+	parser->nBest = 0;
+	parser->nRead = 0;
+	parser->callback = NULL;
+	parser->callbackData = NULL;
+	
+	return parser;
+}
+
+/**
+ * Have a parser started with \ref luau_parseXML_updatesNew pass each update to
+ * \c callback as soon as it has been read, rather than only handing the whole
+ * list back at the end.  This lets the caller get on with the first updates in a
+ * file while the rest of it is still arriving.
+ *
+ * The update passed to the callback is the one that ends up in the list returned
+ * by \ref luau_parseXML_updatesFinish (so the callback may change it, but mustn't
+ * free it).  If the file turns out to be broken further on, the updates already
+ * passed to the callback are free'd along with the parser.
+ *
+ * @arg parser is the parser.
+ * @arg callback is called with each update (as \c callback_data) and \c userData.
+ * @arg userData is passed to \c callback.
+ */
+void
+luau_parseXML_updatesSetCallback(AUpdatesParser *parser, ACallbackWithData callback, void *userData) {
+	parser->callback = callback;
+	parser->callbackData = userData;
+}
+
+/**
+ * Have a parser started with \ref luau_parseXML_updatesNew only read in some parts
+ * of each update (by default, everything is read in).  The parts left out are
+ * skipped over without being copied or looked into at all; in particular, the
+ * mirrors of packages are never worked out.
+ *
+ * @arg parser is the parser.
+ * @arg fields says which parts of the updates to read in.
+ */
+void
+luau_parseXML_updatesSetFields(AUpdatesParser *parser, AUpdateFields fields) {
+	parser->fields = fields;
+}
+
+/**
+ * Have a parser started with \ref luau_parseXML_updatesNew only read in the updates
+ * that pass \c filter (by default, every update is read in).  Whether an update
+ * passes is worked out from its tags alone, before anything is allocated for it,
+ * so the ones that don't are skipped over at next to no cost.
+ *
+ * If the filter has a limit, only that many updates are kept as the file is read
+ * (the best so far, by the filter's order), each with its own memory, so that the
+ * ones pushed out by better updates later on leave nothing behind.  Those kept are
+ * listed (and passed to the callback) best first, once the whole file has been read.
+ *
+ * @arg parser is the parser.
+ * @arg filter says which updates to read in (it's copied, so it needn't outlive
+ *      this call).
+ * @arg installed is the program the updates are for; its version and package
+ *      version are what \c filter->newerOnly compares against.
+ */
+void
+luau_parseXML_updatesSetFilter(AUpdatesParser *parser, const AUpdateFilter *filter, const AProgInfo *installed) {
+	g_free(parser->filter);
+	g_free(parser->installedVersion);
+	g_free(parser->installedPkgVersion);
+	g_free(parser->installedVersionKey);
+	g_free(parser->installedPkgVersionKey);
+	g_free(parser->best);
+	
+	parser->filter = g_malloc(sizeof(AUpdateFilter));
+	*(parser->filter) = *filter;
+	parser->installedVersion = g_strdup(installed->version);
+	parser->installedPkgVersion = g_strdup(installed->pkgVersion);
+	parser->installedVersionKey = luau_versionkey_new(parser->installedVersion);
+	parser->installedPkgVersionKey = luau_versionkey_new(parser->installedPkgVersion);
+	parser->best = (filter->limit > 0) ? g_new(ARankedUpdate, filter->limit) : NULL;
+	parser->nBest = 0;
+}
+
+/**
+ * Feed the next piece of a repository file to a parser started with
+ * \ref luau_parseXML_updatesNew.
+ *
+ * @arg parser is the parser.
+ * @arg data is the next piece of the file.
+ * @arg len is the length of \c data.
+ * @arg err is a GError which will store any recoverable run-time errors
+ * @return FALSE if the file turned out not to be well-formed (there's no point feeding
+ *         in the rest of it)
+ */
+gboolean
+luau_parseXML_updatesFeed(AUpdatesParser *parser, const char *data, int len, GError **err) {
+	xmlSAXHandler handler;
+	int ret = 0, piece;
+	
+	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
+	
+	if (len <= 0)
+		return TRUE;
+	
+	if (parser->context == NULL) {
+		/* The usual tree-building handlers, plus a hook to pick off finished elements */
+		memset(&handler, 0, sizeof(xmlSAXHandler));
+		xmlSAXVersion(&handler, 2);
+		handler.endElementNs = endElement;
+		
+		/* libxml2 guesses the encoding from the first few bytes */
+		parser->context = xmlCreatePushParserCtxt(&handler, NULL, NULL, 0, NULL);
+		if (parser->context == NULL) {
+			g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_FAILED, "XML file could not be parsed");
+			return FALSE;
+		}
+		parser->context->_private = parser;
+		
+		/* Store line number info for more helpful error output (set on the context
+		   rather than through xmlLineNumbersDefault(), which is shared by every thread) */
+		parser->context->linenumbers = 1;
 	}
 	
-	interfaceStr = xmlGetProp(node, "interface");
-	result = luau_parseInterface(&xmlInterface, interfaceStr);
-	xmlFree(interfaceStr);
+	/* libxml2 refuses to look through too much input at once */
+	while (ret == 0 && parser->context->wellFormed && len > 0) {
+		piece = MIN(len, PARSE_CHUNK_SIZE);
+		ret = xmlParseChunk(parser->context, data, piece, 0);
+		data += piece;
+		len -= piece;
+	}
 	
-	if (result == FALSE)
-		DBUGOUT("XML interface version either not specified or unreadable: may encounter problems");
-	else {
-		readableInterface.major = LUAU_XML_INTERFACE_MAJOR;
-		readableInterface.minor = LUAU_XML_INTERFACE_MINOR;
-		if (!luau_satisfiesInterface(&readableInterface, &xmlInterface))
-			DBUGOUT("Unsupported XML interface specified - will continue, but will most likely encounter errors");
+	if (ret != 0 || !parser->context->wellFormed) {
+		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_FAILED, "XML file could not be parsed");
+		return FALSE;
 	}
 	
-	parseUpdates(doc, node);
+	return TRUE;
+}
+
+/**
+ * Finish parsing a repository file fed to a parser started with
+ * \ref luau_parseXML_updatesNew.  The parser is free'd.
+ *
+ * @arg parser is the parser.
+ * @arg err is a GError which will store any recoverable run-time errors
+ * @return a GContainer of type GCONT_LIST of updates.
+ */
+GContainer *
+luau_parseXML_updatesFinish(AUpdatesParser *parser, GError **err) {
+	GContainer *ret = NULL;
+	xmlDocPtr doc = NULL;
 	
-	xmlFreeDoc(doc);
+	g_return_val_if_fail(err == NULL || *err == NULL, NULL);
 	
-	ret = updates;
+	if (parser->context != NULL) {
+		xmlParseChunk(parser->context, NULL, 0, 1);
+		if (parser->context->wellFormed)
+			doc = parser->context->myDoc;
+	}
+	
+	if (checkRoot(xmlDocGetRootElement(doc), err)) {
+		/* Everything has normally been read by now, but just in case */
+		parseCompleted(parser, doc);
+		if (parser->best != NULL)
+			listBest(parser);
+		
+		if (!parser->foundProgInfo)
+			DBUGOUT("No <program-info> tag found - required by DTD");
+		
+		ret = parser->updates;
+		parser->updates = NULL;
+	}
 	
-	G_UNLOCK (parse);
+	luau_parseXML_updatesFree(parser);
+	
+	g_assert(ret != NULL || err == NULL || *err != NULL);
 	
 	return ret;
 }
 
+/**
+ * Abandon a parser started with \ref luau_parseXML_updatesNew.
+ *
+ * @arg parser is the parser.
+ */
+void
+luau_parseXML_updatesFree(AUpdatesParser *parser) {
+	unsigned int i;
+	
+	if (parser == NULL)
+		return;
+	
+	if (parser->context != NULL) {
+		xmlFreeDoc(parser->context->myDoc);
+		xmlFreeParserCtxt(parser->context);
+	}
+	if (parser->updates != NULL)
+		luau_freeUpdateList(g_container_free(parser->updates, FALSE));
+	/* The updates handed back each hold their own reference to the arena */
+	luau_arena_unref(parser->arena);
+	freeSetAttributes(&(parser->attributes), NULL);
+	g_free(parser->filter);
+	g_free(parser->installedVersion);
+	g_free(parser->installedPkgVersion);
+	g_free(parser->installedVersionKey);
+	g_free(parser->installedPkgVersionKey);
+	/* Only left over if the file was broken */
+	for (i = 0; i < parser->nBest; ++i) {
+		luau_freeUpdateInfo(parser->best[i].update);
+		g_free(parser->best[i].update);
+	}
+	g_free(parser->best);
+	g_free(parser);
+}
+
 gboolean
 luau_parseXML_progInfo(GString *contents, AProgInfo *progInfo, GError **err) {
 	xmlDocPtr doc;
@@ -185,13 +487,9 @@ luau_parseXML_progInfo(GString *contents, AProgInfo *progInfo, GError **err) {
 	g_return_val_if_fail(err == NULL || *err == NULL, FALSE);
 	
 	memset(progInfo, 0, sizeof(AProgInfo));
-
-	G_LOCK (parse);
 	
 	doc = xmlParseMemory(contents->str, contents->len);
 	
-	G_UNLOCK (parse);
-	
 	node = xmlDocGetRootElement(doc);
 	if (node == NULL) {
 		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_FAILED, "XML file could not be parsed");
@@ -226,50 +524,470 @@ luau_parseXML_progInfo(GString *contents, AProgInfo *progInfo, GError **err) {
 	
 	xmlFreeDoc(doc);
 	
-	G_UNLOCK (parse);
-	
 	return TRUE;
 }
 
 /* Non-Interface Methods */
 
+/* SAX handler for closing tags: once the element just closed is a child of the root
+   element, it (and any text or comments before it) is parsed and freed */
+static void
+endElement(void *ctx, const xmlChar *localname, const xmlChar *prefix, const xmlChar *URI) {
+	xmlParserCtxtPtr context = (xmlParserCtxtPtr) ctx;
+	
+	xmlSAX2EndElementNs(ctx, localname, prefix, URI);
+	
+	if (context->nodeNr == 1)
+		parseCompleted((AUpdatesParser *) context->_private, context->myDoc);
+}
+
+/* Parse and free the (complete) children of the root element read so far */
 static void
-parseUpdates(xmlDocPtr doc, xmlNodePtr node) {
+parseCompleted(AUpdatesParser *parser, xmlDocPtr doc) {
+	xmlNodePtr root, node, next;
+	gboolean wanted;
+	
+	root = xmlDocGetRootElement(doc);
+	if (root == NULL)
+		return;
+	
+	/* A file which isn't a repository is rejected once it's all been read */
+	wanted = xmlStrEqual(root->name, (const xmlChar *) "luau-repository");
+	
+	for (node = root->xmlChildrenNode; node != NULL; node = next) {
+		next = node->next;
+		
+		if (wanted)
+			parseTopLevel(parser, doc, node);
+		
+		xmlUnlinkNode(node);
+		xmlFreeNode(node);
+	}
+}
+
+/* Check the root element of a repository file */
+static gboolean
+checkRoot(xmlNodePtr node, GError **err) {
+	xmlChar *interfaceStr;
+	AInterface xmlInterface, readableInterface;
+	gboolean result;
+	
+	if (node == NULL) {
+		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_FAILED, "XML file could not be parsed");
+		return FALSE;
+	}
+	
+	if (! xmlStrEqual(node->name, (const xmlChar *) "luau-repository")) {
+		g_set_error(err, LUAU_BASE_ERROR, LUAU_BASE_ERROR_FAILED, "XML error: Invalid root element");
+		return FALSE;
+	}
+	
+	interfaceStr = xmlGetProp(node, "interface");
+	result = luau_parseInterface(&xmlInterface, interfaceStr);
+	xmlFree(interfaceStr);
+	
+	if (result == FALSE)
+		DBUGOUT("XML interface version either not specified or unreadable: may encounter problems");
+	else {
+		readableInterface.major = LUAU_XML_INTERFACE_MAJOR;
+		readableInterface.minor = LUAU_XML_INTERFACE_MINOR;
+		if (!luau_satisfiesInterface(&readableInterface, &xmlInterface))
+			DBUGOUT("Unsupported XML interface specified - will continue, but will most likely encounter errors");
+	}
+	
+	return TRUE;
+}
+
+/* Parse one child of the <luau-repository> element */
+static void
+parseTopLevel(AUpdatesParser *parser, xmlDocPtr doc, xmlNodePtr node) {
+	AUpdate *update;
 	xmlChar *type;
-	gboolean foundProgInfo = FALSE;
-	ASetAttributes attributes;
+	char *temp;
+	const char *pkgVersion;
+	const AVersionKey *pkgVersionKey;
+	gboolean undecided;
+	
+	if (xmlStrEqual(node->name, (const xmlChar *) "update")) {
+		type = xmlGetProp(node, "type");
+		if (wantUpdate(parser, node, updateType(type), NULL, &undecided)) {
+			update = readUpdate(parser, doc, node, type);
+			if (update != NULL)
+				addUpdate(parser, update);
+		}
+		xmlFree(type);
+	} else if (xmlStrEqual(node->name, (const xmlChar *) "software")) {
+		temp = (char*) xmlGetProp(node, "version");
+		if (!wantUpdate(parser, node, LUAU_SOFTWARE, temp, &undecided)) {
+			xmlFree(temp);
+			return;
+		}
+		update = readUpdate(parser, doc, node, "software");
+		update->newVersion = (char*) luau_arena_intern(update->arena, temp);
+		update->newVersionKey = buildVersionKey(update->arena, update->newVersion);
+		xmlFree(temp);
+		if (update->id == NULL)
+			update->id = update->newVersion;
+		
+		/* Same version as the one installed: only its packages can tell whether it's newer */
+		if (undecided) {
+			pkgVersion = luau_versionkey_mostRecent(update->packages, &pkgVersionKey);
+			if (luau_versionkey_cmpCached(pkgVersion, pkgVersionKey, parser->installedPkgVersion, parser->installedPkgVersionKey) != 1) {
+				luau_freeUpdateInfo(update);
+				g_free(update);
+				return;
+			}
+		}
+		addUpdate(parser, update);
+	} else if (xmlStrEqual(node->name, (const xmlChar *) "program-info")) {
+		/* we can skip this since it isn't relevant to parsing updates - we do, however,
+		   check to make sure only one <program-info> tag is specified */
+	   if (parser->foundProgInfo)
+			DBUGOUT("Two <program-info> tags found - only one is allowed");
+	   parser->foundProgInfo = TRUE;
+	} else if (xmlStrEqual(node->name, (const xmlChar *) "mirror-list")) {
+		parseMirrorList(doc, node, &(parser->attributes));
+	} else if (xmlStrEqual(node->name, (const xmlChar *) "comment")) {
+		// do nothing
+	} else if (! (xmlStrEqual(node->name, (const xmlChar *) "text")) ) {
+		DBUGOUT("Only tags allowed in <luau-repository> root tag are <update>, <software>, and <program-info>; found '%s', skipping", (const char*) node->name);
+	}
+}
+
+/* Whether an update (of the given type and version, with the given tag) passes the
+   parser's filter.  Only the tag and its children are looked at; if the update's
+   version is the same as the installed one, *undecided is set and it's up to the
+   caller to compare package versions once the update has been read in. */
+static gboolean
+wantUpdate(AUpdatesParser *parser, xmlNodePtr node, int type, const char *version, gboolean *undecided) {
+	const AUpdateFilter *filter = parser->filter;
+	AInterface interface;
+	xmlNodePtr child;
+	char *temp;
+	int cmp;
+	
+	*undecided = FALSE;
+	if (filter == NULL)
+		return TRUE;
 	
-	initializeSetAttributes(&attributes);
+	if (filter->type >= 0 && type != filter->type)
+		return FALSE;
+	
+	/* The same comparison isOld (in libuau.c) makes */
+	if (filter->newerOnly && version != NULL && parser->installedVersion != NULL) {
+		cmp = luau_versionkey_cmpCached(version, NULL, parser->installedVersion, parser->installedVersionKey);
+		if (cmp == 0 && parser->installedPkgVersion != NULL)
+			*undecided = TRUE;
+		else if (cmp != 1)
+			return FALSE;
+	}
+	
+	/* Only software updates have packages or an interface */
+	if (filter->formats != 0) {
+		if (type != LUAU_SOFTWARE || ! luau_isOfType(updateFormats(node, 0), filter->formats))
+			return FALSE;
+	}
+	
+	if (filter->interfaceMajor >= 0) {
+		interface.major = interface.minor = 0;
+		for (child = node->xmlChildrenNode; type == LUAU_SOFTWARE && child != NULL; child = child->next) {
+			if (xmlStrEqual(child->name, (const xmlChar *) "interface")) {
+				temp = (char*) xmlGetProp(child, "version");
+				luau_parseInterface(&interface, temp);
+				xmlFree(temp);
+			}
+		}
+		if (interface.major != filter->interfaceMajor)
+			return FALSE;
+	}
+	
+	return TRUE;
+}
+
+/* The AUpdateType named by the type attribute of an <update> tag (or -1) */
+static int
+updateType(const xmlChar *type) {
+	if (type == NULL)
+		return -1;
+	else if (xmlStrcasecmp(type, "software")    == 0)
+		return LUAU_SOFTWARE;
+	else if (xmlStrcasecmp(type, "message")     == 0)
+		return LUAU_MESSAGE;
+	else if (xmlStrcasecmp(type, "luau-config") == 0)
+		return LUAU_LIBUPDATE;
+	else
+		return -1;
+}
+
+/* The formats of all the packages under a tag, as parsePackageProperties would work them
+   out (groupType is the type given by the enclosing <package-group>s, or 0) */
+static APkgType
+updateFormats(xmlNodePtr node, APkgType groupType) {
+	APkgType formats = 0, type;
+	char *temp;
 	
 	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
-		if (xmlStrEqual(node->name, (const xmlChar *) "update")) {
-			type = xmlGetProp(node, "type");
-			parseUpdate(doc, node, type, &attributes);
-			xmlFree(type);
-		} else if (xmlStrEqual(node->name, (const xmlChar *) "software")) {
-			parseUpdate(doc, node, "software", &attributes);
-			currUpdate->newVersion = xmlGetProp(node, "version");
-			if (currUpdate->id == NULL)
-				currUpdate->id = g_strdup(currUpdate->newVersion);
-		} else if (xmlStrEqual(node->name, (const xmlChar *) "program-info")) {
-			/* we can skip this since it isn't relevant to parsing updates - we do, however,
-			   check to make sure only one <program-info> tag is specified */
-		   if (foundProgInfo)
-				DBUGOUT("Two <program-info> tags found - only one is allowed");
-		   foundProgInfo = TRUE;
-		} else if (xmlStrEqual(node->name, (const xmlChar *) "mirror-list")) {
-			parseMirrorList(doc, node, &attributes);
-		} else if (xmlStrEqual(node->name, (const xmlChar *) "comment")) {
-			// do nothing
-		} else if (! (xmlStrEqual(node->name, (const xmlChar *) "text")) ) {
-			DBUGOUT("Only tags allowed in <luau-repository> root tag are <update>, <software>, and <program-info>; found '%s', skipping", (const char*) node->name);
+		if (xmlStrEqual(node->name, (const xmlChar *) "package") ||
+		    xmlStrEqual(node->name, (const xmlChar *) "package-group")) {
+			temp = (char*) xmlGetProp(node, "type");
+			type = (temp != NULL) ? luau_parsePkgType(temp) : groupType;
+			xmlFree(temp);
+			
+			if (xmlStrEqual(node->name, (const xmlChar *) "package-group"))
+				formats |= updateFormats(node, type);
+			else
+				formats |= (type != 0) ? type : LUAU_UNKNOWN;
+		}
+	}
+	
+	return formats;
+}
+
+/* Add a newly read update to the list (and hand it to the callback, if there is one) */
+static void
+addUpdate(AUpdatesParser *parser, AUpdate *update) {
+	if (parser->best != NULL) {
+		keepIfBest(parser, update);
+		return;
+	}
+	
+	g_container_add(parser->updates, update);
+	
+	if (parser->callback != NULL)
+		parser->callback(update, parser->callbackData);
+}
+
+/* Parse an update, into the file's arena unless only the best few updates are being
+   kept: then each gets an arena of its own, so one that's thrown out doesn't leave
+   anything behind (its mirror sets can't be shared with other updates, though) */
+static AUpdate*
+readUpdate(AUpdatesParser *parser, xmlDocPtr doc, xmlNodePtr node, xmlChar *type) {
+	ASetAttributes attributes;
+	AUpdate *update;
+	
+	if (parser->best == NULL)
+		return parseUpdate(parser->arena, parser->fields, doc, node, type, &(parser->attributes));
+	
+	copySetAttributes(&attributes, &(parser->attributes));
+	attributes.arena = luau_arena_new();
+	attributes.resolvedMirrors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	attributes.versionKeys = g_hash_table_new(g_direct_hash, g_direct_equal);
+	
+	update = parseUpdate(attributes.arena, parser->fields, doc, node, type, &attributes);
+	
+	/* The update holds its own reference to the arena */
+	g_hash_table_destroy(attributes.resolvedMirrors);
+	g_hash_table_destroy(attributes.versionKeys);
+	luau_arena_unref(attributes.arena);
+	
+	return update;
+}
+
+/* Keep an update if it's among the best parser->filter->limit read so far (throwing
+   out the worst of those kept to make room, if need be), or throw it out if it isn't */
+static void
+keepIfBest(AUpdatesParser *parser, AUpdate *update) {
+	ARankedUpdate ranked, *heap = parser->best;
+	unsigned int i, parent;
+	
+	ranked.update = update;
+	ranked.seq = parser->nRead++;
+	
+	if (parser->nBest < parser->filter->limit) {
+		for (i = parser->nBest++; i > 0; i = parent) {
+			parent = (i - 1) / 2;
+			if (compareRanked(parser, &ranked, &heap[parent]) > 0)
+				break;
+			heap[i] = heap[parent];
+		}
+		heap[i] = ranked;
+	} else if (compareRanked(parser, &ranked, &heap[0]) > 0) {
+		luau_freeUpdateInfo(heap[0].update);
+		g_free(heap[0].update);
+		siftDown(parser, 0, ranked);
+	} else {
+		luau_freeUpdateInfo(update);
+		g_free(update);
+	}
+}
+
+/* Move the updates kept by keepIfBest into the list, best first */
+static void
+listBest(AUpdatesParser *parser) {
+	ARankedUpdate worst, *heap = parser->best;
+	unsigned int i, n = parser->nBest;
+	
+	/* Take the worst off the heap each time, into the space that leaves at its end:
+	   that sorts the heap best first */
+	while (parser->nBest > 1) {
+		worst = heap[0];
+		--(parser->nBest);
+		siftDown(parser, 0, heap[parser->nBest]);
+		heap[parser->nBest] = worst;
+	}
+	parser->nBest = 0;
+	
+	for (i = 0; i < n; ++i) {
+		g_container_add(parser->updates, heap[i].update);
+		if (parser->callback != NULL)
+			parser->callback(heap[i].update, parser->callbackData);
+	}
+}
+
+/* Put ranked into the heap in place of the update at position i, moving it down
+   past any worse updates below it */
+static void
+siftDown(AUpdatesParser *parser, unsigned int i, ARankedUpdate ranked) {
+	ARankedUpdate *heap = parser->best;
+	unsigned int child;
+	
+	for (; (child = 2*i + 1) < parser->nBest; i = child) {
+		if (child + 1 < parser->nBest && compareRanked(parser, &heap[child + 1], &heap[child]) < 0)
+			++child;
+		if (compareRanked(parser, &ranked, &heap[child]) < 0)
+			break;
+		heap[i] = heap[child];
+	}
+	heap[i] = ranked;
+}
+
+/* Whether one update ranks above (> 0) or below (< 0) another, by the filter's order
+   (no two updates rank the same: the one read first comes out ahead) */
+static int
+compareRanked(const AUpdatesParser *parser, const ARankedUpdate *a, const ARankedUpdate *b) {
+	const AUpdate *x = a->update, *y = b->update;
+	const AVersionKey *xKey, *yKey;
+	const char *xVersion, *yVersion;
+	int cmp;
+	
+	if (parser->filter->order == LUAU_ORDER_INTERFACE) {
+		cmp = x->interface.major - y->interface.major;
+		if (cmp == 0)
+			cmp = x->interface.minor - y->interface.minor;
+	} else {
+		cmp = compareVersions(x->newVersion, x->newVersionKey, y->newVersion, y->newVersionKey);
+		if (cmp == 0) {
+			xVersion = luau_versionkey_mostRecent(x->packages, &xKey);
+			yVersion = luau_versionkey_mostRecent(y->packages, &yKey);
+			cmp = compareVersions(xVersion, xKey, yVersion, yKey);
 		}
 	}
 	
-	if (!foundProgInfo)
-		DBUGOUT("No <program-info> tag found - required by DTD");
+	if (cmp != 0)
+		return cmp;
+	else
+		return (a->seq < b->seq) ? 1 : -1;
+}
+
+/* luau_versioncmp (using the versions' keys), with no version at all coming before any other */
+static int
+compareVersions(const char *a, const AVersionKey *aKey, const char *b, const AVersionKey *bKey) {
+	if (a == NULL || b == NULL)
+		return (a != NULL) - (b != NULL);
+	else
+		return luau_versionkey_cmpCached(a, aKey, b, bKey);
+}
+
+/* Split up a version (already in the arena) for comparing, into the arena */
+static AVersionKey*
+buildVersionKey(AArena *arena, const char *version) {
+	if (version == NULL)
+		return NULL;
 	
-	freeSetAttributes(&attributes, TRUE);
+	return luau_versionkey_build(luau_arena_alloc(arena, luau_versionkey_size(version)), version);
+}
+
+/* The key of a package version interned in the attributes' arena: packages mostly share
+   a handful of versions, so each is only split up the first time it's seen */
+static AVersionKey*
+packageVersionKey(ASetAttributes *attributes, const char *version) {
+	AVersionKey *key;
+	
+	if (version == NULL)
+		return NULL;
+	
+	key = g_hash_table_lookup(attributes->versionKeys, version);
+	if (key == NULL) {
+		key = buildVersionKey(attributes->arena, version);
+		g_hash_table_insert(attributes->versionKeys, (gpointer) version, key);
+	}
+	
+	return key;
+}
+
+/* The tags each part of the file can hold, looked up by LUAU_TAG_KEY */
+
+static char
+progInfoTag(const xmlChar *name) {
+	const char *tag = (const char *) name;
+	
+	switch (LUAU_TAG_KEY(strlen(tag), tag[0])) {
+		case LUAU_TAG_KEY(9, 's'): return matchTag(tag, "shortname", 's');
+		case LUAU_TAG_KEY(8, 'f'): return matchTag(tag, "fullname",  'f');
+		case LUAU_TAG_KEY(4, 'd'): return matchTag(tag, "desc",      'd');
+		case LUAU_TAG_KEY(7, 'k'): return matchTag(tag, "keyword",   'k');
+		case LUAU_TAG_KEY(3, 'u'): return matchTag(tag, "url",       'u');
+		case LUAU_TAG_KEY(4, 't'): return matchTag(tag, "text",      't');
+		case LUAU_TAG_KEY(7, 'c'): return matchTag(tag, "comment",   'c');
+		default:                   return -1;
+	}
+}
+
+static char
+genericInfoTag(const xmlChar *name) {
+	const char *tag = (const char *) name;
+	
+	switch (LUAU_TAG_KEY(strlen(tag), tag[0])) {
+		case LUAU_TAG_KEY(2, 'i'): return matchTag(tag, "id",      'i');
+		case LUAU_TAG_KEY(5, 's'): return matchTag(tag, "short",   's');
+		case LUAU_TAG_KEY(4, 'l'): return matchTag(tag, "long",    'l');
+		case LUAU_TAG_KEY(7, 'k'): return matchTag(tag, "keyword", 'k');
+		case LUAU_TAG_KEY(4, 'd'): return matchTag(tag, "date",    'd');
+		case LUAU_TAG_KEY(5, 'v'): return matchTag(tag, "valid",   'v');
+		default:                   return -1;
+	}
+}
+
+static char
+softwareTag(const xmlChar *name) {
+	const char *tag = (const char *) name;
+	
+	switch (LUAU_TAG_KEY(strlen(tag), tag[0])) {
+		case LUAU_TAG_KEY( 7, 'p'): return matchTag(tag, "package",         'p');
+		case LUAU_TAG_KEY( 9, 'i'): return matchTag(tag, "interface",       'i');
+		case LUAU_TAG_KEY(13, 'p'): return matchTag(tag, "package-group",   'g');
+		case LUAU_TAG_KEY(15, 'd'): return matchTag(tag, "display-version", 'd');
+		default:                    return -1;
+	}
+}
+
+static char
+libupdateTag(const xmlChar *name) {
+	const char *tag = (const char *) name;
+	
+	switch (LUAU_TAG_KEY(strlen(tag), tag[0])) {
+		case LUAU_TAG_KEY(3, 's'): return matchTag(tag, "set", 's');
+		default:                   return -1;
+	}
+}
+
+static char
+pkgGroupTag(const xmlChar *name) {
+	const char *tag = (const char *) name;
+	
+	switch (LUAU_TAG_KEY(strlen(tag), tag[0])) {
+		case LUAU_TAG_KEY( 7, 'p'): return matchTag(tag, "package",       'p');
+		case LUAU_TAG_KEY(13, 'p'): return matchTag(tag, "package-group", 'g');
+		case LUAU_TAG_KEY( 4, 't'): return matchTag(tag, "text",          't');
+		case LUAU_TAG_KEY( 7, 'c'): return matchTag(tag, "comment",       'c');
+		default:                    return -1;
+	}
+}
+
+/* Check a name against the one tag it could be */
+static char
+matchTag(const char *name, const char *tag, char symbol) {
+	return lutil_streq(name, tag) ? symbol : -1;
 }
 
 static void
@@ -292,50 +1010,32 @@ parseProgInfo(AProgInfo *progInfo, xmlDocPtr doc, xmlNodePtr node, GError **err)
 
 static void
 parseProgInfoTag(AProgInfo *progInfo, xmlDocPtr doc, xmlNodePtr node) {
-	static const char *symbols[ ] = {"shortname", "s",
-	                                 "fullname",  "f",
-	                                 "desc",      "d",
-	                                 "keyword",   "k",
-	                                 "url",       "u",
-									 "text",      "t",
-									 "comment",   "c",
-	                                  NULL };
-	char result, *temp;
+	char result;
 	
 	progInfo->id = xmlGetProp(node, "id");
 	progInfo->interface.major = -1;
 	progInfo->interface.minor = -1;
 	
 	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
-		result = lutil_parse_parseSymbolArray((const char *)node->name, symbols);
+		result = progInfoTag(node->name);
 		switch (result) {
 			case 's':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				progInfo->shortname = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				progInfo->shortname = dupText(doc, node);
 				break;
 			case 'f':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				progInfo->fullname = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				progInfo->fullname = dupText(doc, node);
 				break;
 			case 'd':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				progInfo->desc = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				progInfo->desc = dupText(doc, node);
 				break;
 			case 'k':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
 				if (progInfo->keywords == NULL)
 					progInfo->keywords = g_ptr_array_new();
 				
-				g_ptr_array_add(progInfo->keywords, g_strdup(lutil_parse_deleteWhitespace(temp)));
-				xmlFree(temp);
+				g_ptr_array_add(progInfo->keywords, dupText(doc, node));
 				break;
 			case 'u':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				progInfo->url = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				progInfo->url = dupText(doc, node);
 				break;
 			case -1:
 				DBUGOUT("Unrecognized <%s> tag in <program-info> in XML file: Skipping", node->name);
@@ -370,8 +1070,7 @@ parseMirrorList(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes)
 static void
 parseMirrorDef(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes, char *list_id)
 {
-	ASingAttribute *attr;
-	char *temp, *url, *id;
+	char *url, *id;
 	
 	id = (char*) xmlGetProp(node, "id");
 	if (id == NULL || id[0] == '\0')
@@ -381,139 +1080,116 @@ parseMirrorDef(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes, char
 		return;
 	}
 	
-	temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-	url = g_strdup(lutil_parse_deleteWhitespace(temp));
-	xmlFree(temp);
+	url = dupText(doc, node);
 	if (url == NULL || url[0] == '\0')
 	{
-		xmlFree(url);
 		DBUGOUT("No URL specified for mirror '%s' at line %ld", id, xmlGetLineNo(node));
+		g_free(url);
+		xmlFree(id);
 		return;
 	}
 	
-	attr = g_malloc(sizeof(ASingAttribute));
-	attr->id = id;
-	attr->value = url;
-	
-	g_container_add(attributes->definedMirrors, attr);
-	if (list_id != NULL)
-		addToMirrorList(attributes, list_id, id);
-}
-
-static void
-addToMirrorList(ASetAttributes *attributes, const char *list_id, const char *mirror_id)
-{
-	AMirrorList *mirrLst;
-	GIterator iter;
-	gboolean found, result;
-	
-	found = FALSE;
-	
-	result = g_container_get_iter(&iter, attributes->definedMirrorLists);
-	if (result)
-	{
-		while (!found && g_iterator_hasNext(&iter))
-		{
-			mirrLst = g_iterator_next(&iter);
-			
-			if (lutil_streq(list_id, mirrLst->id))
-			{
-				g_container_add(mirrLst->mirrors, g_strdup(mirror_id));
-				found = TRUE;
-			}
-		}
-	}
-	if (!found)
-	{
-		mirrLst = g_malloc(sizeof(AMirrorList));
-		mirrLst->id = g_strdup(list_id);
-		mirrLst->mirrors = g_container_new(GCONT_LIST);
-		g_container_add(mirrLst->mirrors, g_strdup(mirror_id));
-		g_container_add(attributes->definedMirrorLists, mirrLst);
-	}
-}
-                                                                                            
-	
+	addDefinition(attributes->definedMirrors, id, url);
+	if (list_id != NULL)
+		addDefinition(attributes->definedMirrorLists, list_id, g_strdup(id));
+	
+	/* Mirror sets already resolved stay valid for the packages that have them, but
+	   packages from here on need to see the new definition */
+	g_hash_table_destroy(attributes->resolvedMirrors);
+	attributes->resolvedMirrors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	
+	xmlFree(id);
+}
+
+/* Add a value (which the table takes over) to the end of the list defined for an ID
+   (a mirror can be defined more than once, and mirror lists are defined a piece at a time) */
 static void
-parseUpdate(xmlDocPtr doc, xmlNodePtr node, xmlChar *type, ASetAttributes *attributes) {
+addDefinition(GHashTable *definitions, const char *id, char *value)
+{
+	GSList *values;
+	
+	values = g_hash_table_lookup(definitions, id);
+	if (values == NULL)
+		g_hash_table_insert(definitions, g_strdup(id), g_slist_append(NULL, value));
+	else
+		g_slist_append(values, value);
+}
+
+static AUpdate*
+parseUpdate(AArena *arena, AUpdateFields fields, xmlDocPtr doc, xmlNodePtr node, xmlChar *type, ASetAttributes *attributes) {
+	AUpdate *update;
+	
 	if (type == NULL) {
 		DBUGOUT("No type specified for update: skipping");
-		return;
+		return NULL;
 	}
 	
 	/* Create and initialize a new AUpdate object */
-	currUpdate = (AUpdate*) g_malloc(sizeof(AUpdate));
-	memset(currUpdate, 0, sizeof(AUpdate));
-	currUpdate->keywords = g_ptr_array_new();
-	currUpdate->packages = g_ptr_array_new();
-	currUpdate->quantifiers = NULL;
-	g_container_add(updates, currUpdate); /* ... and add it to the list */
-	
-	
-	if      (xmlStrcasecmp(type, "software")    == 0) { currUpdate->type = LUAU_SOFTWARE;  }
-	else if (xmlStrcasecmp(type, "message" )    == 0) { currUpdate->type = LUAU_MESSAGE;   }
-	else if (xmlStrcasecmp(type, "luau-config") == 0) { currUpdate->type = LUAU_LIBUPDATE; }
+	update = (AUpdate*) g_malloc(sizeof(AUpdate));
+	memset(update, 0, sizeof(AUpdate));
+	update->keywords = g_ptr_array_new();
+	update->packages = g_ptr_array_new();
+	update->quantifiers = NULL;
+	/* Everything else the update is made of comes out of the file's arena */
+	update->arena = luau_arena_ref(arena);
+	update->fields = fields;
+	
+	
+	if      (xmlStrcasecmp(type, "software")    == 0) { update->type = LUAU_SOFTWARE;  }
+	else if (xmlStrcasecmp(type, "message" )    == 0) { update->type = LUAU_MESSAGE;   }
+	else if (xmlStrcasecmp(type, "luau-config") == 0) { update->type = LUAU_LIBUPDATE; }
 	else { 
 		DBUGOUT("Unknown 'update' type specified: %s - Skipping", type);
-		return;
+		return update;
 	}
 	DBUGOUT("Found update of type %s", type);
 	
-	parseUpdateInfo(doc, node, currUpdate->type, attributes);
+	parseUpdateInfo(update, doc, node, attributes);
+	
+	return update;
 }
 
 static void
-parseUpdateInfo(xmlDocPtr doc, xmlNodePtr node, AUpdateType type, ASetAttributes *attributes) {
-	parseGenericInfo(doc, node, attributes);
-	if (type == LUAU_SOFTWARE)
-		parseSoftware(doc, node, attributes);
-	if (type == LUAU_MESSAGE)
-		parseMessage(doc, node, attributes);
-	else if (type == LUAU_LIBUPDATE)
-		parseLibupdate(doc, node, attributes);
+parseUpdateInfo(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
+	parseGenericInfo(update, doc, node, attributes);
+	if (update->type == LUAU_SOFTWARE)
+		parseSoftware(update, doc, node, attributes);
+	if (update->type == LUAU_MESSAGE)
+		parseMessage(update, doc, node, attributes);
+	else if (update->type == LUAU_LIBUPDATE)
+		parseLibupdate(update, doc, node, attributes);
 }
 
 static void
-parseGenericInfo(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
-	static const char *symbols[ ] = {"id",       "i",
-	                                 "short",    "s",
-	                                 "long",     "l",
-	                                 "keyword",  "k",
-	                                 "date",     "d",
-	                                 "valid",    "v",
-	                                  NULL };
+parseGenericInfo(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
 	char result, *temp;
 	AQuantifier *quant = NULL;
 	AQuantDataType quantDataType;
 	
 	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
-		result = lutil_parse_parseSymbolArray((const char *)node->name, symbols);
+		result = genericInfoTag(node->name);
 		switch (result) {
 			case 'i':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				currUpdate->id = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				update->id = arenaText(update->arena, doc, node, NULL);
 				break;
 			case 's':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				currUpdate->shortDesc = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				if (update->fields == LUAU_FIELDS_CATEGORIZE)
+					break;
+				update->shortDesc = arenaText(update->arena, doc, node, NULL);
 				break;
 			case 'l':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				currUpdate->fullDesc = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				if (update->fields != LUAU_FIELDS_FULL)
+					break;
+				update->fullDesc = arenaText(update->arena, doc, node, NULL);
 				break;
 			case 'k':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				g_ptr_array_add(currUpdate->keywords, g_strdup(lutil_parse_deleteWhitespace(temp)));
-				xmlFree(temp);
+				g_ptr_array_add(update->keywords, (char*) internText(update->arena, doc, node));
 				break;
 			case 'd':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				currUpdate->date = g_malloc(sizeof(ADate));
-				luau_parseDate(currUpdate->date, lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				if (update->fields == LUAU_FIELDS_CATEGORIZE)
+					break;
+				update->date = luau_arena_alloc(update->arena, sizeof(ADate));
+				dateText(doc, node, update->date);
 				break;
 			case 'v':
 				temp = (char*) xmlGetProp(node, "type");
@@ -527,41 +1203,41 @@ parseGenericInfo(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
 				}
 				xmlFree(temp);
 				
-				if (currUpdate->quantifiers == NULL)
-					currUpdate->quantifiers = g_ptr_array_new();
+				if (update->quantifiers == NULL)
+					update->quantifiers = g_ptr_array_new();
 				
 				temp = (char*) xmlGetProp(node, "from");
 				if (temp != NULL) {
-					quant = g_malloc(sizeof(AQuantifier));
+					quant = luau_arena_alloc(update->arena, sizeof(AQuantifier));
 					quant->qtype = LUAU_QUANT_FROM;
 					quant->dtype = quantDataType;
-					parseQuantData(&(quant->data), temp, quantDataType);
+					parseQuantData(update->arena, &(quant->data), temp, quantDataType);
 					
-					g_ptr_array_add(currUpdate->quantifiers, quant);
+					g_ptr_array_add(update->quantifiers, quant);
 					
 					xmlFree(temp);
 				}
 				
 				temp = (char*) xmlGetProp(node, "to");
 				if (temp != NULL) {
-					quant = g_malloc(sizeof(AQuantifier));
+					quant = luau_arena_alloc(update->arena, sizeof(AQuantifier));
 					quant->qtype = LUAU_QUANT_TO;
 					quant->dtype = quantDataType;
-					parseQuantData(&(quant->data), temp, quantDataType);
+					parseQuantData(update->arena, &(quant->data), temp, quantDataType);
 					
-					g_ptr_array_add(currUpdate->quantifiers, quant);
+					g_ptr_array_add(update->quantifiers, quant);
 					
 					xmlFree(temp);
 				}
 				
 				temp = (char*) xmlGetProp(node, "for");
 				if (temp != NULL) {
-					quant = g_malloc(sizeof(AQuantifier));
+					quant = luau_arena_alloc(update->arena, sizeof(AQuantifier));
 					quant->qtype = LUAU_QUANT_FOR;
 					quant->dtype = quantDataType;
-					parseQuantData(&(quant->data), temp, quantDataType);
+					parseQuantData(update->arena, &(quant->data), temp, quantDataType);
 					
-					g_ptr_array_add(currUpdate->quantifiers, quant);
+					g_ptr_array_add(update->quantifiers, quant);
 					
 					xmlFree(temp);
 				}
@@ -572,71 +1248,92 @@ parseGenericInfo(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
 }
 
 static void
-parseSoftware(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) { 
-	static const char *symbols[ ] = {"package",         "p",
-									 "interface",       "i",
-									 "package-group",   "g",
-									 "display-version", "d",
-	                                  NULL };
+parseSoftware(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) { 
 	char result, *temp;
 	
 	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
-		result = lutil_parse_parseSymbolArray((const char *)node->name, symbols);
+		result = softwareTag(node->name);
 		switch (result) {
 			case 'p':
-				parsePackage(doc, node, attributes);
+				parsePackage(update, doc, node, attributes);
 				break;
 				
 			case 'i':
 				temp = (char*) xmlGetProp(node, "version");
-				luau_parseInterface(&(currUpdate->interface), temp);
+				luau_parseInterface(&(update->interface), temp);
 				xmlFree(temp);
 				
 				break;
 				
 			case 'g':
-				parsePkgGroup(doc, node, attributes);
+				parsePkgGroup(update, doc, node, attributes);
 				break;
 				
 			case 'd':
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				currUpdate->newDisplayVersion = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
+				if (update->fields == LUAU_FIELDS_CATEGORIZE)
+					break;
+				update->newDisplayVersion = arenaText(update->arena, doc, node, NULL);
 				break;
 		}
 	}
 }
 
 static void
-parsePackage(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
+parsePackage(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
 	ASetAttributes newAttributes;
 	GPtrArray *mirrors;
-	GContainer *allocated;
 	APackage *pkg;
-	char *loc, *temp, *suffix;
+	char *loc, *suffix;
 	unsigned int i, total;
 	
-	copySetAttributes(&newAttributes, attributes, FALSE);
+	copySetAttributes(&newAttributes, attributes);
 	
-	pkg = (APackage*) g_malloc(sizeof(APackage));
-	g_ptr_array_add(currUpdate->packages, pkg);
-	pkg->mirrors = g_ptr_array_new();
-	mirrors = pkg->mirrors;
+	pkg = (APackage*) luau_arena_alloc(update->arena, sizeof(APackage));
+	g_ptr_array_add(update->packages, pkg);
+	pkg->mirrors = NULL;
+	pkg->mirrorSet = NULL;
+	pkg->mirrorPath = NULL;
+	pkg->versionKey = NULL;
 	
-	suffix = getAttributeString(&newAttributes, "filename");
+	/* Without its mirrors, all there is to a package is its properties */
+	if (update->fields != LUAU_FIELDS_FULL) {
+		parsePackageProperties(update, node, pkg, &newAttributes);
+		freeSetAttributes(&newAttributes, attributes);
+		return;
+	}
 	
-	temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-	loc = g_strdup(lutil_parse_deleteWhitespace(temp));
-	xmlFree(temp);
+	suffix = getAttributeString(&newAttributes, ATTR_FILENAME);
+	
+	loc = dupText(doc, node);
 	
 	if (loc != NULL && loc[0] == '\0') {
 		g_free(loc);
 		loc = NULL;
 	}
 
-	allocated = parsePackageProperties(node, pkg, &newAttributes);
-	total  = parsePackageAttrMirrors(pkg, &newAttributes, suffix, loc);
-	total += parsePackageChildMirrors(doc, node, pkg, suffix);
+	parsePackageProperties(update, node, pkg, &newAttributes);
+	
+	/* A package found only on the mirrors in effect just keeps its path on them; those
+	   mirrors (and their weights) are shared with every other package that uses them */
+	if (newAttributes.mirrorSet != NULL && (loc != NULL || suffix != NULL) && !hasChildMirrors(node)) {
+		if (suffix == NULL)
+			pkg->mirrorPath = luau_arena_strdup(update->arena, loc);
+		else if (loc == NULL)
+			pkg->mirrorPath = luau_arena_strdup(update->arena, suffix);
+		else
+			pkg->mirrorPath = luau_arena_strconcat(update->arena, loc, "/", suffix, NULL);
+		pkg->mirrorSet = newAttributes.mirrorSet;
+		
+		g_free(loc);
+		freeSetAttributes(&newAttributes, attributes);
+		return;
+	}
+	
+	pkg->mirrors = luau_arena_newPtrArray(update->arena);
+	mirrors = pkg->mirrors;
+	
+	total  = parsePackageAttrMirrors(update->arena, pkg, newAttributes.mirrorSet, suffix, loc);
+	total += parsePackageChildMirrors(update->arena, doc, node, pkg, suffix);
 	
 	if (total != 100 && total != 0) {
 		int n, sum;
@@ -670,29 +1367,20 @@ parsePackage(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
 
 	
 	g_free(loc);
-	if (allocated != NULL)
-		g_container_destroy(allocated);
-	
-	freeSetAttributes(&newAttributes, FALSE);
+	freeSetAttributes(&newAttributes, attributes);
 }
 	
 
-static GContainer *
-parsePackageProperties(xmlNodePtr node, APackage *pkg, ASetAttributes *attributes)
+static void
+parsePackageProperties(AUpdate *update, xmlNodePtr node, APackage *pkg, ASetAttributes *attributes)
 {
-	GContainer *allocated;
-	GPtrArray *mirrors;
 	char *temp;
 	
-	allocated = NULL;
-	
-	mirrors = pkg->mirrors;
-	
 	temp = (char*) xmlGetProp(node, "md5");
 	if (temp != NULL) {
 		strncpy(pkg->md5sum, temp, 33);
 		xmlFree(temp);
-	} else if ( (temp = getAttributeString(attributes, "md5")) != NULL ) {
+	} else if ( (temp = getAttributeString(attributes, ATTR_MD5)) != NULL ) {
 		strncpy(pkg->md5sum, temp, 33);
 	} else {
 		pkg->md5sum[0] = '\0';
@@ -702,7 +1390,7 @@ parsePackageProperties(xmlNodePtr node, APackage *pkg, ASetAttributes *attribute
 	if (temp != NULL) {
 		pkg->size = atoi(temp);
 		xmlFree(temp);
-	} else if ( (temp = getAttributeString(attributes, "size")) != NULL ) {
+	} else if ( (temp = getAttributeString(attributes, ATTR_SIZE)) != NULL ) {
 		pkg->size = atoi(temp);
 	} else {
 		pkg->size = 0;
@@ -712,114 +1400,88 @@ parsePackageProperties(xmlNodePtr node, APackage *pkg, ASetAttributes *attribute
 	if (temp != NULL) {
 		pkg->type = luau_parsePkgType(temp);
 		xmlFree(temp);
-	} else if ( (temp = getAttributeString(attributes, "type")) != NULL ) {
+	} else if ( (temp = getAttributeString(attributes, ATTR_TYPE)) != NULL ) {
 		pkg->type = luau_parsePkgType(temp);
 	} else {
 		pkg->type = LUAU_UNKNOWN;
 	}
 	
-	temp = (char*) xmlGetProp(node, "mirror-id");
+	temp = (update->fields == LUAU_FIELDS_FULL) ? (char*) xmlGetProp(node, "mirror-id") : NULL;
 	if (temp != NULL)
 	{
-		AMultAttribute *attrs;
-		
-		allocated = g_container_new(GCONT_LIST);
-		
-		attrs = appendStringToAttributeList(attributes, "mirror-id", temp);
-		g_container_add(allocated, attrs->id);
-		g_container_add(allocated, attrs->values);
-		g_container_concat(allocated, attrs->values);
-		g_container_add(allocated, attrs);
-		
+		appendStringToAttributeList(attributes, ATTR_MIRROR_ID, temp);
+		attributes->mirrorSet = resolveMirrorSet(attributes);
 		xmlFree(temp);
 	}
 	
-	pkg->version = (char*) xmlGetProp(node, "version");
-	if (pkg->version == NULL)
-		pkg->version = getAttributeString(attributes, "version");
+	temp = (char*) xmlGetProp(node, "version");
+	if (temp != NULL) {
+		pkg->version = (char*) luau_arena_intern(update->arena, temp);
+		xmlFree(temp);
+	} else {
+		pkg->version = (char*) luau_arena_intern(update->arena, getAttributeString(attributes, ATTR_VERSION));
+	}
+	pkg->versionKey = packageVersionKey(attributes, pkg->version);
 		
-	currUpdate->availableFormats = (currUpdate->availableFormats | pkg->type);
-	
-	return allocated;
+	update->availableFormats = (update->availableFormats | pkg->type);
 }
 
 static int
-parsePackageAttrMirrors(APackage *pkg, ASetAttributes *attributes, const char *suffix, const char *loc)
+parsePackageAttrMirrors(AArena *arena, APackage *pkg, const AMirrorSet *mirrorSet, const char *suffix, const char *loc)
 {
 	GPtrArray *mirrors;
-	GContainer *mirrorList, *mirrorIDs, *tmp;
-	GIterator iter;
-	gboolean result;
-	char *temp, *prefix;
+	const char *prefix;
+	char *temp;
+	unsigned int i;
 	int total = 0;
 	
 	mirrors = pkg->mirrors;
 	
-	mirrorList = getAttributeList(attributes, "mirror-url");
-	mirrorIDs  = getAttributeList(attributes, "mirror-id");
-	
-	g_assert(mirrorList != NULL);
-	g_assert(mirrorIDs  != NULL);
-	
-	if (mirrorIDs->len > 0)
-	{
-		tmp = parseMirrorIDs(mirrorIDs, attributes);
-		g_container_concat(mirrorList, tmp);
-		g_container_free(tmp, TRUE);
-	}
-
-	
-	if (loc != NULL || suffix != NULL)
+	if (mirrorSet != NULL && (loc != NULL || suffix != NULL))
 	{
-		result = g_container_get_iter(&iter, mirrorList);
-		if (result)
+		for (i = 0; i < mirrorSet->n; ++i)
 		{
-			while (g_iterator_hasNext(&iter))
-			{
-				prefix = g_iterator_next(&iter);
-				g_assert(prefix != NULL);
-				
-				/* We have to be careful not to pass any unintended NULL values
-				   to vstrcreate, because a NULL value tells vstrcreate to terminate
-				   (an unfortunate necessity to deal with C's unsavory handling of a
-				   variable number of arguments) */
-				if (suffix == NULL) /* loc != NULL */
-					temp = lutil_vstrcreate(prefix, "/", loc, NULL);
-				else if (loc == NULL) /* suffix != NULL */
-					temp = lutil_vstrcreate(prefix, "/", suffix, NULL);
-				else /* loc != NULL, suffix != NULL */
-					temp = lutil_vstrcreate(prefix, "/", loc, "/", suffix, NULL);
-				
-				g_ptr_array_add(mirrors, GINT_TO_POINTER (100));
-				g_ptr_array_add(mirrors, temp);
-				total += 100;
-			}
+			prefix = mirrorSet->urls[i];
+			g_assert(prefix != NULL);
+			
+			/* We have to be careful not to pass any unintended NULL values
+			   to strconcat, because a NULL value tells strconcat to terminate
+			   (an unfortunate necessity to deal with C's unsavory handling of a
+			   variable number of arguments) */
+			if (suffix == NULL) /* loc != NULL */
+				temp = luau_arena_strconcat(arena, prefix, "/", loc, NULL);
+			else if (loc == NULL) /* suffix != NULL */
+				temp = luau_arena_strconcat(arena, prefix, "/", suffix, NULL);
+			else /* loc != NULL, suffix != NULL */
+				temp = luau_arena_strconcat(arena, prefix, "/", loc, "/", suffix, NULL);
+			
+			/* Rescaled along with any <mirror>s of the package's own */
+			g_ptr_array_add(mirrors, GINT_TO_POINTER (100));
+			g_ptr_array_add(mirrors, temp);
+			total += 100;
 		}
 	}
 		
-	if (mirrorList->len == 0 && loc != NULL)
+	if (mirrorSet == NULL && loc != NULL)
 	{
 		if (suffix != NULL)
-			temp = lutil_vstrcreate(loc, suffix, NULL);
+			temp = luau_arena_strconcat(arena, loc, suffix, NULL);
 		else
-			temp = g_strdup(loc);
+			temp = luau_arena_strdup(arena, loc);
 		
 		g_ptr_array_add(mirrors, GINT_TO_POINTER (100));
 		g_ptr_array_add(mirrors, temp);
 		total += 100;
 	}
 	
-	g_container_free(mirrorList, TRUE);
-	g_container_free(mirrorIDs, TRUE);
-	
 	return total;
 }
 
 static int
-parsePackageChildMirrors(xmlDocPtr doc, xmlNodePtr node, APackage *pkg, const char *suffix)
+parsePackageChildMirrors(AArena *arena, xmlDocPtr doc, xmlNodePtr node, APackage *pkg, const char *suffix)
 {
 	GPtrArray *mirrors;
-	char *percentage, *loc, *temp;
+	char *percentage, *loc;
 	int i, total;
 	
 	total = 0;
@@ -845,14 +1507,7 @@ parsePackageChildMirrors(xmlDocPtr doc, xmlNodePtr node, APackage *pkg, const ch
 					total += i;
 				}
 				
-				temp = (char*) xmlNodeListGetString(doc, node->xmlChildrenNode, 1);
-				loc = g_strdup(lutil_parse_deleteWhitespace(temp));
-				xmlFree(temp);
-				if (suffix != NULL) {
-					temp = lutil_vstrcreate(loc, suffix, NULL);
-					g_free(loc);
-					loc = temp;
-				}
+				loc = arenaText(arena, doc, node, suffix);
 				g_ptr_array_add(mirrors, loc);
 				
 				DBUGOUT("Mirror location: %s", loc);
@@ -866,39 +1521,145 @@ parsePackageChildMirrors(xmlDocPtr doc, xmlNodePtr node, APackage *pkg, const ch
 	return total;
 }
 
+/* Find the text inside a tag and trim the whitespace around it, without copying it
+   if it's all in one piece (as it nearly always is).  Returns FALSE if the tag has
+   no text at all; otherwise, text->joined must be xmlFree'd once the text is done with. */
+static gboolean
+getTagText(xmlDocPtr doc, xmlNodePtr node, ATagText *text) {
+	xmlNodePtr child = node->xmlChildrenNode;
+	const char *str;
+	
+	text->joined = NULL;
+	if (child != NULL && child->next == NULL && child->content != NULL &&
+	    (child->type == XML_TEXT_NODE || child->type == XML_CDATA_SECTION_NODE)) {
+		str = (const char *) child->content;
+	} else {
+		text->joined = xmlNodeListGetString(doc, child, 1);
+		str = (const char *) text->joined;
+	}
+	
+	if (str == NULL)
+		return FALSE;
+	
+	text->str = luau_text_trim(str, strlen(str), &(text->len));
+	return TRUE;
+}
+
+/* Copy the (trimmed) text inside a tag into an arena, followed by suffix if it isn't
+   NULL; NULL if there's neither */
+static char*
+arenaText(AArena *arena, xmlDocPtr doc, xmlNodePtr node, const char *suffix) {
+	ATagText text;
+	gsize suffixLen;
+	char *copy;
+	
+	if (!getTagText(doc, node, &text)) {
+		if (suffix == NULL)
+			return NULL;
+		text.str = "";
+		text.len = 0;
+	}
+	
+	if (suffix == NULL) {
+		copy = luau_arena_strndup(arena, text.str, text.len);
+	} else {
+		suffixLen = strlen(suffix);
+		copy = luau_arena_alloc(arena, text.len + suffixLen + 1);
+		memcpy(copy, text.str, text.len);
+		memcpy(copy + text.len, suffix, suffixLen + 1);
+	}
+	
+	xmlFree(text.joined);
+	return copy;
+}
+
+/* Intern the (trimmed) text inside a tag into an arena (or NULL if there isn't any) */
+static const char*
+internText(AArena *arena, xmlDocPtr doc, xmlNodePtr node) {
+	ATagText text;
+	const char *shared;
+	
+	if (!getTagText(doc, node, &text))
+		return NULL;
+	
+	shared = luau_arena_internLen(arena, text.str, text.len);
+	xmlFree(text.joined);
+	return shared;
+}
+
+/* Parse the (trimmed) text inside a tag as a date.  Dates are short, so the text is
+   NUL-terminated on the stack rather than copied. */
+static void
+dateText(xmlDocPtr doc, xmlNodePtr node, ADate *date) {
+	ATagText text;
+	char buffer[64];
+	
+	if (!getTagText(doc, node, &text)) {
+		luau_parseDate(date, NULL);
+		return;
+	}
+	
+	if (text.len < sizeof(buffer)) {
+		memcpy(buffer, text.str, text.len);
+		buffer[text.len] = '\0';
+		luau_parseDate(date, buffer);
+	} else {
+		ERROR("Invalid date: %lu characters long", (unsigned long) text.len);
+		luau_parseDate(date, NULL);
+	}
+	
+	xmlFree(text.joined);
+}
+
+/* Copy the (trimmed) text inside a tag (or NULL if there isn't any); must be g_free'd */
+static char*
+dupText(xmlDocPtr doc, xmlNodePtr node) {
+	ATagText text;
+	char *copy;
+	
+	if (!getTagText(doc, node, &text))
+		return NULL;
+	
+	copy = g_strndup(text.str, text.len);
+	xmlFree(text.joined);
+	return copy;
+}
+
 static void
-parseMessage(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
+parseMessage(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
 	/* Nothing to do here!  There are (currently) no XML tags specific to message updates */
 }
 
 static void
-parseLibupdate(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
-	static const char *symbols[ ] = { "set", "s",
-	                                  NULL };
-	char result;
+parseLibupdate(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes) {
+	char result, *temp;
 	
 	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
-		result = lutil_parse_parseSymbolArray((const char *)node->name, symbols);
+		result = libupdateTag(node->name);
 		switch (result) {
 			case 's':
-				currUpdate->newURL = (char*) xmlGetProp(node, "url");
+				if (update->fields != LUAU_FIELDS_FULL)
+					break;
+				temp = (char*) xmlGetProp(node, "url");
+				update->newURL = luau_arena_strdup(update->arena, temp);
+				xmlFree(temp);
 				break;
 		}
 	}
 }
 
 static gboolean
-parseQuantData(void **data, char *str, AQuantDataType quantDataType) {
+parseQuantData(AArena *arena, void **data, char *str, AQuantDataType quantDataType) {
 	gboolean result;
 	
 	if (quantDataType == LUAU_QUANT_DATA_VERSION || quantDataType == LUAU_QUANT_DATA_KEYWORD) {
-		*data = g_strdup(str);
+		*data = (char*) luau_arena_intern(arena, str);
 		result = TRUE;
 	} else if (quantDataType == LUAU_QUANT_DATA_INTERFACE) {
-		*data = g_malloc(sizeof(AInterface));
+		*data = luau_arena_alloc(arena, sizeof(AInterface));
 		result = luau_parseInterface((AInterface*) *data, str);
 	} else if (quantDataType == LUAU_QUANT_DATA_DATE) {
-		*data = g_malloc(sizeof(ADate));
+		*data = luau_arena_alloc(arena, sizeof(ADate));
 		result = luau_parseDate((ADate*) *data, str);
 	} else {
 		ERROR("Internal Error: Unrecognized quantifier data type (%d)", quantDataType);
@@ -909,71 +1670,52 @@ parseQuantData(void **data, char *str, AQuantDataType quantDataType) {
 }
 
 static void
-parsePkgGroup(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes)
+parsePkgGroup(AUpdate *update, xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes)
 {
-	static const char *symbols[ ] = { "package", "p",
-		                              "package-group", "g",
-									  "text", "t",
-									  "comment", "c",
-	                                  NULL };
-	static const char *sing_names[ ] = { "option", "type", "size", "md5", "filename", "version" };
-	static const char *mult_names[ ] = { "mirror-url", "mirror-id" };
-	static const int nSingNames = 6;
-	static const int nMultNames = 2;
-	
-	ASingAttribute *singAttr;
-	AMultAttribute *multAttr;
+	/* In the same order as ASingAttributeID and AMultAttributeID */
+	static const char *sing_names[N_SING_ATTRIBUTES] = { "option", "type", "size", "md5", "filename", "version" };
+	static const char *mult_names[N_MULT_ATTRIBUTES] = { "mirror-url", "mirror-id" };
+	
 	ASetAttributes newAttributes;
-	GContainer *newSingAttributes = g_container_new(GCONT_LIST);
-	GContainer *newMultAttributes = g_container_new(GCONT_LIST);
-	GIterator iter;
 	char  *value, result;
-	const char *name;
 	int i;
 	
-	/* g_list_copy does only a shallow copy, but that's all right.  We do this so that
-	   any new attributes we append on here will not affect the attributes passed in
-	   by the calling function. */
-	copySetAttributes(&newAttributes, attributes, FALSE);
-	/* When we go through and eliminate any malloc'd memory at the end of this function
-	   we need to be sure to -only- eliminate memory we allocated, not anything that
-	   was in the list passed in.  So we keep a pointer to the last attribute given to
-	   us and start with the one after that when we go through to free everything. */
-	/*result = g_container_get_iter_last(&lastOldElement, attributes);
-	if (!result)
-		return;
-	*/
+	/* Anything set here goes into our own copy of the attributes, so it doesn't
+	   affect the attributes passed in by the calling function */
+	copySetAttributes(&newAttributes, attributes);
+	
 	/* Collect any new attributes specified in this package-group tag */
-	for (i = 0; i < nSingNames; ++i) {
-		name = sing_names[i];
-		value = (char*) xmlGetProp(node, name);
+	for (i = 0; i < N_SING_ATTRIBUTES; ++i) {
+		value = (char*) xmlGetProp(node, sing_names[i]);
 		if (value != NULL) {
-			singAttr = setAttributeValue(&newAttributes, name, value);
-			g_container_add(newSingAttributes, singAttr);
+			setAttributeValue(&newAttributes, i, value);
 			xmlFree(value);
 		}
 	}
-	for (i = 0; i < nMultNames; ++i) {
-		name = mult_names[i];
-		value = (char*) xmlGetProp(node, name);
+	for (i = 0; i < N_MULT_ATTRIBUTES; ++i) {
+		value = (char*) xmlGetProp(node, mult_names[i]);
 		if (value != NULL) {
-			multAttr = appendStringToAttributeList(&newAttributes, name, value);
-			g_container_add(newMultAttributes, multAttr);
+			appendStringToAttributeList(&newAttributes, i, value);
 			xmlFree(value);
 		}
 	}
+	/* Worked out once here for all the packages in the group */
+	if (update->fields == LUAU_FIELDS_FULL &&
+	    (newAttributes.multAttributes[ATTR_MIRROR_URL] != attributes->multAttributes[ATTR_MIRROR_URL] ||
+	     newAttributes.multAttributes[ATTR_MIRROR_ID]  != attributes->multAttributes[ATTR_MIRROR_ID]))
+		newAttributes.mirrorSet = resolveMirrorSet(&newAttributes);
 	
 	/* Parse the children elements, passing along any attributes picked up */
 	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
-		result = lutil_parse_parseSymbolArray((const char *)node->name, symbols);
+		result = pkgGroupTag(node->name);
 		
 		switch (result) {
 			case 'p':
-				parsePackage(doc, node, &newAttributes);
+				parsePackage(update, doc, node, &newAttributes);
 				break;
 			
 			case 'g':
-				parsePkgGroup(doc, node, &newAttributes);
+				parsePkgGroup(update, doc, node, &newAttributes);
 				break;
 			
 			case -1:
@@ -983,58 +1725,33 @@ parsePkgGroup(xmlDocPtr doc, xmlNodePtr node, ASetAttributes *attributes)
 		}
 	}
 	
-	/* Remember - we aren't actually freeing the attribute list passed into
-	   the function (that would be a no no!): we're only freeing the -copy-
-	   of those attributes we made at the beginning of this function, along
-	   with any new ones we may've added) */
-	result = g_container_get_iter(&iter, newSingAttributes);
-	if (result)
-	{
-		while (g_iterator_hasNext(&iter))
-		{
-			singAttr = g_iterator_next(&iter);
-			freeSingAttribute(singAttr);
-			//g_free(singAttr);
-		}
-	}
-	g_container_free(newSingAttributes, TRUE);
-	
-	result = g_container_get_iter(&iter, newMultAttributes);
-	if (result)
-	{
-		while (g_iterator_hasNext(&iter))
-		{
-			multAttr = g_iterator_next(&iter);
-			freeMultAttribute(multAttr);
-			//g_free(multAttr);
-		}
-	}
-	g_container_free(newMultAttributes, TRUE);
-	
-	/* A shallow free - again, not actually free'ing the pointers contained
-	   in the list (except for what was done above) */
-	freeSetAttributes(&newAttributes, FALSE);
+	/* Remember - we aren't actually freeing the attributes passed into the
+	   function (that would be a no no!): we're only freeing whatever we added
+	   on top of them */
+	freeSetAttributes(&newAttributes, attributes);
 }
 
-static AMultAttribute *
-appendStringToAttributeList(ASetAttributes *attributes, const char *id, const char *value)
+static void
+appendStringToAttributeList(ASetAttributes *attributes, AMultAttributeID id, const char *value)
 {
-	AMultAttribute *attrs;
-	GContainer *newAttrs;
+	GContainer *newValues;
+	GIterator iter;
+	gboolean result;
 	
 	g_assert(attributes != NULL);
-	g_assert(id != NULL);
 	g_assert(value != NULL);
 	
-	newAttrs = lutil_gsplit(";", value);
+	newValues = lutil_gsplit(";", value);
 	
-	attrs = g_malloc(sizeof(AMultAttribute));
-	attrs->id = g_strdup(id);
-	attrs->values = newAttrs;
-	
-	g_container_add(attributes->multAttributes, attrs);
+	result = g_container_get_iter(&iter, newValues);
+	if (result)
+	{
+		while (g_iterator_hasNext(&iter))
+			attributes->multAttributes[id] = g_slist_prepend(attributes->multAttributes[id], g_iterator_next(&iter));
+	}
 	
-	return attrs;
+	/* The strings themselves now belong to the list */
+	g_container_free(newValues, TRUE);
 }
 /*
 static void
@@ -1099,249 +1816,238 @@ appendAttrToAttributeList(ASetAttributes *attributes, const char *id, ASingAttri
 */
                                                        
 static GContainer *
-getAttributeList(ASetAttributes *attributes, const char *id)
+getAttributeList(ASetAttributes *attributes, AMultAttributeID id)
 {
-	AMultAttribute *attr;
-	GContainer *results, *list;
-	GIterator iter;
-	gboolean result;
+	GContainer *results;
+	GSList *values, *curr;
 	
 	g_assert(attributes != NULL);
-	g_assert(id != NULL);
 	
 	results = g_container_new(GCONT_LIST);
 	
-	result = g_container_get_iter(&iter, attributes->multAttributes);
-	if (!result)
-		return results;
-	
-	while (g_iterator_hasNext(&iter))
-	{
-		attr = g_iterator_next(&iter);
-		g_assert(attr != NULL);
-		
-		if (lutil_streq(id, attr->id))
-		{
-			list = attr->values;
-			g_container_concat(results, list);
-		}
-	}
+	/* The values are kept newest first, but wanted in the order they were given */
+	values = g_slist_reverse(g_slist_copy(attributes->multAttributes[id]));
+	for (curr = values; curr != NULL; curr = curr->next)
+		g_container_add(results, curr->data);
+	g_slist_free(values);
 	
 	return results;
 }
 
-static ASingAttribute *
-setAttributeValue(ASetAttributes *attributes, const char *id, const char *value)
+static void
+setAttributeValue(ASetAttributes *attributes, ASingAttributeID id, const char *value)
 {
-	ASingAttribute *attr;
-	
 	g_assert(attributes != NULL);
-	g_assert(id != NULL);
 	g_assert(value != NULL);
 	
-	attr = g_malloc(sizeof(ASingAttribute));
-	
-	attr->id = g_strdup(id);
-	attr->value = g_strdup(value);
-	g_container_add(attributes->singAttributes, attr);
-	
-	return attr;
+	/* Whatever value was here belongs to an enclosing level, which still needs it */
+	attributes->singAttributes[id] = g_strdup(value);
 }
 
 static char *
-getAttributeString(ASetAttributes *attributes, const char *id)
+getAttributeString(ASetAttributes *attributes, ASingAttributeID id)
 {
-	ASingAttribute *attr;
-	GIterator iter;
-	gboolean result;
-	char *value = NULL;
+	g_assert(attributes != NULL);
+	
+	return attributes->singAttributes[id];
+}
+
+/* Add the URLs of a mirror, or of all the mirrors in a mirror list, to urls */
+static void
+addMirrorURLs(GContainer *urls, const char *id, ASetAttributes *attributes)
+{
+	GSList *defined;
 	
 	g_assert(id != NULL);
 	g_assert(attributes != NULL);
 	
-	result = g_container_get_iter_last(&iter, attributes->singAttributes);
-	while (g_iterator_hasPrev(&iter))
+	defined = g_hash_table_lookup(attributes->definedMirrors, id);
+	if (defined != NULL)
 	{
-		attr = g_iterator_prev(&iter);
-		g_assert(attr != NULL);
-		
-		if (lutil_streq(id, attr->id)) {
-			value = attr->value;
-			break;
-		}
+		for (; defined != NULL; defined = defined->next)
+			g_container_add(urls, defined->data);
+	}
+	else if ( (defined = g_hash_table_lookup(attributes->definedMirrorLists, id)) != NULL )
+	{
+		for (; defined != NULL; defined = defined->next)
+			addMirrorURLs(urls, defined->data, attributes);
+	}
+	else
+	{
+		DBUGOUT("No such mirror ID: %s", id);
 	}
-	
-	return value;
 }
 
-static GContainer *
-parseMirrorIDs(GContainer *ids, ASetAttributes *attributes)
+/* Work out the mirrors the list attributes come to, as a set (with normalized weights)
+   allocated from the file's arena.  Sets are cached by the URLs and IDs that make them
+   up, so each mirror list is only looked up once, however many packages use it */
+static const AMirrorSet*
+resolveMirrorSet(ASetAttributes *attributes)
 {
-	AMirror *mirr;
-	AMirrorList *mirrLst;
-	GContainer *results;
-	GIterator iter1, iter2;
-	gboolean found, result;
-	const char *id;
+	GContainer *urls, *ids;
+	GIterator iter;
+	GString *key;
+	gpointer cached;
+	AMirrorSet *set;
+	const char **setURLs;
+	int *weights;
+	unsigned int i;
+	int sum;
+	float factor;
 	
-	g_assert(ids != NULL);
 	g_assert(attributes != NULL);
 	
-	results = g_container_new(GCONT_LIST);
-	result = g_container_get_iter(&iter1, ids);
+	if (attributes->multAttributes[ATTR_MIRROR_URL] == NULL && attributes->multAttributes[ATTR_MIRROR_ID] == NULL)
+		return NULL;
 	
-	if (!result)
-		return results;
+	urls = getAttributeList(attributes, ATTR_MIRROR_URL);
+	ids  = getAttributeList(attributes, ATTR_MIRROR_ID);
 	
-	while (g_iterator_hasNext(&iter1))
-	{
-		id = g_iterator_next(&iter1);
-		g_assert(id != NULL);
-		found = FALSE;
-		
-		result = g_container_get_iter(&iter2, attributes->definedMirrors);
-		if (!result)
-			return results;
-		
-		while (g_iterator_hasNext(&iter2))
-		{
-			mirr = g_iterator_next(&iter2);
-			g_assert(mirr != NULL);
-
-			if (lutil_streq(id, mirr->id))
-			{
-				g_container_add(results, mirr->url);
-				found = TRUE;
-			}
+	/* Values never contain ';' (they were split on it) */
+	key = g_string_new(NULL);
+	if (g_container_get_iter(&iter, urls)) {
+		while (g_iterator_hasNext(&iter)) {
+			g_string_append(key, g_iterator_next(&iter));
+			g_string_append_c(key, ';');
+		}
+	}
+	g_string_append_c(key, '\n');
+	if (g_container_get_iter(&iter, ids)) {
+		while (g_iterator_hasNext(&iter)) {
+			g_string_append(key, g_iterator_next(&iter));
+			g_string_append_c(key, ';');
 		}
+	}
+	
+	if (g_hash_table_lookup_extended(attributes->resolvedMirrors, key->str, NULL, &cached)) {
+		g_string_free(key, TRUE);
+		g_container_free(urls, TRUE);
+		g_container_free(ids, TRUE);
+		return cached;
+	}
+	
+	if (g_container_get_iter(&iter, ids)) {
+		while (g_iterator_hasNext(&iter))
+			addMirrorURLs(urls, g_iterator_next(&iter), attributes);
+	}
+	
+	if (urls->len == 0) {
+		set = NULL;
+	} else {
+		set = luau_arena_alloc(attributes->arena, sizeof(AMirrorSet));
+		set->n = urls->len;
+		setURLs = luau_arena_alloc(attributes->arena, set->n * sizeof(char*));
+		weights = luau_arena_alloc(attributes->arena, set->n * sizeof(int));
 		
-		if (!found)
-		{
-			result = g_container_get_iter(&iter2, attributes->definedMirrorLists);
-			if (!result)
-				return results;
-			
-			while (g_iterator_hasNext(&iter2))
-			{
-				mirrLst = g_iterator_next(&iter2);
-				g_assert(mirrLst != NULL);
-				
-				if (lutil_streq(id, mirrLst->id))
-				{
-					GContainer *tmp = parseMirrorIDs(mirrLst->mirrors, attributes);
-					g_container_concat(results, tmp);
-					g_container_free(tmp, TRUE);
-					found = TRUE;
-				}
-			}
+		i = 0;
+		g_container_get_iter(&iter, urls);
+		while (g_iterator_hasNext(&iter))
+			setURLs[i++] = luau_arena_intern(attributes->arena, g_iterator_next(&iter));
+		
+		/* Every mirror gets the same share, the last one taking up whatever the
+		   rounding leaves over */
+		factor = ((float)100 / (100 * set->n));
+		sum = 0;
+		for (i = 0; i < set->n; ++i) {
+			if (set->n == 1)
+				weights[i] = 100;
+			else if (i+1 == set->n)
+				weights[i] = 100 - sum;
+			else
+				weights[i] = (int) (100*factor);
+			sum += weights[i];
 		}
 		
-		if (!found)
-			DBUGOUT("No such mirror ID: %s", id);
+		set->urls = setURLs;
+		set->weights = weights;
 	}
 	
-	return results;
+	g_hash_table_insert(attributes->resolvedMirrors, g_string_free(key, FALSE), set);
+	g_container_free(urls, TRUE);
+	g_container_free(ids, TRUE);
+	
+	return set;
 }
-				
-static void
-initializeSetAttributes(ASetAttributes *attributes)
+
+/* Whether a <package> lists any <mirror>s of its own */
+static gboolean
+hasChildMirrors(xmlNodePtr node)
 {
-	attributes->definedMirrorLists = g_container_new(GCONT_LIST);
-	attributes->definedMirrors = g_container_new(GCONT_LIST);
-	attributes->singAttributes = g_container_new(GCONT_LIST);
-	attributes->multAttributes = g_container_new(GCONT_LIST);
+	for (node = node->xmlChildrenNode; node != NULL; node = node->next) {
+		if (lutil_streq(node->name, "mirror"))
+			return TRUE;
+	}
+	
+	return FALSE;
 }
 
 static void
-copySetAttributes(ASetAttributes *newSet, ASetAttributes *attributes, gboolean deepCopy)
+initializeSetAttributes(ASetAttributes *attributes, AArena *arena)
 {
-	if (deepCopy)
-		ERROR("ASetAttributes deep copy not supported");
+	int i;
 	
+	attributes->arena = arena;
+	attributes->definedMirrors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, freeStringList);
+	attributes->definedMirrorLists = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, freeStringList);
+	attributes->resolvedMirrors = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	attributes->versionKeys = g_hash_table_new(g_direct_hash, g_direct_equal);
+	attributes->mirrorSet = NULL;
+	for (i = 0; i < N_SING_ATTRIBUTES; ++i)
+		attributes->singAttributes[i] = NULL;
+	for (i = 0; i < N_MULT_ATTRIBUTES; ++i)
+		attributes->multAttributes[i] = NULL;
+}
+
+/* Start a new level of attributes, inheriting everything from the enclosing one */
+static void
+copySetAttributes(ASetAttributes *newSet, const ASetAttributes *attributes)
+{
 	g_assert(attributes != NULL);
 	
-	newSet->multAttributes = g_container_dup(attributes->multAttributes);
-	newSet->singAttributes = g_container_dup(attributes->singAttributes);
-	newSet->definedMirrors = g_container_dup(attributes->definedMirrors);
-	newSet->definedMirrorLists = g_container_dup(attributes->definedMirrorLists);
+	*newSet = *attributes;
 }
 
+/* Free whatever was added to a set of attributes since it was copied from enclosing,
+   or everything (mirror definitions included) if enclosing is NULL */
 static void
-freeSetAttributes(ASetAttributes *attributes, gboolean deepFree)
+freeSetAttributes(ASetAttributes *attributes, const ASetAttributes *enclosing)
 {
+	GSList *inherited;
+	int i;
+	
 	g_assert(attributes != NULL);
-
-	if (deepFree)
+	
+	for (i = 0; i < N_SING_ATTRIBUTES; ++i)
 	{
-		AMultAttribute *attrs;
-		ASingAttribute *attr;
-		GIterator iter;
-		gboolean result;
-		
-		result = g_container_get_iter(&iter, attributes->multAttributes);
-		if (result)
-		{
-			while (g_iterator_hasNext(&iter))
-			{
-				attrs = g_iterator_next(&iter);
-				freeMultAttribute(attrs);
-			}
-		}
-		
-		result = g_container_get_iter(&iter, attributes->singAttributes);
-		if (result)
-		{
-			while (g_iterator_hasNext(&iter))
-			{
-				attr = g_iterator_next(&iter);
-				freeSingAttribute(attr);
-			}
-		}
-		
-		result = g_container_get_iter(&iter, attributes->definedMirrors);
-		if (result)
-		{
-			while (g_iterator_hasNext(&iter))
-			{
-				attr = g_iterator_next(&iter);
-				freeSingAttribute(attr);
-			}
-		}
-		
-		result = g_container_get_iter(&iter, attributes->definedMirrorLists);
-		if (result)
+		if (enclosing == NULL || attributes->singAttributes[i] != enclosing->singAttributes[i])
+			g_free(attributes->singAttributes[i]);
+	}
+	
+	for (i = 0; i < N_MULT_ATTRIBUTES; ++i)
+	{
+		inherited = (enclosing != NULL) ? enclosing->multAttributes[i] : NULL;
+		while (attributes->multAttributes[i] != inherited)
 		{
-			while (g_iterator_hasNext(&iter))
-			{
-				attrs = g_iterator_next(&iter);
-				freeMultAttribute(attrs);
-			}
+			g_free(attributes->multAttributes[i]->data);
+			attributes->multAttributes[i] = g_slist_delete_link(attributes->multAttributes[i], attributes->multAttributes[i]);
 		}
 	}
 	
-	g_container_free(attributes->multAttributes, TRUE);
-	g_container_free(attributes->singAttributes, TRUE);
-	g_container_free(attributes->definedMirrors, TRUE);
-	g_container_free(attributes->definedMirrorLists, TRUE);
-}
-
-static void
-freeSingAttribute(ASingAttribute *attr)
-{
-	g_assert(attr != NULL);
-	
-	g_free(attr->id);
-	g_free(attr->value);
-	g_free(attr);
+	if (enclosing == NULL)
+	{
+		g_hash_table_destroy(attributes->definedMirrors);
+		g_hash_table_destroy(attributes->definedMirrorLists);
+		g_hash_table_destroy(attributes->resolvedMirrors);
+		g_hash_table_destroy(attributes->versionKeys);
+	}
 }
 
 static void
-freeMultAttribute(AMultAttribute *attrs)
+freeStringList(gpointer list)
 {
-	g_assert(attrs != NULL);
-	g_assert(attrs->values != NULL);
+	GSList *curr;
 	
-	g_container_destroy(attrs->values);
-	g_free(attrs->id);
-	g_free(attrs);
+	for (curr = list; curr != NULL; curr = curr->next)
+		g_free(curr->data);
+	g_slist_free(list);
 }
@@ -0,0 +1,192 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "textscan.h"
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define SCAN_SSE2
+#endif
+
+#ifdef WITH_DMALLOC
+#  include <dmalloc.h>
+#endif
+
+#define IS_SPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\n' || (c) == '\r')
+
+#if defined(SCAN_AVX2) || defined(SCAN_SSE2)
+
+#  ifdef SCAN_AVX2
+/// Bytes looked at in one go
+#    define SCAN_WIDTH 32
+#  else
+#    define SCAN_WIDTH 16
+#  endif
+
+/// A mask with a bit set for each byte looked at in one go
+#  define SCAN_ALL ((guint32) (((guint64) 1 << SCAN_WIDTH) - 1))
+
+static guint32 spaceMask(const char *p);
+static int lowestBit (guint32 mask);
+static int highestBit(guint32 mask);
+
+#endif /* SCAN_AVX2 || SCAN_SSE2 */
+
+
+/**
+ * Skip over the whitespace at the start of a string.
+ *
+ * @arg <i>str</i> is the start of the string.
+ * @arg <i>end</i> is the end of the string (it needn't be NUL-terminated).
+ * @return the first character that isn't whitespace, or \c end if they all are
+ */
+const char *
+luau_text_skipSpace(const char *str, const char *end) {
+#ifdef SCAN_WIDTH
+	guint32 mask;
+	
+	for (; end - str >= SCAN_WIDTH; str += SCAN_WIDTH) {
+		mask = ~spaceMask(str) & SCAN_ALL;
+		if (mask != 0)
+			return str + lowestBit(mask);
+	}
+#endif
+	
+	while (str < end && IS_SPACE(*str))
+		++str;
+	
+	return str;
+}
+
+/**
+ * Find where a string ends once the whitespace at its end is left off.
+ *
+ * @arg <i>str</i> is the start of the string.
+ * @arg <i>end</i> is the end of the string (it needn't be NUL-terminated).
+ * @return the character after the last one that isn't whitespace, or \c str if
+ *         they all are
+ */
+const char *
+luau_text_trimEnd(const char *str, const char *end) {
+#ifdef SCAN_WIDTH
+	guint32 mask;
+	
+	for (; end - str >= SCAN_WIDTH; end -= SCAN_WIDTH) {
+		mask = ~spaceMask(end - SCAN_WIDTH) & SCAN_ALL;
+		if (mask != 0)
+			return end - SCAN_WIDTH + highestBit(mask) + 1;
+	}
+#endif
+	
+	while (end > str && IS_SPACE(end[-1]))
+		--end;
+	
+	return end;
+}
+
+/**
+ * Find the part of a string left once the whitespace at each end of it is
+ * trimmed off (like lutil_parse_deleteWhitespace, but without changing the
+ * string: the result is a view into it).
+ *
+ * @arg <i>str</i> is the string.
+ * @arg <i>len</i> is the length of \c str (it needn't be NUL-terminated).
+ * @arg <i>trimmedLen</i> is set to the length of the trimmed part.
+ * @return the start of the trimmed part of \c str
+ */
+const char *
+luau_text_trim(const char *str, gsize len, gsize *trimmedLen) {
+	const char *start;
+	
+	start = luau_text_skipSpace(str, str + len);
+	*trimmedLen = luau_text_trimEnd(start, str + len) - start;
+	
+	return start;
+}
+
+/* Non-Interface Methods */
+
+#ifdef SCAN_WIDTH
+
+/* A mask with a bit set for each of the SCAN_WIDTH bytes at p which is whitespace */
+static guint32
+spaceMask(const char *p) {
+#  ifdef SCAN_AVX2
+	__m256i bytes, space;
+	
+	bytes = _mm256_loadu_si256((const __m256i *) p);
+	space = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')),
+	                                        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\t'))),
+	                        _mm256_or_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')),
+	                                        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\r'))));
+	
+	return (guint32) _mm256_movemask_epi8(space);
+#  else
+	__m128i bytes, space;
+	
+	bytes = _mm_loadu_si128((const __m128i *) p);
+	space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')),
+	                                  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\t'))),
+	                     _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')),
+	                                  _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\r'))));
+	
+	return (guint32) _mm_movemask_epi8(space);
+#  endif
+}
+
+/* The position of the lowest bit set in a (non-zero) mask */
+static int
+lowestBit(guint32 mask) {
+#  ifdef __GNUC__
+	return __builtin_ctz(mask);
+#  else
+	int i = 0;
+	
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++i;
+	}
+	return i;
+#  endif
+}
+
+/* The position of the highest bit set in a (non-zero) mask */
+static int
+highestBit(guint32 mask) {
+#  ifdef __GNUC__
+	return 31 - __builtin_clz(mask);
+#  else
+	int i = 0;
+	
+	while (mask >>= 1)
+		++i;
+	return i;
+#  endif
+}
+
+#endif /* SCAN_WIDTH */
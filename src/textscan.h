@@ -0,0 +1,49 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+/** @file textscan.h
+ * \brief Fast scanning of the text in repository files
+ *
+ * Nearly all the text the parser keeps (descriptions above all) has whitespace
+ * around it, left by the indentation of the file.  These find the part of a
+ * string inside that whitespace without changing or copying the string, so that
+ * it can then be copied exactly once, straight to where it's kept.  Where the
+ * compiler targets SSE2 or AVX2, the string is looked through 16 or 32 bytes at
+ * a time.
+ *
+ * Whitespace is what XML takes it to be: spaces, tabs, newlines and carriage returns.
+ */
+
+#ifndef TEXTSCAN_H
+#define TEXTSCAN_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+
+/// Find the first character between \c str and \c end that isn't whitespace (or \c end)
+const char* luau_text_skipSpace(const char *str, const char *end);
+/// Find where the string from \c str to \c end ends once whitespace is trimmed off its end
+const char* luau_text_trimEnd(const char *str, const char *end);
+/// Find the part of a string left once the whitespace around it is trimmed off
+const char* luau_text_trim(const char *str, gsize len, gsize *trimmedLen);
+
+#endif /* TEXTSCAN_H */
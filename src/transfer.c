@@ -0,0 +1,181 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+#include <curl/curl.h>
+
+#include "transfer.h"
+#include "util.h"
+
+static CURLSH *share = NULL;
+static GPtrArray *idleHandles = NULL;
+
+G_LOCK_DEFINE_STATIC(transferPool);
+
+/* curl wants a separate lock for each kind of shared data */
+G_LOCK_DEFINE_STATIC(shareData);
+G_LOCK_DEFINE_STATIC(shareDNS);
+G_LOCK_DEFINE_STATIC(shareSSLSession);
+#if LIBCURL_VERSION_NUM >= 0x073900
+G_LOCK_DEFINE_STATIC(shareConnect);
+#endif
+G_LOCK_DEFINE_STATIC(shareOther);
+
+static void initShare(void);
+static void lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+static void unlockShare(CURL *handle, curl_lock_data data, void *userptr);
+
+/**
+ * Get a curl handle for a transfer.  The handle is either a fresh one or one which
+ * has been used before (and reset to the default options), so any connection it
+ * still has open can be reused.  Either way it is attached to the shared DNS,
+ * connection and TLS session caches.  Give the handle back with
+ * \ref luau_transfer_release rather than cleaning it up.
+ *
+ * @return a curl easy handle
+ */
+CURL *
+luau_transfer_acquire(void) {
+	CURL *handle = NULL;
+	
+	G_LOCK(transferPool);
+	if (share == NULL)
+		initShare();
+	if (idleHandles->len > 0)
+		handle = g_ptr_array_remove_index_fast(idleHandles, idleHandles->len-1);
+	G_UNLOCK(transferPool);
+	
+	if (handle != NULL)
+		curl_easy_reset(handle);
+	else
+		handle = curl_easy_init();
+	
+	if (handle != NULL)
+		curl_easy_setopt(handle, CURLOPT_SHARE, share);
+	
+	return handle;
+}
+
+/**
+ * Give back a handle obtained from \ref luau_transfer_acquire once its transfer is
+ * finished (and it has been removed from any multi handle).
+ *
+ * @arg <i>handle</i> is the handle to give back.
+ */
+void
+luau_transfer_release(CURL *handle) {
+	if (handle == NULL)
+		return;
+	
+	G_LOCK(transferPool);
+	if (idleHandles != NULL && idleHandles->len < TRANSFER_MAX_IDLE_HANDLES) {
+		g_ptr_array_add(idleHandles, handle);
+		handle = NULL;
+	}
+	G_UNLOCK(transferPool);
+	
+	if (handle != NULL)
+		curl_easy_cleanup(handle);
+}
+
+/**
+ * Clean up all of the idle handles and the shared caches.  Handles which are still
+ * in use must not be used afterwards.
+ */
+void
+luau_transfer_cleanup(void) {
+	unsigned int i;
+	
+	G_LOCK(transferPool);
+	if (share != NULL) {
+		for (i = 0; i < idleHandles->len; ++i)
+			curl_easy_cleanup(g_ptr_array_index(idleHandles, i));
+		g_ptr_array_free(idleHandles, TRUE);
+		idleHandles = NULL;
+		
+		curl_share_cleanup(share);
+		share = NULL;
+	}
+	G_UNLOCK(transferPool);
+}
+
+
+/* Create the share object (called with the pool lock held) */
+static void
+initShare(void) {
+	share = curl_share_init();
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, lockShare);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, unlockShare);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	/* Older versions keep connections with each handle, which is why handles are reused */
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+	
+	idleHandles = g_ptr_array_new();
+}
+
+static void
+lockShare(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr) {
+	switch (data) {
+		case CURL_LOCK_DATA_SHARE:
+			G_LOCK(shareData);
+			break;
+		case CURL_LOCK_DATA_DNS:
+			G_LOCK(shareDNS);
+			break;
+		case CURL_LOCK_DATA_SSL_SESSION:
+			G_LOCK(shareSSLSession);
+			break;
+#if LIBCURL_VERSION_NUM >= 0x073900
+		case CURL_LOCK_DATA_CONNECT:
+			G_LOCK(shareConnect);
+			break;
+#endif
+		default:
+			G_LOCK(shareOther);
+	}
+}
+
+static void
+unlockShare(CURL *handle, curl_lock_data data, void *userptr) {
+	switch (data) {
+		case CURL_LOCK_DATA_SHARE:
+			G_UNLOCK(shareData);
+			break;
+		case CURL_LOCK_DATA_DNS:
+			G_UNLOCK(shareDNS);
+			break;
+		case CURL_LOCK_DATA_SSL_SESSION:
+			G_UNLOCK(shareSSLSession);
+			break;
+#if LIBCURL_VERSION_NUM >= 0x073900
+		case CURL_LOCK_DATA_CONNECT:
+			G_UNLOCK(shareConnect);
+			break;
+#endif
+		default:
+			G_UNLOCK(shareOther);
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+/** @file transfer.h
+ * \brief Process-wide curl transfer engine
+ *
+ * Hands out curl easy handles which all use a single curl share object, so that
+ * DNS lookups, open connections and TLS sessions are reused between transfers
+ * (eg. when checking many programs hosted on the same server).  Released handles
+ * are kept for reuse rather than being cleaned up.
+ */
+
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <curl/curl.h>
+
+/// Maximum number of idle handles kept for reuse
+#define TRANSFER_MAX_IDLE_HANDLES 8
+
+/// Get a curl handle (with all options at their defaults) attached to the shared caches
+CURL* luau_transfer_acquire(void);
+/// Give a handle back once its transfer is finished
+void luau_transfer_release(CURL *handle);
+/// Clean up all idle handles and the shared caches
+void luau_transfer_cleanup(void);
+
+#endif /* TRANSFER_H */
@@ -0,0 +1,405 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include <glib.h>
+
+#include "libuau.h"
+#include "versionkey.h"
+#include "util.h"
+
+#ifdef WITH_DMALLOC
+#  include <dmalloc.h>
+#endif
+
+/// The characters a version string is split up at
+#define IS_SEPARATOR(c) ((c) == '.' || (c) == '-' || (c) == '_' || (c) == '/' || (c) == '+' || (c) == '\\')
+
+/// What a segment of a version is compared as
+typedef enum {
+	SEGMENT_NUMBER,
+	SEGMENT_ALPHA,
+	/// An "x", which matches any segment (and anything after it)
+	SEGMENT_WILDCARD
+} ASegmentKind;
+
+/// One segment of a version
+typedef struct {
+	/// The segment's text (lowercased, and NUL-terminated within the key)
+	const char *text;
+	/// Value of a SEGMENT_NUMBER
+	int value;
+	ASegmentKind kind;
+} AVersionSegment;
+
+/* A key is one block: this header, then the segments, then the text they point into */
+struct _AVersionKey {
+	/// Length of the version string the key was built from (and so of its text)
+	gsize length;
+	/// Number of segments
+	unsigned int n;
+};
+
+#define SEGMENTS(key) ((AVersionSegment *) ((char *) (key) + sizeof(AVersionKey)))
+/// The version's text, lowercased and with a NUL in place of each separator
+#define TEXT(key)     ((char *) (SEGMENTS(key) + (key)->n))
+
+static unsigned int countSegments(const char *version);
+static gboolean keyMatches(const AVersionKey *key, const char *version);
+static int compareAlphaNumeric(const char *v1, const char *v2);
+
+/**
+ * Split up a version string once, so that it can be compared again and again with
+ * \ref luau_versionkey_cmp without any more work.
+ *
+ * @arg version is the version string (NULL is taken as "").
+ * @return the key, which must be free'd with g_free.  The key holds its own copy of
+ *         everything it needs, so \c version needn't outlive it.
+ */
+AVersionKey *
+luau_versionkey_new(const char *version) {
+	return luau_versionkey_build(g_malloc(luau_versionkey_size(version)), version);
+}
+
+/**
+ * Compare two versions split up by \ref luau_versionkey_new, with the same result
+ * as \ref luau_versioncmp comparing the strings they were built from.
+ *
+ * @arg required is the key of the required version.
+ * @arg current is the key of the current version.
+ * @return 1 if \c required is more recent than \c current, -1 if it's less recent,
+ *         or 0 if they're the same (or match because of a wildcard).
+ */
+int
+luau_versionkey_cmp(const AVersionKey *required, const AVersionKey *current) {
+	const AVersionSegment *req, *cur;
+	unsigned int i, max;
+	int result = 0;
+	
+	max = MAX(required->n, current->n);
+	for (i = 0; i < max; ++i) {
+		req = (i < required->n) ? &SEGMENTS(required)[i] : NULL;
+		cur = (i < current->n)  ? &SEGMENTS(current)[i]  : NULL;
+		
+		/* special case: if wildcard in either segment then they are "equal" */
+		if ((req != NULL && req->kind == SEGMENT_WILDCARD) || (cur != NULL && cur->kind == SEGMENT_WILDCARD)) {
+			result = 0;
+			break;
+		}
+		
+		if ((req != NULL && req->kind == SEGMENT_ALPHA) || (cur != NULL && cur->kind == SEGMENT_ALPHA)) {
+			result = compareAlphaNumeric((req != NULL) ? req->text : NULL, (cur != NULL) ? cur->text : NULL);
+			
+			if (result != 0)
+				break;
+		} else if (req == NULL) {
+			result = -1;
+			break;
+		} else if (cur == NULL) {
+			result = 1;
+			break;
+		} else if (req->value != cur->value) {
+			result = (req->value < cur->value) ? -1 : 1;
+			break;
+		}
+	}
+	
+	return result;
+}
+
+/**
+ * Work out how much memory the key of a version string takes, for building it
+ * somewhere other than with \ref luau_versionkey_new (in an arena, say).
+ *
+ * @arg version is the version string (NULL is taken as "").
+ * @return the size of its key, in bytes.
+ */
+gsize
+luau_versionkey_size(const char *version) {
+	if (version == NULL)
+		version = "";
+	
+	return sizeof(AVersionKey) + countSegments(version) * sizeof(AVersionSegment) + strlen(version) + 1;
+}
+
+/**
+ * Build the key of a version string in memory the caller has set aside for it.
+ *
+ * @arg mem is where to build the key: \ref luau_versionkey_size bytes, aligned
+ *      for a pointer.
+ * @arg version is the version string (NULL is taken as "").
+ * @return the key (that is, \c mem).
+ */
+AVersionKey *
+luau_versionkey_build(gpointer mem, const char *version) {
+	AVersionKey *key = mem;
+	AVersionSegment *segment;
+	char *text, *end;
+	gsize i;
+	
+	if (version == NULL)
+		version = "";
+	key->n = countSegments(version);
+	
+	/* Lowercased, with each separator turned into a NUL to end the segment before it */
+	text = TEXT(key);
+	for (i = 0; version[i] != '\0'; ++i)
+		text[i] = IS_SEPARATOR(version[i]) ? '\0' : g_ascii_tolower(version[i]);
+	text[i] = '\0';
+	key->length = i;
+	end = text + i;
+	
+	/* Empty segments (between separators that come one after the other) don't count */
+	segment = SEGMENTS(key);
+	while (text < end) {
+		if (*text == '\0') {
+			++text;
+			continue;
+		}
+		
+		segment->text = text;
+		segment->value = 0;
+		if (text[0] == 'x' && text[1] == '\0')
+			segment->kind = SEGMENT_WILDCARD;
+		else if (lutil_containsAlpha(text))
+			segment->kind = SEGMENT_ALPHA;
+		else {
+			segment->kind = SEGMENT_NUMBER;
+			segment->value = atoi(text);
+		}
+		
+		text += strlen(text);
+		++segment;
+	}
+	
+	return key;
+}
+
+/**
+ * Build the key of a version string in a buffer (usually on the stack), so that it
+ * needn't be allocated; only a version too long to fit is given memory of its own.
+ *
+ * @arg buffer is where to build the key, if it fits.
+ * @arg version is the version string (NULL is taken as "").
+ * @return the key, which must be handed to \ref luau_versionkey_release along with
+ *         \c buffer once it's no longer needed.
+ */
+AVersionKey *
+luau_versionkey_buildIn(AVersionKeyBuffer *buffer, const char *version) {
+	gsize size = luau_versionkey_size(version);
+	
+	return luau_versionkey_build((size <= sizeof(buffer->bytes)) ? buffer->bytes : g_malloc(size), version);
+}
+
+void
+luau_versionkey_release(AVersionKeyBuffer *buffer, AVersionKey *key) {
+	if ((gpointer) key != (gpointer) buffer->bytes)
+		g_free(key);
+}
+
+/**
+ * Compare two version strings like \ref luau_versioncmp, using the keys already
+ * built for them where there are any.  A key is only used if it matches the string
+ * it comes with (see versionkey.h); otherwise one is built on the spot, without
+ * allocating anything for any ordinary version.
+ *
+ * @arg required is the required version.
+ * @arg requiredKey is the key built for \c required (or NULL).
+ * @arg current is the current version.
+ * @arg currentKey is the key built for \c current (or NULL).
+ * @return the same as \ref luau_versioncmp.
+ */
+int
+luau_versionkey_cmpCached(const char *required, const AVersionKey *requiredKey,
+                          const char *current, const AVersionKey *currentKey) {
+	AVersionKeyBuffer reqBuffer, curBuffer;
+	AVersionKey *reqBuilt = NULL, *curBuilt = NULL;
+	int result;
+	
+	if (requiredKey == NULL || !keyMatches(requiredKey, required))
+		requiredKey = reqBuilt = luau_versionkey_buildIn(&reqBuffer, required);
+	if (currentKey == NULL || !keyMatches(currentKey, current))
+		currentKey = curBuilt = luau_versionkey_buildIn(&curBuffer, current);
+	
+	result = luau_versionkey_cmp(requiredKey, currentKey);
+	
+	if (reqBuilt != NULL)
+		luau_versionkey_release(&reqBuffer, reqBuilt);
+	if (curBuilt != NULL)
+		luau_versionkey_release(&curBuffer, curBuilt);
+	
+	return result;
+}
+
+/**
+ * Find the most recent version of any of a set of packages, using the keys built
+ * for the packages' versions.
+ *
+ * @arg packages is an array of APackage structs (or NULL).
+ * @arg key is set to the key of the version found (NULL if there isn't one).
+ * @return the version (belonging to its package), or "0" if no package has one.
+ */
+const char *
+luau_versionkey_mostRecent(const GPtrArray *packages, const AVersionKey **key) {
+	const APackage *pkg;
+	const char *mostRecent = "0";
+	unsigned int i;
+	
+	*key = NULL;
+	for (i = 0; packages != NULL && i < packages->len; ++i) {
+		pkg = g_ptr_array_index(packages, i);
+		if (pkg->version != NULL && luau_versionkey_cmpCached(pkg->version, pkg->versionKey, mostRecent, *key) > 0) {
+			mostRecent = pkg->version;
+			*key = pkg->versionKey;
+		}
+	}
+	
+	return mostRecent;
+}
+
+
+/* Non-Interface Methods */
+
+/* Check that \c key is the key of \c version.  Only the key's text needs checking,
+   since the segments follow from it; a version that differs from the one the key was
+   built from only in case or separators compares the same, so it may use the key too. */
+static gboolean
+keyMatches(const AVersionKey *key, const char *version) {
+	const char *text = TEXT(key);
+	gsize i;
+	
+	if (version == NULL)
+		version = "";
+	
+	for (i = 0; i < key->length; ++i) {
+		if (version[i] == '\0' || text[i] != (IS_SEPARATOR(version[i]) ? '\0' : g_ascii_tolower(version[i])))
+			return FALSE;
+	}
+	
+	return (version[i] == '\0');
+}
+
+static unsigned int
+countSegments(const char *version) {
+	unsigned int n = 0;
+	gboolean inSegment = FALSE;
+	
+	for (; *version != '\0'; ++version) {
+		if (IS_SEPARATOR(*version))
+			inSegment = FALSE;
+		else if (!inSegment) {
+			inSegment = TRUE;
+			++n;
+		}
+	}
+	
+	return n;
+}
+
+/* compareAlphaNumeric <VERSION1> <VERSION2>
+ * Returns: 1 or 0.
+ *
+ * Compare two strings and return 1 if VERSION1 > VERSION2, otherwise 0.
+ * Otherwise, gathers digits forward to compare full numbers.
+ */
+
+static int
+compareAlphaNumeric(const char *v1, const char *v2) {
+	int i, len1, len2, limit, result = 0;
+	
+	if (v1 == NULL)
+		v1 = "";
+	if (v2 == NULL)
+		v2 = "";
+	
+	/* get length of the longest string to index with over as $limit */
+	len1 = strlen(v1);
+	len2 = strlen(v2);
+	if (len1 > len2)
+		limit = len1;
+	else
+		limit = len2;
+	
+	for (i = 0; i < limit; ++i) {
+		char char1, char2;
+		int val1, val2;
+		
+		/* compare character by character indexing up the string */
+		if (i < len1)
+			char1 = v1[i];
+		else
+			char1 = '\0';
+		
+		if (i < len2)
+			char2 = v2[i];
+		else
+			char2 = '\0';
+		
+		/* special case: point release is higher than alphabetic release
+		 * example: REQUIRED 2.5-pre3 < CURRENT 2.5 or REQUIRED alpha-char < CURRENT no char */
+		if (! isdigit(char1) && char2 == '\0')
+			return -1;
+
+		/* look forward to find next index digit to complete the full number (past the
+		 * end of the shorter string, char1 or char2 is all there is to look at) */
+		if (isdigit(char1))
+			val1 = atoi(v1 + i);
+		else if (char1 == '\0')
+			val1 = 0;
+		else
+			val1 = -1;
+		
+		if (isdigit(char2))
+			val2 = atoi(v2 + i);
+		else if (char2 == '\0')
+			val2 = 0;
+		else
+			val2 = -1;
+
+		/* if comparing numbers do an integer compare - otherwise do a string compare */
+		if (val1 != -1 || val2 != -1) {
+			if (val1 > val2) {
+				result = 1;
+				break;
+			} else if (val1 < val2) {
+				result = -1;
+				break;
+			} else if (val1 >= 10) {
+				/* Skip over digits of number we just checked */
+				i += (int)log10(val1);
+			}
+		} else if (char1 < char2) {
+			result = -1;
+			break;
+		} else if (char1 > char2) {
+			result = 1;
+			break;
+		}
+	}
+	
+	return result;
+}
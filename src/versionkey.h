@@ -0,0 +1,70 @@
+/*
+ * luau (Lib Update/Auto-Update): Simple Update Library
+ * Copyright (C) 2003  David Eklund
+ *
+ * - This library is free software; you can redistribute it and/or             -
+ * - modify it under the terms of the GNU Lesser General Public                -
+ * - License as published by the Free Software Foundation; either              -
+ * - version 2.1 of the License, or (at your option) any later version.        -
+ * -                                                                           -
+ * - This library is distributed in the hope that it will be useful,           -
+ * - but WITHOUT ANY WARRANTY; without even the implied warranty of            -
+ * - MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU         -
+ * - Lesser General Public License for more details.                           -
+ * -                                                                           -
+ * - You should have received a copy of the GNU Lesser General Public          -
+ * - License along with this library; if not, write to the Free Software       -
+ * - Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA -
+ */
+
+
+/** @file versionkey.h
+ * \brief Version strings split up once, for comparing again and again
+ *
+ * Comparing two version strings (see \ref luau_versioncmp) means lowercasing them
+ * and splitting them into segments at each '.', '-', '_', '/', '+' or '\\', then
+ * comparing the segments one by one.  A version key is a string that's already
+ * been through all that, held in a single block of memory, so that comparing
+ * keys takes nothing more than a walk along their segments.  The parser builds
+ * the keys of the versions it reads in as it goes, and each check for updates
+ * builds the keys of the installed versions once for all the updates.
+ *
+ * \ref luau_versionkey_cmpCached checks each key against the string it comes with
+ * (a walk along the string, which is still much less work than splitting it up),
+ * so a key left behind when a caller replaces the string it came from is never
+ * used for the new one, even if the new string ends up at the same address.
+ */
+
+#ifndef VERSIONKEY_H
+#define VERSIONKEY_H
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include <glib.h>
+
+#include "libuau.h"
+
+/// Room for the key of any ordinary version string, so it can be built without allocating
+typedef union {
+	char bytes[256];
+	gpointer alignment;
+} AVersionKeyBuffer;
+
+/// How many bytes the key of \c version takes
+gsize luau_versionkey_size(const char *version);
+/// Build the key of \c version in \c mem (\ref luau_versionkey_size bytes, aligned for a pointer)
+AVersionKey* luau_versionkey_build(gpointer mem, const char *version);
+/// Build the key of \c version in \c buffer, or in memory of its own if it doesn't fit there
+AVersionKey* luau_versionkey_buildIn(AVersionKeyBuffer *buffer, const char *version);
+/// Free a key built by \ref luau_versionkey_buildIn (if it didn't fit in \c buffer)
+void luau_versionkey_release(AVersionKeyBuffer *buffer, AVersionKey *key);
+
+/// Compare two versions like \ref luau_versioncmp, using the key built for either one (or NULL)
+int luau_versionkey_cmpCached(const char *required, const AVersionKey *requiredKey,
+                              const char *current, const AVersionKey *currentKey);
+/// The most recent version of any of \c packages (see \ref luau_getMostRecentPkgVersion), and its key
+const char* luau_versionkey_mostRecent(const GPtrArray *packages, const AVersionKey **key);
+
+#endif /* VERSIONKEY_H */
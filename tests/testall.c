@@ -22,13 +22,27 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 
 #include <glib.h>
+#ifdef HAVE_LIBZ
+#  include <zlib.h>
+#endif
+#ifdef HAVE_LIBLZMA
+#  include <lzma.h>
+#endif
+#ifdef HAVE_LIBZSTD
+#  include <zstd.h>
+#endif
 
 #include "libuau.h"
 #include "test.h"
 #include "util.h"
 #include "gcontainer.h"
+#include "parseupdates.h"
+#include "codec.h"
+#include "versionkey.h"
+#include "textscan.h"
 
 #ifdef WITH_LEAKBUG
 #  include <leakbug.h>
@@ -44,9 +58,40 @@ static gboolean testInterfaceCompat(void);
 static gboolean testToString(void);
 static gboolean testFromString(void);
 static gboolean testGContainer(void);
+static gboolean testCodecs(void);
+static gboolean testParseThreads(void);
+static gboolean testUpdateFilter(void);
+static gboolean testBestUpdates(void);
+static gboolean testTextTrim(void);
 
 static ADate* setDate(ADate *date, int month, int day, int year);
 static AInterface* setInterf(AInterface *interf, int major, int minor);
+static int versionKeyCmp(const char *required, const char *current);
+static int staleKeyCmp(const char *built, const char *required, const char *current);
+static gboolean testConcatenated(const char *name, const GString *body);
+static gboolean appendDecoded(const char *data, gsize len, gpointer userData, GError **err);
+static GString* makeRepository(int count);
+static gpointer parseRepository(gpointer reference);
+static gboolean sameString(const char *str1, const char *str2);
+static gboolean samePackage(const APackage *pkg1, const APackage *pkg2);
+static gboolean sameUpdate(const AUpdate *update1, const AUpdate *update2);
+static const char* filteredIDs(const char *contents, const AUpdateFilter *filter, const char *version, const char *pkgVersion);
+static int trimMismatches(gsize len);
+static const char* scalarTrim(const char *str, gsize len, gsize *trimmedLen);
+
+/// Number of threads parsing at once in the parser stress test (one after another
+/// without gthread)
+#define PARSE_THREADS   8
+/// Number of times each of those threads parses the repository
+#define PARSE_RUNS      10
+/// Number of updates in the repository they parse
+#define PARSE_UPDATES   200
+
+/// Repository parsed by the parser stress test, and its result parsed on its own
+typedef struct {
+	const char *contents;
+	GContainer *updates;
+} ParseReference;
 
 int
 main(int argc, char *argv[]) {
@@ -60,6 +105,11 @@ main(int argc, char *argv[]) {
 	result = testToString()        && result;
 	result = testFromString()      && result;
 	result = testGContainer()      && result;
+	result = testCodecs()          && result;
+	result = testParseThreads()    && result;
+	result = testUpdateFilter()    && result;
+	result = testBestUpdates()     && result;
+	result = testTextTrim()        && result;
 	
 	if (result == TRUE)
 		printf("All tests in all categories were successful.\n\n");
@@ -102,6 +152,21 @@ testVersionCompare(void) {
 	result = testInt( "Version #20",  1, luau_versioncmp("2.0",      "2.0.0b")   ) && result;
 	result = testInt( "Version #20", -1, luau_versioncmp("2.0",      "2.0.4b")   ) && result;
 	
+	/* Versions split up beforehand compare the same way */
+	result = testInt( "Version Key #1",  1, versionKeyCmp("2-RC10f",  "2-rc2d")   ) && result;
+	result = testInt( "Version Key #2", -1, versionKeyCmp("3.1-RC3",  "3.1-rc12") ) && result;
+	result = testInt( "Version Key #3",  1, versionKeyCmp("1.6.x",    "1.5.7")    ) && result;
+	result = testInt( "Version Key #4",  0, versionKeyCmp("1.2.5",    "1.x")      ) && result;
+	result = testInt( "Version Key #5", -1, versionKeyCmp("2.0",      "2.0.4b")   ) && result;
+	result = testInt( "Version Key #6",  0, versionKeyCmp("1..2",     "1.2")      ) && result;
+	
+	/* A key is checked against the string it comes with, even at the same address */
+	result = testInt( "Version Key #7",  1, staleKeyCmp("1.0",     "3.0",     "2.0")     ) && result;
+	result = testInt( "Version Key #8", -1, staleKeyCmp("3.0",     "1.0",     "2.0")     ) && result;
+	result = testInt( "Version Key #9",  0, staleKeyCmp("1.0",     "1.0.1",   "1.0.1")   ) && result;
+	result = testInt( "Version Key #10", 0, staleKeyCmp("1.0.1",   "1.0",     "1.0")     ) && result;
+	result = testInt( "Version Key #11",-1, staleKeyCmp("1.0-RC1", "1_0.rc1", "1.0-rc2") ) && result;
+	
 	if (result)
 		printf("All tests passed.\n\n");
 	else
@@ -225,6 +290,14 @@ testFromString(void) {
 	result = testBool( "Interface Parse #3", TRUE, ret ) && result;
 	result = testBool( "Interface Parse #4", TRUE, (interf.major == -1 && interf.minor == -1) ) && result;
 	
+	result = testInt ( "Package Type Parse #1", LUAU_RPM,     luau_parsePkgType("rpm") ) && result;
+	result = testInt ( "Package Type Parse #2", LUAU_AUTOPKG, luau_parsePkgType("AutoPackage") ) && result;
+	result = testInt ( "Package Type Parse #3", LUAU_UNKNOWN, luau_parsePkgType("RPX") ) && result;
+	result = testInt ( "Package Type Parse #4", LUAU_UNKNOWN, luau_parsePkgType("") ) && result;
+
+	result = testInt ( "Quantifier Type Parse #1", LUAU_QUANT_DATA_KEYWORD, luau_parseQuantDataType("Keyword") ) && result;
+	result = testInt ( "Quantifier Type Parse #2", LUAU_QUANT_DATA_INVALID, luau_parseQuantDataType("kernel") ) && result;
+
 	if (result)
 		printf("All tests passed.\n\n");
 	else
@@ -316,6 +389,557 @@ testGContainer(void) {
 	return result;
 }
 
+/// The two pieces of the compressed files testCodecs concatenates
+#define CODEC_FIRST  "<?xml version=\"1.0\"?>\n<luau-repository interface=\"1.1\">\n"
+#define CODEC_SECOND "<program-info id=\"test\"/>\n</luau-repository>\n"
+
+static gboolean
+testCodecs(void) {
+	const char *pieces[] = { CODEC_FIRST, CODEC_SECOND };
+	char buffer[1024];
+	GString *body;
+	gboolean result = TRUE;
+	unsigned int i;
+#ifdef HAVE_LIBZ
+	z_stream z;
+#endif
+#ifdef HAVE_LIBLZMA
+	size_t pos;
+#endif
+	
+	printf("Decompression Tests\n");
+	printf("-------------------\n");
+	
+#ifdef HAVE_LIBZ
+	/* A file of two gzip members, as "cat a.gz b.gz" makes */
+	body = g_string_new("");
+	for (i = 0; i < G_N_ELEMENTS(pieces); ++i) {
+		memset(&z, 0, sizeof(z));
+		deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16+MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+		z.next_in = (Bytef *) pieces[i];
+		z.avail_in = strlen(pieces[i]);
+		z.next_out = (Bytef *) buffer;
+		z.avail_out = sizeof(buffer);
+		deflate(&z, Z_FINISH);
+		g_string_append_len(body, buffer, sizeof(buffer) - z.avail_out);
+		deflateEnd(&z);
+	}
+	result = testConcatenated("gzip", body) && result;
+	g_string_free(body, TRUE);
+#endif
+	
+#ifdef HAVE_LIBLZMA
+	body = g_string_new("");
+	for (i = 0; i < G_N_ELEMENTS(pieces); ++i) {
+		pos = 0;
+		lzma_easy_buffer_encode(6, LZMA_CHECK_CRC32, NULL, (const uint8_t *) pieces[i], strlen(pieces[i]),
+		                        (uint8_t *) buffer, &pos, sizeof(buffer));
+		g_string_append_len(body, buffer, pos);
+	}
+	result = testConcatenated("xz", body) && result;
+	g_string_free(body, TRUE);
+#endif
+	
+#ifdef HAVE_LIBZSTD
+	body = g_string_new("");
+	for (i = 0; i < G_N_ELEMENTS(pieces); ++i)
+		g_string_append_len(body, buffer, ZSTD_compress(buffer, sizeof(buffer), pieces[i], strlen(pieces[i]), 1));
+	result = testConcatenated("zstd", body) && result;
+	g_string_free(body, TRUE);
+#endif
+	
+	if (result)
+		printf("All tests passed.\n\n");
+	else
+		printf("Some tests failed.\n\n");
+	
+	return result;
+}
+
+/* Uncompress a file of two compressed streams, all at once and then a few bytes at a
+   time (so that the second stream starts in the middle of a piece, or at the start of one) */
+static gboolean
+testConcatenated(const char *name, const GString *body) {
+	const gsize pieceSizes[] = { 0, 1, 5 };
+	ADecoder *decoder;
+	GString *decoded;
+	gboolean result = TRUE, ok;
+	gsize pos, n;
+	unsigned int i;
+	char *test;
+	
+	for (i = 0; i < G_N_ELEMENTS(pieceSizes); ++i) {
+		decoder = luau_codec_newDecoder(luau_codec_detect(body->str, body->len), NULL);
+		decoded = g_string_new("");
+		ok = TRUE;
+		for (pos = 0; ok && pos < body->len; pos += n) {
+			n = (pieceSizes[i] > 0) ? MIN(pieceSizes[i], body->len - pos) : body->len;
+			ok = luau_codec_decode(decoder, body->str + pos, n, appendDecoded, decoded, NULL);
+		}
+		
+		test = g_strdup_printf("%s Concatenated #%u", name, 2*i + 1);
+		result = testStr( test, CODEC_FIRST CODEC_SECOND, ok ? decoded->str : NULL ) && result;
+		g_free(test);
+		test = g_strdup_printf("%s Concatenated #%u", name, 2*i + 2);
+		result = testBool( test, TRUE, luau_codec_isFinished(decoder) ) && result;
+		g_free(test);
+		
+		g_string_free(decoded, TRUE);
+		luau_codec_freeDecoder(decoder);
+	}
+	
+	return result;
+}
+
+static gboolean
+appendDecoded(const char *data, gsize len, gpointer userData, GError **err) {
+	g_string_append_len((GString *) userData, data, len);
+	return TRUE;
+}
+
+static gboolean
+testParseThreads(void) {
+	ParseReference reference;
+	GString *contents;
+	gboolean result;
+	int i, good = 0;
+#ifdef USE_GTHREADS
+	GThread *thread[PARSE_THREADS];
+#endif
+	
+	printf("Parallel Parsing Tests\n");
+	printf("----------------------\n");
+	
+	contents = makeRepository(PARSE_UPDATES);
+	reference.contents = contents->str;
+	reference.updates = luau_parseXML_updates(contents->str, NULL);
+	
+	result = testBool( "Parse #1", TRUE, reference.updates != NULL );
+	if (reference.updates != NULL) {
+		result = testInt( "Parse #2", PARSE_UPDATES, reference.updates->len ) && result;
+		
+#ifdef USE_GTHREADS
+		if (!g_thread_supported())
+			g_thread_init(NULL);
+		
+		for (i = 0; i < PARSE_THREADS; ++i)
+			thread[i] = g_thread_create(parseRepository, &reference, TRUE, NULL);
+		for (i = 0; i < PARSE_THREADS; ++i)
+			good += GPOINTER_TO_INT(g_thread_join(thread[i]));
+#else
+		for (i = 0; i < PARSE_THREADS; ++i)
+			good += GPOINTER_TO_INT(parseRepository(&reference));
+#endif
+		
+		result = testInt( "Parse #3", PARSE_THREADS * PARSE_RUNS, good ) && result;
+		
+		luau_freeUpdateList(g_container_free(reference.updates, FALSE));
+	}
+	
+	g_string_free(contents, TRUE);
+	
+	if (result)
+		printf("All tests passed.\n\n");
+	else
+		printf("Some tests failed.\n\n");
+	
+	return result;
+}
+
+/* Build a repository file with the given number of <software> updates */
+static GString *
+makeRepository(int count) {
+	GString *contents;
+	int i;
+	
+	contents = g_string_new("<?xml version=\"1.0\"?>\n<luau-repository interface=\"1.1\">\n");
+	g_string_append(contents, "<program-info id=\"test\"><shortname>test</shortname></program-info>\n");
+	g_string_append(contents, "<mirror-list id=\"main\"><mirror-def id=\"m1\">http://example.com/</mirror-def></mirror-list>\n");
+	
+	for (i = 0; i < count; ++i)
+		g_string_append_printf(contents,
+		                       "<software version=\"1.%d\"><short>Release %d</short><long>Release %d of test.</long>"
+		                       "<keyword>k%d</keyword><keyword>all</keyword><date>2005-%d-%d</date>"
+		                       "<package type=\"rpm\" size=\"%d\" mirror-id=\"main\" filename=\"test-1.%d.rpm\"/>"
+		                       "<package type=\"tgz\" size=\"%d\"><mirror>http://example.org/test-1.%d.tar.gz</mirror></package>"
+		                       "</software>\n",
+		                       i, i, i, i % 10, i % 12 + 1, i % 28 + 1, i * 100, i, i * 200, i);
+	
+	g_string_append(contents, "</luau-repository>\n");
+	
+	return contents;
+}
+
+/* Thread body: parse the repository PARSE_RUNS times, returning how many of the
+   parses came out the same as the reference parse, field by field */
+static gpointer
+parseRepository(gpointer reference) {
+	const ParseReference *ref = reference;
+	GContainer *updates;
+	gboolean same;
+	int i, good = 0;
+	unsigned int j;
+	
+	for (i = 0; i < PARSE_RUNS; ++i) {
+		updates = luau_parseXML_updates((char *) ref->contents, NULL);
+		if (updates == NULL)
+			continue;
+		
+		same = (updates->len == ref->updates->len);
+		for (j = 0; same && j < updates->len; ++j)
+			same = sameUpdate(g_container_index(updates, j), g_container_index(ref->updates, j));
+		if (same)
+			++good;
+		
+		luau_freeUpdateList(g_container_free(updates, FALSE));
+	}
+	
+	return GINT_TO_POINTER(good);
+}
+
+static gboolean
+sameString(const char *str1, const char *str2) {
+	if (str1 == NULL || str2 == NULL)
+		return (str1 == str2);
+	else
+		return (strcmp(str1, str2) == 0);
+}
+
+static gboolean
+samePackage(const APackage *pkg1, const APackage *pkg2) {
+	GPtrArray *mirrors1, *mirrors2;
+	gboolean same;
+	unsigned int i;
+	
+	if (pkg1->type != pkg2->type || pkg1->size != pkg2->size ||
+	    !sameString(pkg1->md5sum, pkg2->md5sum) || !sameString(pkg1->version, pkg2->version))
+		return FALSE;
+	
+	mirrors1 = luau_getPackageMirrors(pkg1);
+	mirrors2 = luau_getPackageMirrors(pkg2);
+	
+	same = (mirrors1->len == mirrors2->len);
+	for (i = 0; same && i < mirrors1->len; i += 2)
+		same = (g_ptr_array_index(mirrors1, i) == g_ptr_array_index(mirrors2, i)) &&
+		       sameString(g_ptr_array_index(mirrors1, i+1), g_ptr_array_index(mirrors2, i+1));
+	
+	luau_freePackageMirrors(mirrors1);
+	luau_freePackageMirrors(mirrors2);
+	
+	return same;
+}
+
+static gboolean
+sameUpdate(const AUpdate *update1, const AUpdate *update2) {
+	unsigned int i;
+	
+	if (!sameString(update1->id, update2->id) || update1->type != update2->type ||
+	    !sameString(update1->shortDesc, update2->shortDesc) ||
+	    !sameString(update1->fullDesc, update2->fullDesc) ||
+	    !sameString(update1->newVersion, update2->newVersion) ||
+	    !sameString(update1->newDisplayVersion, update2->newDisplayVersion) ||
+	    !sameString(update1->newURL, update2->newURL) ||
+	    update1->availableFormats != update2->availableFormats ||
+	    update1->interface.major != update2->interface.major ||
+	    update1->interface.minor != update2->interface.minor)
+		return FALSE;
+	
+	if ((update1->date == NULL) != (update2->date == NULL) ||
+	    (update1->date != NULL && luau_datecmp(update1->date, update2->date) != 0))
+		return FALSE;
+	
+	if ((update1->keywords == NULL) != (update2->keywords == NULL))
+		return FALSE;
+	if (update1->keywords != NULL) {
+		if (update1->keywords->len != update2->keywords->len)
+			return FALSE;
+		for (i = 0; i < update1->keywords->len; ++i)
+			if (!sameString(g_ptr_array_index(update1->keywords, i), g_ptr_array_index(update2->keywords, i)))
+				return FALSE;
+	}
+	
+	if ((update1->quantifiers == NULL) != (update2->quantifiers == NULL) ||
+	    (update1->quantifiers != NULL && update1->quantifiers->len != update2->quantifiers->len))
+		return FALSE;
+	
+	if ((update1->packages == NULL) != (update2->packages == NULL))
+		return FALSE;
+	if (update1->packages != NULL) {
+		if (update1->packages->len != update2->packages->len)
+			return FALSE;
+		for (i = 0; i < update1->packages->len; ++i)
+			if (!samePackage(g_ptr_array_index(update1->packages, i), g_ptr_array_index(update2->packages, i)))
+				return FALSE;
+	}
+	
+	return TRUE;
+}
+
+static gboolean
+testUpdateFilter(void) {
+	AUpdateFilter filter;
+	gboolean result;
+	/* b, c and d are the same version as the one installed (2.0), with package
+	   versions 2.0-1, 2.0-3 and 2.0-2 */
+	const char *contents =
+		"<?xml version=\"1.0\"?>\n<luau-repository interface=\"1.1\">\n"
+		"<software version=\"1.0\"><id>a</id><interface version=\"1.0\"/>"
+		"<package type=\"rpm\" version=\"1.0-1\"><mirror>http://example.com/a.rpm</mirror></package></software>\n"
+		"<software version=\"2.0\"><id>b</id><interface version=\"2.0\"/>"
+		"<package type=\"deb\" version=\"2.0-1\"><mirror>http://example.com/b.deb</mirror></package></software>\n"
+		"<software version=\"2.0\"><id>c</id><interface version=\"2.1\"/><package-group type=\"rpm\">"
+		"<package version=\"2.0-3\"><mirror>http://example.com/c.rpm</mirror></package></package-group></software>\n"
+		"<software version=\"2.0\"><id>d</id>"
+		"<package type=\"rpm\" version=\"2.0-2\"><mirror>http://example.com/d.rpm</mirror></package></software>\n"
+		"<update type=\"message\"><id>e</id><short>Message</short></update>\n"
+		"<software version=\"3.0\"><id>f</id><interface version=\"2.3\"/>"
+		"<package type=\"src\" version=\"3.0-1\"><mirror>http://example.com/f.tar.gz</mirror></package></software>\n"
+		"</luau-repository>\n";
+	
+	printf("Update Filter Tests\n");
+	printf("-------------------\n");
+	
+	luau_initUpdateFilter(&filter);
+	filter.type = LUAU_MESSAGE;
+	result = testStr( "Filter #1", "e", filteredIDs(contents, &filter, "2.0", NULL) );
+	
+	/* Same version as the one installed: newer only if a package is */
+	luau_initUpdateFilter(&filter);
+	filter.newerOnly = TRUE;
+	result = testStr( "Filter #2", "e,f",       filteredIDs(contents, &filter, "2.0", NULL)     ) && result;
+	result = testStr( "Filter #3", "c,e,f",     filteredIDs(contents, &filter, "2.0", "2.0-2")  ) && result;
+	result = testStr( "Filter #4", "b,c,d,e,f", filteredIDs(contents, &filter, "2.0", "2.0-0")  ) && result;
+	result = testStr( "Filter #5", "e",         filteredIDs(contents, &filter, "3.0", "3.0-1")  ) && result;
+	
+	/* Package types, including one given by a <package-group> */
+	luau_initUpdateFilter(&filter);
+	filter.formats = LUAU_RPM;
+	result = testStr( "Filter #6", "a,c,d", filteredIDs(contents, &filter, "2.0", NULL) ) && result;
+	filter.formats = LUAU_DEB | LUAU_SRC;
+	result = testStr( "Filter #7", "b,f",   filteredIDs(contents, &filter, "2.0", NULL) ) && result;
+	
+	luau_initUpdateFilter(&filter);
+	filter.interfaceMajor = 2;
+	result = testStr( "Filter #8", "b,c,f", filteredIDs(contents, &filter, "2.0", NULL) ) && result;
+	filter.interfaceMajor = 1;
+	result = testStr( "Filter #9", "a",     filteredIDs(contents, &filter, "2.0", NULL) ) && result;
+	
+	filter.interfaceMajor = 2;
+	filter.formats = LUAU_RPM;
+	filter.newerOnly = TRUE;
+	result = testStr( "Filter #10", "c", filteredIDs(contents, &filter, "2.0", "2.0-0") ) && result;
+	
+	if (result)
+		printf("All tests passed.\n\n");
+	else
+		printf("Some tests failed.\n\n");
+	
+	return result;
+}
+
+static gboolean
+testBestUpdates(void) {
+	AUpdateFilter filter;
+	gboolean result;
+	/* By version: d and e tie (same version and package version), then b, c, a, f;
+	   by interface: c and e tie, then a and d tie, then b, f */
+	const char *contents =
+		"<?xml version=\"1.0\"?>\n<luau-repository interface=\"1.1\">\n"
+		"<software version=\"1.0\"><id>a</id><interface version=\"2.0\"/></software>\n"
+		"<software version=\"1.2\"><id>b</id><interface version=\"1.5\"/>"
+		"<package type=\"rpm\" version=\"2\"><mirror>http://example.com/b.rpm</mirror></package></software>\n"
+		"<software version=\"1.1\"><id>c</id><interface version=\"2.1\"/></software>\n"
+		"<software version=\"1.2\"><id>d</id><interface version=\"2.0\"/>"
+		"<package type=\"rpm\" version=\"3\"><mirror>http://example.com/d.rpm</mirror></package></software>\n"
+		"<software version=\"1.2\"><id>e</id><interface version=\"2.1\"/>"
+		"<package type=\"rpm\" version=\"3\"><mirror>http://example.com/e.rpm</mirror></package></software>\n"
+		"<software version=\"0.9\"><id>f</id><interface version=\"1.0\"/></software>\n"
+		"</luau-repository>\n";
+	
+	printf("Best Updates Tests\n");
+	printf("------------------\n");
+	
+	luau_initUpdateFilter(&filter);
+	result = testStr( "Best #1", "a,b,c,d,e,f", filteredIDs(contents, &filter, "1.0", NULL) );
+	
+	filter.limit = 3;
+	result = testStr( "Best #2", "d,e,b", filteredIDs(contents, &filter, "1.0", NULL) ) && result;
+	filter.limit = 1;
+	result = testStr( "Best #3", "d", filteredIDs(contents, &filter, "1.0", NULL) ) && result;
+	filter.limit = 10;
+	result = testStr( "Best #4", "d,e,b,c,a,f", filteredIDs(contents, &filter, "1.0", NULL) ) && result;
+	
+	filter.order = LUAU_ORDER_INTERFACE;
+	filter.limit = 2;
+	result = testStr( "Best #5", "c,e", filteredIDs(contents, &filter, "1.0", NULL) ) && result;
+	filter.limit = 4;
+	result = testStr( "Best #6", "c,e,a,d", filteredIDs(contents, &filter, "1.0", NULL) ) && result;
+	filter.limit = 6;
+	result = testStr( "Best #7", "c,e,a,d,b,f", filteredIDs(contents, &filter, "1.0", NULL) ) && result;
+	
+	/* Only those passing the rest of the filter are ranked */
+	filter.order = LUAU_ORDER_NEWEST;
+	filter.newerOnly = TRUE;
+	filter.limit = 4;
+	result = testStr( "Best #8", "d,e,b", filteredIDs(contents, &filter, "1.1", NULL) ) && result;
+	
+	if (result)
+		printf("All tests passed.\n\n");
+	else
+		printf("Some tests failed.\n\n");
+	
+	return result;
+}
+
+/* Parse a repository file through a filter (for a program of the given version and
+   package version), returning the IDs of the updates that come out, in order and
+   separated by commas (overwritten by the next call) */
+static const char *
+filteredIDs(const char *contents, const AUpdateFilter *filter, const char *version, const char *pkgVersion) {
+	static char ids[128];
+	AUpdatesParser *parser;
+	GContainer *updates;
+	AProgInfo installed;
+	AUpdate *update;
+	int i;
+	
+	memset(&installed, 0, sizeof(AProgInfo));
+	installed.id = "test";
+	installed.version = (char *) version;
+	installed.pkgVersion = (char *) pkgVersion;
+	
+	parser = luau_parseXML_updatesNew();
+	luau_parseXML_updatesSetFilter(parser, filter, &installed);
+	luau_parseXML_updatesFeed(parser, contents, strlen(contents), NULL);
+	updates = luau_parseXML_updatesFinish(parser, NULL);
+	
+	ids[0] = '\0';
+	if (updates == NULL)
+		return ids;
+	
+	for (i = 0; i < updates->len; ++i) {
+		update = g_container_index(updates, i);
+		if (i > 0)
+			g_strlcat(ids, ",", sizeof(ids));
+		g_strlcat(ids, update->id, sizeof(ids));
+	}
+	
+	luau_freeUpdateList(g_container_free(updates, FALSE));
+	
+	return ids;
+}
+
+static gboolean
+testTextTrim(void) {
+	GContainer *updates;
+	AUpdate *update;
+	APackage *package;
+	const char *trimmed;
+	gsize len;
+	gboolean result;
+	const char *contents =
+		"<?xml version=\"1.0\"?>\n<luau-repository interface=\"1.1\">\n"
+		"<software version=\"1.0\"><package-group filename=\"test-1.0.rpm\"><package type=\"rpm\">"
+		"<mirror></mirror><mirror> \n\t </mirror><mirror>\n  http://example.com/  \n</mirror>"
+		"</package></package-group></software>\n"
+		"</luau-repository>\n";
+	
+	printf("Text Trimming Tests\n");
+	printf("-------------------\n");
+	
+	/* Every split of each length into leading whitespace, text (with whitespace
+	   inside it) and trailing whitespace, around the 16 and 32-byte scanning widths */
+	result = testInt( "Trim #1",  0, trimMismatches(0)  );
+	result = testInt( "Trim #2",  0, trimMismatches(1)  ) && result;
+	result = testInt( "Trim #3",  0, trimMismatches(15) ) && result;
+	result = testInt( "Trim #4",  0, trimMismatches(16) ) && result;
+	result = testInt( "Trim #5",  0, trimMismatches(17) ) && result;
+	result = testInt( "Trim #6",  0, trimMismatches(31) ) && result;
+	result = testInt( "Trim #7",  0, trimMismatches(32) ) && result;
+	result = testInt( "Trim #8",  0, trimMismatches(33) ) && result;
+	result = testInt( "Trim #9",  0, trimMismatches(64) ) && result;
+	result = testInt( "Trim #10", 0, trimMismatches(65) ) && result;
+	
+	trimmed = luau_text_trim("", 0, &len);
+	result = testInt( "Trim #11", 0, len ) && result;
+	trimmed = luau_text_trim(" \t\r\n \t\r\n \t\r\n \t\r\n \t\r\n \t\r\n \t\r\n \t\r\n ", 33, &len);
+	result = testInt( "Trim #12", 0, len ) && result;
+	trimmed = luau_text_trim("\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\tSome  text\t\there\n\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t", 50, &len);
+	result = testBool( "Trim #13", TRUE, len == 16 && strncmp(trimmed, "Some  text\t\there", len) == 0 ) && result;
+	
+	/* An empty <mirror> is just the package's filename */
+	updates = luau_parseXML_updates((char *) contents, NULL);
+	result = testBool( "Mirror Text #1", TRUE, updates != NULL && updates->len == 1 ) && result;
+	if (updates != NULL && updates->len == 1) {
+		update = g_container_index(updates, 0);
+		package = g_ptr_array_index(update->packages, 0);
+		result = testInt( "Mirror Text #2", 6, package->mirrors->len ) && result;
+		if (package->mirrors->len == 6) {
+			result = testStr( "Mirror Text #3", "test-1.0.rpm", g_ptr_array_index(package->mirrors, 1) ) && result;
+			result = testStr( "Mirror Text #4", "test-1.0.rpm", g_ptr_array_index(package->mirrors, 3) ) && result;
+			result = testStr( "Mirror Text #5", "http://example.com/test-1.0.rpm", g_ptr_array_index(package->mirrors, 5) ) && result;
+		}
+	}
+	if (updates != NULL)
+		luau_freeUpdateList(g_container_free(updates, FALSE));
+	
+	if (result)
+		printf("All tests passed.\n\n");
+	else
+		printf("Some tests failed.\n\n");
+	
+	return result;
+}
+
+/* Trim every string of the given length made up of some whitespace, some text with
+   runs of whitespace inside it and some more whitespace, returning how many times
+   luau_text_trim disagrees with scalarTrim.  The bytes either side of each string
+   aren't whitespace, so looking past either end of it gives the wrong answer. */
+static int
+trimMismatches(gsize len) {
+	static const char spaces[] = " \t\n\r";
+	char buffer[128];
+	char *str = buffer + 16;
+	const char *trimmed, *expected;
+	gsize lead, trail, i, trimmedLen, expectedLen;
+	int wrong = 0;
+	
+	g_assert(len + 32 <= sizeof(buffer));
+	
+	for (lead = 0; lead <= len; ++lead) {
+		for (trail = 0; lead + trail <= len; ++trail) {
+			memset(buffer, 'x', sizeof(buffer));
+			for (i = 0; i < len; ++i) {
+				if (i < lead || i >= len - trail || (i - lead) % 7 >= 4)
+					str[i] = spaces[i % 4];
+				else
+					str[i] = 'a' + i % 26;
+			}
+			
+			trimmed = luau_text_trim(str, len, &trimmedLen);
+			expected = scalarTrim(str, len, &expectedLen);
+			if (trimmed != expected || trimmedLen != expectedLen)
+				++wrong;
+		}
+	}
+	
+	return wrong;
+}
+
+/* luau_text_trim a byte at a time */
+static const char *
+scalarTrim(const char *str, gsize len, gsize *trimmedLen) {
+	const char *end = str + len;
+	
+	while (str < end && (*str == ' ' || *str == '\t' || *str == '\n' || *str == '\r'))
+		++str;
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+		--end;
+	
+	*trimmedLen = end - str;
+	return str;
+}
+
 static ADate *
 setDate(ADate *date, int month, int day, int year) {
 	date->day = day;
@@ -330,3 +954,34 @@ setInterf(AInterface *interf, int major, int minor) {
 	interf->minor = minor;
 	return interf;
 }
+
+static int
+versionKeyCmp(const char *required, const char *current) {
+	AVersionKey *req, *cur;
+	int result;
+	
+	req = luau_versionkey_new(required);
+	cur = luau_versionkey_new(current);
+	result = luau_versionkey_cmp(req, cur);
+	g_free(req);
+	g_free(cur);
+	
+	return result;
+}
+
+/* Compare \c required with \c current, passing along a key built for the version
+   that used to be where \c required is now */
+static int
+staleKeyCmp(const char *built, const char *required, const char *current) {
+	AVersionKey *key;
+	char version[32];
+	int result;
+	
+	g_strlcpy(version, built, sizeof(version));
+	key = luau_versionkey_new(version);
+	g_strlcpy(version, required, sizeof(version));
+	result = luau_versionkey_cmpCached(version, key, current, NULL);
+	g_free(key);
+	
+	return result;
+}